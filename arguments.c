@@ -0,0 +1,113 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Storage helpers for parsed command lines: a string arena that is
+ * reset after every command, and a growable argument vector.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell2.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARGUMENT_VECTOR_INITIAL_CAPACITY 64
+
+/**
+ * Allocate length bytes from the arena, adding a block when needed
+ * @param arena Arena to allocate from
+ * @param length Number of bytes
+ * @return Pointer to uninitialized memory, aligned for pointers
+ */
+void* string_arena_alloc(string_arena* arena, size_t length) {
+  string_arena_block* block = arena->head;
+  size_t aligned_length = (length + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  size_t block_size;
+  void* result;
+
+  if (block == NULL || block->size - block->used < aligned_length) {
+    block_size = aligned_length > ARENA_BLOCK_SIZE ? aligned_length : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(string_arena_block) + block_size);
+    if (block == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+  }
+  result = block->data + block->used;
+  block->used += aligned_length;
+  return result;
+}
+
+/**
+ * Copy length bytes of text into the arena as a terminated string
+ */
+char* string_arena_strndup(string_arena* arena, const char* text, size_t length) {
+  char* copy = string_arena_alloc(arena, length + 1);
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+char* string_arena_strdup(string_arena* arena, const char* text) {
+  return string_arena_strndup(arena, text, strlen(text));
+}
+
+/**
+ * Release every string in the arena. The most recent block is kept
+ * so that ordinary command lines never touch malloc.
+ * @param arena Arena to reset
+ */
+void string_arena_reset(string_arena* arena) {
+  string_arena_block* block;
+  string_arena_block* next;
+
+  if (arena->head == NULL) {
+    return;
+  }
+  block = arena->head->next;
+  while (block != NULL) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head->next = NULL;
+  arena->head->used = 0;
+}
+
+/**
+ * Append an argument, keeping the list NULL-terminated
+ * @param vector Vector to append to
+ * @param argument String to append (not copied)
+ */
+void argument_vector_push(argument_vector* vector, char* argument) {
+  size_t new_capacity;
+  char** new_items;
+
+  if (vector->count + 1 >= vector->capacity) {
+    new_capacity = vector->capacity ? vector->capacity * 2 : ARGUMENT_VECTOR_INITIAL_CAPACITY;
+    new_items = realloc(vector->items, new_capacity * sizeof(char*));
+    if (new_items == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+    vector->items = new_items;
+    vector->capacity = new_capacity;
+  }
+  vector->items[vector->count++] = argument;
+  vector->items[vector->count] = NULL;
+}
+
+/**
+ * Empty the vector without releasing its storage
+ */
+void argument_vector_clear(argument_vector* vector) {
+  vector->count = 0;
+  if (vector->items != NULL) {
+    vector->items[0] = NULL;
+  }
+}
@@ -0,0 +1,491 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * 64-bit integer arithmetic for $((...)) and the let builtin.
+ *
+ * A recursive-descent parser evaluates the expression as it reads it,
+ * with C operator precedence:
+ *   ,  = += -= *= /= %= <<= >>= &= ^= |=  ?:  ||  &&  |  ^  &
+ *   == !=  < <= > >=  << >>  + -  * / %  **  unary + - ! ~ ++ --
+ * Variables are read and written by name; an unset or empty variable
+ * is 0. Overflow wraps around instead of being undefined.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "shell2.h"
+
+#define MAX_VARIABLE_NAME_LENGTH 256
+#define MAX_RECURSION_DEPTH 32
+
+typedef struct {
+  const char* cursor;
+  const char* error;
+  int skip;   /* > 0 inside a branch that is not taken: no side effects */
+  int depth;  /* nesting of variable values evaluated as expressions */
+} arithmetic_parser;
+
+static int64_t parse_comma(arithmetic_parser* parser);
+static int64_t parse_assignment(arithmetic_parser* parser);
+static int64_t parse_unary(arithmetic_parser* parser);
+static int64_t parse_power(arithmetic_parser* parser);
+static bool evaluate_with_depth(const char* expression, int64_t* result, int depth);
+
+static void skip_blanks(arithmetic_parser* parser) {
+  while (isspace((unsigned char)*parser->cursor)) {
+    parser->cursor++;
+  }
+}
+
+static void set_error(arithmetic_parser* parser, const char* message) {
+  if (parser->error == NULL) {
+    parser->error = message;
+  }
+}
+
+/**
+ * Consume token if it comes next and is not the start of a longer
+ * operator listed in not_followed_by
+ */
+static bool accept(arithmetic_parser* parser, const char* token, const char* not_followed_by) {
+  size_t length = strlen(token);
+
+  skip_blanks(parser);
+  if (strncmp(parser->cursor, token, length) != 0) {
+    return false;
+  }
+  if (not_followed_by != NULL && parser->cursor[length] != '\0' &&
+      strchr(not_followed_by, parser->cursor[length]) != NULL) {
+    return false;
+  }
+  parser->cursor += length;
+  return true;
+}
+
+static bool is_name_start(char c) {
+  return isalpha((unsigned char)c) || c == '_';
+}
+
+/**
+ * Read an identifier into name
+ * @return false if the next token is not an identifier
+ */
+static bool read_name(arithmetic_parser* parser, char* name) {
+  size_t length = 0;
+
+  skip_blanks(parser);
+  /* $name is accepted as a synonym for name */
+  if (parser->cursor[0] == '$' && is_name_start(parser->cursor[1])) {
+    parser->cursor++;
+  }
+  if (!is_name_start(*parser->cursor)) {
+    return false;
+  }
+  while (isalnum((unsigned char)*parser->cursor) || *parser->cursor == '_') {
+    if (length + 1 >= MAX_VARIABLE_NAME_LENGTH) {
+      set_error(parser, "variable name too long");
+      return false;
+    }
+    name[length++] = *parser->cursor++;
+  }
+  name[length] = '\0';
+  return true;
+}
+
+/**
+ * Value of a variable; its text is itself evaluated as an expression
+ */
+static int64_t get_variable(arithmetic_parser* parser, const char* name) {
+  const char* value = variable_get(name);
+  int64_t result = 0;
+
+  if (value == NULL || *value == '\0') {
+    return 0;
+  }
+  if (parser->depth >= MAX_RECURSION_DEPTH) {
+    set_error(parser, "expression recursion level exceeded");
+    return 0;
+  }
+  if (!evaluate_with_depth(value, &result, parser->depth + 1)) {
+    set_error(parser, "invalid variable value");
+  }
+  return result;
+}
+
+static void set_variable(arithmetic_parser* parser, const char* name, int64_t value) {
+  char text[32];
+
+  if (parser->skip > 0 || parser->error != NULL) {
+    return;
+  }
+  snprintf(text, sizeof(text), "%lld", (long long)value);
+  variable_set(name, text, false);
+}
+
+static int64_t wrap_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static int64_t wrap_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+static int64_t wrap_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+/**
+ * Apply a binary operator, checking division by zero
+ */
+static int64_t apply_operator(arithmetic_parser* parser, const char* op, int64_t left, int64_t right) {
+  int64_t result = 1;
+
+  switch (op[0]) {
+  case '+': return wrap_add(left, right);
+  case '-': return wrap_sub(left, right);
+  case '*':
+    if (op[1] != '*') {
+      return wrap_mul(left, right);
+    }
+    if (right < 0) {
+      set_error(parser, "exponent less than 0");
+      return 0;
+    }
+    while (right > 0) {
+      if (right & 1) {
+        result = wrap_mul(result, left);
+      }
+      left = wrap_mul(left, left);
+      right >>= 1;
+    }
+    return result;
+  case '/':
+  case '%':
+    if (right == 0) {
+      if (parser->skip == 0) {
+        set_error(parser, "division by 0");
+      }
+      return 0;
+    }
+    if (left == INT64_MIN && right == -1) {
+      return op[0] == '/' ? INT64_MIN : 0;
+    }
+    return op[0] == '/' ? left / right : left % right;
+  case '<': return (int64_t)((uint64_t)left << (right & 63));
+  case '>': return left >> (right & 63);
+  case '&': return left & right;
+  case '^': return left ^ right;
+  case '|': return left | right;
+  }
+  set_error(parser, "unknown operator");
+  return 0;
+}
+
+/**
+ * primary: number | name | name++ | name-- | ( expression )
+ */
+static int64_t parse_primary(arithmetic_parser* parser) {
+  char name[MAX_VARIABLE_NAME_LENGTH];
+  const char* start;
+  char* end;
+  int64_t value;
+
+  skip_blanks(parser);
+  /* A nested $((...)) is just a parenthesised expression here */
+  if (parser->cursor[0] == '$' && parser->cursor[1] == '(') {
+    parser->cursor++;
+  }
+  if (accept(parser, "(", NULL)) {
+    value = parse_comma(parser);
+    if (!accept(parser, ")", NULL)) {
+      set_error(parser, "missing ')'");
+    }
+    return value;
+  }
+  if (isdigit((unsigned char)*parser->cursor)) {
+    start = parser->cursor;
+    value = (int64_t)strtoull(start, &end, 0);
+    if (isalnum((unsigned char)*end) || *end == '_') {
+      set_error(parser, "value too great for base");
+    }
+    parser->cursor = end;
+    return value;
+  }
+  if (read_name(parser, name)) {
+    value = get_variable(parser, name);
+    if (accept(parser, "++", NULL)) {
+      set_variable(parser, name, wrap_add(value, 1));
+    }
+    else if (accept(parser, "--", NULL)) {
+      set_variable(parser, name, wrap_sub(value, 1));
+    }
+    return value;
+  }
+  set_error(parser, *parser->cursor ? "syntax error: operand expected" : "syntax error: missing operand");
+  return 0;
+}
+
+/**
+ * unary: ++name | --name | + - ! ~ unary | primary
+ */
+static int64_t parse_unary(arithmetic_parser* parser) {
+  char name[MAX_VARIABLE_NAME_LENGTH];
+  const char* saved;
+  int64_t value;
+  int delta;
+
+  skip_blanks(parser);
+  if (strncmp(parser->cursor, "++", 2) == 0 || strncmp(parser->cursor, "--", 2) == 0) {
+    saved = parser->cursor;
+    delta = parser->cursor[0] == '+' ? 1 : -1;
+    parser->cursor += 2;
+    if (read_name(parser, name)) {
+      value = wrap_add(get_variable(parser, name), delta);
+      set_variable(parser, name, value);
+      return value;
+    }
+    /* Not an increment: treat as two signs, e.g. --5 */
+    parser->cursor = saved;
+  }
+  if (accept(parser, "+", NULL)) {
+    return parse_unary(parser);
+  }
+  if (accept(parser, "-", NULL)) {
+    return wrap_sub(0, parse_unary(parser));
+  }
+  if (accept(parser, "!", "=")) {
+    return !parse_unary(parser);
+  }
+  if (accept(parser, "~", NULL)) {
+    return ~parse_unary(parser);
+  }
+  return parse_primary(parser);
+}
+
+/**
+ * power: unary ( ** power )?   (right associative; as in bash, a sign
+ * binds tighter, so -2**2 is 4)
+ */
+static int64_t parse_power(arithmetic_parser* parser) {
+  int64_t base = parse_unary(parser);
+
+  if (accept(parser, "**", NULL)) {
+    return apply_operator(parser, "**", base, parse_power(parser));
+  }
+  return base;
+}
+
+/*
+ * Left-associative binary levels, from tightest to loosest binding.
+ * Each entry lists its operators and, for each, characters that must
+ * not follow it (so "<" does not swallow "<=" or "<<").
+ */
+typedef struct {
+  const char* token;
+  const char* not_followed_by;
+} operator_token;
+
+static const operator_token multiplicative_ops[] = { {"*", "*="}, {"/", "="}, {"%", "="}, {NULL, NULL} };
+static const operator_token additive_ops[] = { {"+", "+="}, {"-", "-="}, {NULL, NULL} };
+static const operator_token shift_ops[] = { {"<<", "="}, {">>", "="}, {NULL, NULL} };
+static const operator_token relational_ops[] = { {"<=", NULL}, {">=", NULL}, {"<", "<"}, {">", ">"}, {NULL, NULL} };
+static const operator_token equality_ops[] = { {"==", NULL}, {"!=", NULL}, {NULL, NULL} };
+static const operator_token bit_and_ops[] = { {"&", "&="}, {NULL, NULL} };
+static const operator_token bit_xor_ops[] = { {"^", "="}, {NULL, NULL} };
+static const operator_token bit_or_ops[] = { {"|", "|="}, {NULL, NULL} };
+
+static const operator_token* const binary_levels[] = {
+  multiplicative_ops, additive_ops, shift_ops, relational_ops,
+  equality_ops, bit_and_ops, bit_xor_ops, bit_or_ops
+};
+
+#define BINARY_LEVEL_COUNT (sizeof(binary_levels) / sizeof(binary_levels[0]))
+
+static int64_t compare(const char* op, int64_t left, int64_t right) {
+  if (strcmp(op, "<=") == 0) return left <= right;
+  if (strcmp(op, ">=") == 0) return left >= right;
+  if (strcmp(op, "<") == 0) return left < right;
+  if (strcmp(op, ">") == 0) return left > right;
+  if (strcmp(op, "==") == 0) return left == right;
+  return left != right;
+}
+
+/**
+ * Parse a left-associative binary level
+ * @param level Index into binary_levels (-1 means power)
+ */
+static int64_t parse_binary(arithmetic_parser* parser, int level) {
+  const operator_token* op;
+  int64_t left, right;
+  bool matched;
+
+  if (level < 0) {
+    return parse_power(parser);
+  }
+  left = parse_binary(parser, level - 1);
+  do {
+    matched = false;
+    for (op = binary_levels[level]; op->token != NULL; op++) {
+      if (accept(parser, op->token, op->not_followed_by)) {
+        right = parse_binary(parser, level - 1);
+        if (binary_levels[level] == relational_ops || binary_levels[level] == equality_ops) {
+          left = compare(op->token, left, right);
+        } else {
+          left = apply_operator(parser, op->token, left, right);
+        }
+        matched = true;
+        break;
+      }
+    }
+  } while (matched && parser->error == NULL);
+  return left;
+}
+
+/**
+ * logical_and: bitwise_or ( && bitwise_or )*   (short-circuit)
+ */
+static int64_t parse_logical_and(arithmetic_parser* parser) {
+  int64_t left = parse_binary(parser, BINARY_LEVEL_COUNT - 1);
+  int64_t right;
+
+  while (accept(parser, "&&", NULL)) {
+    if (!left) {
+      parser->skip++;
+    }
+    right = parse_binary(parser, BINARY_LEVEL_COUNT - 1);
+    if (!left) {
+      parser->skip--;
+    }
+    left = left && right;
+  }
+  return left;
+}
+
+/**
+ * logical_or: logical_and ( || logical_and )*   (short-circuit)
+ */
+static int64_t parse_logical_or(arithmetic_parser* parser) {
+  int64_t left = parse_logical_and(parser);
+  int64_t right;
+
+  while (accept(parser, "||", NULL)) {
+    if (left) {
+      parser->skip++;
+    }
+    right = parse_logical_and(parser);
+    if (left) {
+      parser->skip--;
+    }
+    left = left || right;
+  }
+  return left;
+}
+
+/**
+ * conditional: logical_or ( ? expression : conditional )?
+ */
+static int64_t parse_conditional(arithmetic_parser* parser) {
+  int64_t condition = parse_logical_or(parser);
+  int64_t when_true, when_false;
+
+  if (!accept(parser, "?", NULL)) {
+    return condition;
+  }
+  if (!condition) {
+    parser->skip++;
+  }
+  when_true = parse_comma(parser);
+  if (!condition) {
+    parser->skip--;
+  }
+  if (!accept(parser, ":", NULL)) {
+    set_error(parser, "expected ':' for conditional expression");
+    return 0;
+  }
+  if (condition) {
+    parser->skip++;
+  }
+  when_false = parse_conditional(parser);
+  if (condition) {
+    parser->skip--;
+  }
+  return condition ? when_true : when_false;
+}
+
+/**
+ * assignment: name (= | op=) assignment | conditional
+ */
+static int64_t parse_assignment(arithmetic_parser* parser) {
+  static const char* const compound_ops[] = {
+    "<<=", ">>=", "**=", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", NULL
+  };
+  char name[MAX_VARIABLE_NAME_LENGTH];
+  const char* saved = parser->cursor;
+  const char* const* op;
+  char operator_text[4];
+  int64_t value;
+
+  if (read_name(parser, name)) {
+    if (accept(parser, "=", "=")) {
+      value = parse_assignment(parser);
+      set_variable(parser, name, value);
+      return value;
+    }
+    for (op = compound_ops; *op != NULL; op++) {
+      if (accept(parser, *op, NULL)) {
+        /* Strip the trailing '=' to get the arithmetic operator */
+        snprintf(operator_text, sizeof(operator_text), "%.*s", (int)strlen(*op) - 1, *op);
+        value = get_variable(parser, name);
+        value = apply_operator(parser, operator_text, value, parse_assignment(parser));
+        set_variable(parser, name, value);
+        return value;
+      }
+    }
+  }
+  parser->cursor = saved;
+  return parse_conditional(parser);
+}
+
+/**
+ * comma: assignment ( , assignment )*
+ */
+static int64_t parse_comma(arithmetic_parser* parser) {
+  int64_t value = parse_assignment(parser);
+
+  while (parser->error == NULL && accept(parser, ",", NULL)) {
+    value = parse_assignment(parser);
+  }
+  return value;
+}
+
+static bool evaluate_with_depth(const char* expression, int64_t* result, int depth) {
+  arithmetic_parser parser = { expression, NULL, 0, depth };
+
+  *result = 0;
+  skip_blanks(&parser);
+  if (*parser.cursor == '\0') {
+    return true; /* $(( )) is 0 */
+  }
+  *result = parse_comma(&parser);
+  skip_blanks(&parser);
+  if (parser.error == NULL && *parser.cursor != '\0') {
+    set_error(&parser, "syntax error in expression");
+  }
+  if (parser.error != NULL) {
+    if (depth == 0) {
+      fprintf(stderr, "%s: %s (error token is \"%s\")\n", expression, parser.error, parser.cursor);
+    }
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Evaluate an arithmetic expression
+ * @param expression Expression text
+ * @param result Receives the value
+ * @return false on error (message already printed)
+ */
+bool arithmetic_evaluate(const char* expression, long long* result) {
+  int64_t value;
+  bool ok = evaluate_with_depth(expression, &value, 0);
+
+  *result = value;
+  return ok;
+}
@@ -0,0 +1,155 @@
+#!/bin/sh
+# <Adel Alkhamisy>
+# <Adel.Alkhamisy@bison.howard.edu>
+#
+# Spawn-latency and throughput benchmark: runs the same workloads
+# through ref_shell and shell2 and prints commands/s, p50/p99 latency
+# and, for pipelines, MB/s, then how fast each shell starts and exits
+# what the zygote (SHELL2_ZYGOTE=1) changes, what "set -o uring"
+# saves on a script of builtins and what "set -o utilities" and
+# "set -o fusion" save on short text pipelines. Run with "make bench".
+#
+# BENCH_COUNT    commands per latency workload and shell starts (default 1000)
+# BENCH_STAGES   stages in the pipeline workloads (default 4)
+# BENCH_PIPE_MB  size of the large pipeline input in MB (default 1024)
+
+cd "$(dirname "$0")/.." || exit 1
+
+BENCH_COUNT=${BENCH_COUNT:-1000}
+BENCH_STAGES=${BENCH_STAGES:-4}
+BENCH_PIPE_MB=${BENCH_PIPE_MB:-1024}
+DRIVER=bench/shell_bench
+STARTUP_DRIVER=bench/startup_bench
+SHELLS="./ref_shell ./shell2"
+
+WORK_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT INT TERM
+
+# A pipeline of BENCH_STAGES stages reading $1 and counting bytes at the end
+pipeline() {
+  command="cat $1"
+  stage=2
+  while [ "$stage" -lt "$BENCH_STAGES" ]; do
+    command="$command | cat"
+    stage=$((stage + 1))
+  done
+  echo "$command | wc -c"
+}
+
+# True if the shell prints the same result as /bin/sh for the command
+supports() {
+  expected=$(/bin/sh -c "$2" 2>/dev/null | tail -n 1 | tr -d ' ')
+  printf '%s\nexit\n' "$2" | "$1" 2>/dev/null | tr -d ' ' | grep -q "^.*$expected\$"
+}
+
+row() {
+  printf '%-28s %-14s %10s %10s %10s %10s\n' "$1" "$2" "$3" "$4" "$5" "$6"
+}
+
+# run NAME COUNT BYTES COMMAND
+run() {
+  for shell in $SHELLS; do
+    if ! supports "$shell" "$4"; then
+      row "$1" "${shell#./}" n/a n/a n/a n/a
+      continue
+    fi
+    if [ "$3" -gt 0 ]; then
+      set -- "$1" "$2" "$3" "$4" $("$DRIVER" -b "$3" "$shell" "$4" "$2")
+    else
+      set -- "$1" "$2" "$3" "$4" $("$DRIVER" "$shell" "$4" "$2")
+    fi
+    row "$1" "${shell#./}" "$5" "$6" "$7" "${8:--}"
+    set -- "$1" "$2" "$3" "$4"
+  done
+}
+
+# Large input: testData repeated up to BENCH_PIPE_MB megabytes
+LARGE_INPUT="$WORK_DIR/large"
+yes "$(cat testData)" | head -c "$((BENCH_PIPE_MB * 1024 * 1024))" > "$LARGE_INPUT"
+SMALL_BYTES=$(wc -c < testData)
+LARGE_BYTES=$(wc -c < "$LARGE_INPUT")
+
+row workload shell "cmds/s" "p50(us)" "p99(us)" "MB/s"
+run "trivial /bin/true"          "$BENCH_COUNT" 0 "/bin/true"
+run "external echo"              "$BENCH_COUNT" 0 "/bin/echo hello"
+run "builtin echo"               "$BENCH_COUNT" 0 "echo hello"
+run "builtin pwd"                "$BENCH_COUNT" 0 "pwd"
+run "builtin cd"                 "$BENCH_COUNT" 0 "cd ."
+run "$BENCH_STAGES-stage pipe, testData" "$((BENCH_COUNT / 10 + 1))" "$SMALL_BYTES" "$(pipeline testData)"
+run "$BENCH_STAGES-stage pipe, ${BENCH_PIPE_MB}MB" 3 "$LARGE_BYTES" "$(pipeline "$LARGE_INPUT")"
+
+# Cold start: start, read end of input or run "exit", and be reaped
+startup() {
+  if [ ! -x "$2" ]; then
+    row "$1" "${2#./}" n/a n/a n/a -
+    return
+  fi
+  set -- "$1" "$2" $("$STARTUP_DRIVER" "$BENCH_COUNT" "$2" $3)
+  row "$1" "${2#./}" "$3" "$4" "$5" -
+}
+
+echo
+row startup shell "starts/s" "p50(us)" "p99(us)" ""
+startup "stdin at EOF"    ./ref_shell
+startup "stdin at EOF"    ./shell2
+startup "-c exit"         ./shell2        "-c exit"
+startup "-c exit, static" ./shell2-static "-c exit"
+
+# zygote NAME COUNT COMMAND: shell2 forking stages itself, then via the zygote
+zygote() {
+  for mode in 0 1; do
+    label="shell2 fork"
+    [ "$mode" = 1 ] && label="shell2 zygote"
+    set -- "$1" "$2" "$3" $(SHELL2_ZYGOTE=$mode "$DRIVER" ./shell2 "$3" "$2")
+    row "$1" "$label" "$4" "$5" "$6" -
+    set -- "$1" "$2" "$3"
+  done
+}
+
+echo
+row "zygote vs fork" shell "cmds/s" "p50(us)" "p99(us)" ""
+zygote "trivial /bin/true"                "$BENCH_COUNT" "/bin/true"
+zygote "$BENCH_STAGES-stage pipe, testData" "$((BENCH_COUNT / 10 + 1))" "$(pipeline testData)"
+
+# script NAME FIRST_LINE: BENCH_COUNT * 50 echo builtins read from a file
+script() {
+  file="$WORK_DIR/script"
+  { echo "$2"; seq "$((BENCH_COUNT * 50))" | sed 's/^/echo line /'; } > "$file"
+  start=$(date +%s%N)
+  ./shell2 < "$file" > /dev/null
+  end=$(date +%s%N)
+  lines=$((BENCH_COUNT * 50))
+  row "$1" shell2 "$((lines * 1000000000 / (end - start)))" - - -
+}
+
+echo
+row "builtin script" shell "lines/s" "" "" ""
+script "plain write()"  "set +o uring"
+script "set -o uring"   "set -o uring"
+
+# utilities NAME COUNT COMMAND: the text utilities exec'd, run
+# in-process, then with adjacent stages fused into one process. All sort
+# bytewise, as the in-process sort only does that.
+utilities() {
+  for setting in "set +o utilities" "set -o utilities" "set -o utilities -o fusion"; do
+    set -- "$1" "$2" "$3" $(LC_ALL=C "$DRIVER" -s "$setting" ./shell2 "$3" "$2")
+    case $setting in
+      *fusion) label="-o fusion" ;;
+      *) label=${setting#set } ;;
+    esac
+    row "$1" "$label" "$4" "$5" "$6" -
+    set -- "$1" "$2" "$3"
+  done
+}
+
+echo
+row "text utilities" option "cmds/s" "p50(us)" "p99(us)" ""
+utilities "cat testData | head -3"  "$BENCH_COUNT" "cat testData | head -3"
+utilities "wc -l testData"          "$BENCH_COUNT" "wc -l testData"
+utilities "grep line testData"      "$BENCH_COUNT" "grep line testData"
+utilities "grep -c, ${BENCH_PIPE_MB}MB" 3 "grep -c empty $LARGE_INPUT"
+utilities "sort testData | uniq"    "$BENCH_COUNT" "sort testData | uniq"
+SORT_INPUT="$WORK_DIR/shuffled"
+seq 500000 | shuf > "$SORT_INPUT"
+utilities "sort 500k shuffled lines" 3 "sort $SORT_INPUT | wc -l"
+utilities "$BENCH_STAGES-stage pipe, testData" "$((BENCH_COUNT / 10 + 1))" "$(pipeline testData)"
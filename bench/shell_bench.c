@@ -0,0 +1,180 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Benchmark driver for shell2 and ref_shell.
+ *
+ * Starts a shell with its stdin and stdout connected to pipes, waits
+ * for the first prompt, then sends the same command line COUNT times.
+ * A command's latency is the time from writing the line until the next
+ * prompt ("> " at the end of the output) arrives, so it covers parsing,
+ * fork, exec, the command itself and reaping.
+ *
+ * Usage: shell_bench [-b BYTES] [-s SETUP] SHELL COMMAND COUNT
+ * Prints one line: "<commands/s> <p50 us> <p99 us> [<MB/s>]". With -b,
+ * MB/s is BYTES divided by the median latency, for pipelines that move
+ * a known amount of data. With -s, the SETUP line (such as "set -o
+ * utilities") is sent once before the timed runs.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+static int to_shell = -1;
+static int from_shell = -1;
+
+static double now_seconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Start the shell with pipes for stdin and stdout; stderr is discarded
+ */
+static pid_t start_shell(const char* shell_path) {
+  int input_pipe[2], output_pipe[2];
+  int null_fd;
+  pid_t pid;
+
+  if (pipe2(input_pipe, O_CLOEXEC) < 0 || pipe2(output_pipe, O_CLOEXEC) < 0) {
+    perror("pipe2");
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    dup2(input_pipe[0], STDIN_FILENO);
+    dup2(output_pipe[1], STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDERR_FILENO);
+    }
+    execl(shell_path, shell_path, (char*)NULL);
+    perror("execl");
+    _exit(127);
+  }
+  close(input_pipe[0]);
+  close(output_pipe[1]);
+  to_shell = input_pipe[1];
+  from_shell = output_pipe[0];
+  return pid;
+}
+
+/**
+ * Read shell output until it ends with the prompt
+ * @return false if the shell went away
+ */
+static bool wait_for_prompt(void) {
+  static char output[OUTPUT_BUFFER_SIZE];
+  size_t kept = 0;
+  ssize_t count;
+
+  while (true) {
+    count = read(from_shell, output + kept, sizeof(output) - kept);
+    if (count <= 0) {
+      return false;
+    }
+    kept += count;
+    if (kept >= 2 && output[kept - 2] == '>' && output[kept - 1] == ' ') {
+      return true;
+    }
+    /* Only the tail matters: keep the last byte for the next check */
+    if (kept == sizeof(output)) {
+      output[0] = output[kept - 1];
+      kept = 1;
+    }
+  }
+}
+
+static int compare_doubles(const void* left, const void* right) {
+  double a = *(const double*)left;
+  double b = *(const double*)right;
+
+  return (a > b) - (a < b);
+}
+
+int main(int argc, char* argv[]) {
+  double* latencies;
+  double start, total = 0;
+  double median;
+  long long bytes = 0;
+  char* line;
+  char* setup = NULL;
+  size_t line_length;
+  int count, i, option;
+  pid_t shell_pid;
+
+  while ((option = getopt(argc, argv, "b:s:")) != -1) {
+    if (option == 'b') {
+      bytes = atoll(optarg);
+    } else if (option == 's') {
+      setup = optarg;
+    } else {
+      fprintf(stderr, "Usage: %s [-b BYTES] [-s SETUP] SHELL COMMAND COUNT\n", argv[0]);
+      return 2;
+    }
+  }
+  if (argc - optind != 3 || (count = atoi(argv[optind + 2])) <= 0) {
+    fprintf(stderr, "Usage: %s [-b BYTES] [-s SETUP] SHELL COMMAND COUNT\n", argv[0]);
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  line_length = strlen(argv[optind + 1]) + 1;
+  line = malloc(line_length + 1);
+  latencies = malloc(count * sizeof(double));
+  if (line == NULL || latencies == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  snprintf(line, line_length + 1, "%s\n", argv[optind + 1]);
+
+  shell_pid = start_shell(argv[optind]);
+  if (!wait_for_prompt()) {
+    fprintf(stderr, "%s: no prompt\n", argv[optind]);
+    return 1;
+  }
+  if (setup != NULL && (dprintf(to_shell, "%s\n", setup) < 0 || !wait_for_prompt())) {
+    fprintf(stderr, "%s: shell exited during setup\n", argv[optind]);
+    return 1;
+  }
+  for (i = 0; i < count; i++) {
+    start = now_seconds();
+    if (write(to_shell, line, line_length) != (ssize_t)line_length || !wait_for_prompt()) {
+      fprintf(stderr, "%s: shell exited during run %d\n", argv[optind], i + 1);
+      return 1;
+    }
+    latencies[i] = now_seconds() - start;
+    total += latencies[i];
+  }
+  if (write(to_shell, "exit\n", 5) < 0) {
+    perror("write");
+  }
+  close(to_shell);
+  while (waitpid(shell_pid, NULL, 0) < 0 && errno == EINTR) {
+  }
+
+  qsort(latencies, count, sizeof(double), compare_doubles);
+  median = latencies[count / 2];
+  printf("%.0f %.1f %.1f", count / total, median * 1e6, latencies[(count * 99) / 100] * 1e6);
+  if (bytes > 0) {
+    printf(" %.1f", bytes / median / 1e6);
+  }
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,82 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Startup benchmark for shell2 and ref_shell.
+ *
+ * Runs "SHELL [ARG...]" COUNT times with stdin and stdout on /dev/null
+ * and times each run from fork() until it has been reaped, which is
+ * what a job runner pays per invocation. With stdin at end of file an
+ * interactive-style shell exits right after starting, so the same
+ * driver measures "ref_shell", "shell2" and "shell2 -c exit".
+ *
+ * Usage: startup_bench COUNT SHELL [ARG...]
+ * Prints one line: "<starts/s> <p50 us> <p99 us>".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double now_seconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void* left, const void* right) {
+  double a = *(const double*)left;
+  double b = *(const double*)right;
+
+  return (a > b) - (a < b);
+}
+
+int main(int argc, char* argv[]) {
+  double* latencies;
+  double start, total = 0;
+  int count, i, status, null_fd;
+  pid_t pid;
+
+  if (argc < 3 || (count = atoi(argv[1])) <= 0) {
+    fprintf(stderr, "Usage: %s COUNT SHELL [ARG...]\n", argv[0]);
+    return 2;
+  }
+  latencies = malloc(count * sizeof(double));
+  null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (latencies == NULL || null_fd < 0) {
+    perror("startup_bench");
+    return 1;
+  }
+  for (i = 0; i < count; i++) {
+    start = now_seconds();
+    pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      dup2(null_fd, STDIN_FILENO);
+      dup2(null_fd, STDOUT_FILENO);
+      execv(argv[2], argv + 2);
+      perror("execv");
+      _exit(127);
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    latencies[i] = now_seconds() - start;
+    total += latencies[i];
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+      fprintf(stderr, "%s: did not start cleanly\n", argv[2]);
+      return 1;
+    }
+  }
+  qsort(latencies, count, sizeof(double), compare_doubles);
+  printf("%.0f %.1f %.1f\n", count / total, latencies[count / 2] * 1e6, latencies[(count * 99) / 100] * 1e6);
+  return 0;
+}
@@ -0,0 +1,448 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Built-in commands.
+ *
+ * Each builtin writes to streams->output instead of stdout so that it
+ * can run inside the shell process for command substitution, where the
+ * output goes to an in-memory stream.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "shell2.h"
+
+/**
+ * cd: change the working directory (HOME if no argument)
+ */
+static int builtin_cd(char* args[], builtin_streams* streams) {
+  const char* home_directory;
+
+  if (args[1] == NULL) {
+    /* Change to HOME directory if no argument */
+    home_directory = variable_get("HOME");
+    if (home_directory == NULL) {
+      fprintf(stderr, "cd: HOME not set\n");
+      return 1;
+    }
+    if (chdir(home_directory) != 0) {
+      perror("cd");
+      return 1;
+    }
+  } else if (chdir(args[1]) != 0) {
+    perror("cd");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * pwd: print the working directory
+ */
+static int builtin_pwd(char* args[], builtin_streams* streams) {
+  char working_directory_buffer[WORKING_DIR_BUFFER_SIZE];
+
+  if (getcwd(working_directory_buffer, WORKING_DIR_BUFFER_SIZE) == NULL) {
+    perror("pwd");
+    return 1;
+  }
+  fprintf(streams->output, "%s\n", working_directory_buffer);
+  return 0;
+}
+
+/**
+ * echo: print the arguments ($NAME was already expanded by the parser)
+ */
+static int builtin_echo(char* args[], builtin_streams* streams) {
+  int echo_index;
+
+  for (echo_index = 1; args[echo_index] != NULL; echo_index++) {
+    fprintf(streams->output, "%s ", args[echo_index]);
+  }
+  fprintf(streams->output, "\n");
+  return 0;
+}
+
+/**
+ * exit [STATUS]: terminate the shell. In a command server it ends only
+ * the current request, whose status goes back to the client.
+ */
+static int builtin_exit(char* args[], builtin_streams* streams) {
+  int status = args[1] != NULL ? atoi(args[1]) & 0xff : 0;
+
+  if (server_serving()) {
+    return status;
+  }
+  exit(status);
+}
+
+/**
+ * env: print one variable, or the whole exported environment
+ */
+static int builtin_env(char* args[], builtin_streams* streams) {
+  const char* env_value;
+  char** environment_variables;
+
+  if (args[1] != NULL) {
+    env_value = variable_get(args[1]);
+    if (env_value != NULL) {
+      fprintf(streams->output, "%s\n", env_value);
+    } else {
+      fprintf(streams->output, "\n"); /* Print empty line if variable not found */
+    }
+    return 0;
+  }
+  for (environment_variables = variables_environment(); *environment_variables; environment_variables++) {
+    fprintf(streams->output, "%s\n", *environment_variables);
+  }
+  return 0;
+}
+
+/**
+ * setenv: set and export a variable given as NAME=VALUE.
+ * The value is everything after the first '=' and may be empty.
+ */
+static int builtin_setenv(char* args[], builtin_streams* streams) {
+  if (args[1] == NULL) {
+    fprintf(stderr, "setenv: missing argument\n");
+    return 1;
+  }
+  if (variable_assignment_name_length(args[1]) == 0) {
+    fprintf(stderr, "setenv: invalid format. Use NAME=VALUE\n");
+    return 1;
+  }
+  variable_assign_word(args[1], true);
+  return 0;
+}
+
+/**
+ * Print one exported variable as an export command that recreates it
+ */
+static void print_exported_variable(const char* text, bool exported, void* context) {
+  FILE* output = context;
+  const char* cursor = strchr(text, '=');
+
+  if (!exported) {
+    return;
+  }
+  fprintf(output, "export %.*s=\"", (int)(cursor - text), text);
+  for (cursor++; *cursor != '\0'; cursor++) {
+    if (strchr("\"\\$`", *cursor) != NULL) {
+      fputc('\\', output);
+    }
+    fputc(*cursor, output);
+  }
+  fputs("\"\n", output);
+}
+
+/**
+ * export: export NAME=VALUE or existing NAME; with no arguments, list
+ * the exported variables. "export -n NAME" stops exporting NAME.
+ */
+static int builtin_export(char* args[], builtin_streams* streams) {
+  bool unexport = false;
+  size_t name_length;
+  int status = 0;
+  int i = 1;
+
+  if (args[1] != NULL && strcmp(args[1], "-n") == 0) {
+    unexport = true;
+    i++;
+  }
+  if (args[i] == NULL) {
+    variables_for_each(print_exported_variable, streams->output);
+    return 0;
+  }
+  for (; args[i] != NULL; i++) {
+    name_length = variable_assignment_name_length(args[i]);
+    if (name_length > 0) {
+      args[i][name_length] = '\0';
+      variable_set(args[i], args[i] + name_length + 1, !unexport);
+      if (unexport) {
+        variable_set_exported(args[i], false);
+      }
+    }
+    else if (variable_name_is_valid(args[i], strlen(args[i]))) {
+      /* Exporting an unset name has no effect until it is assigned */
+      variable_set_exported(args[i], !unexport);
+    }
+    else {
+      fprintf(stderr, "export: `%s': not a valid identifier\n", args[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/**
+ * unset: remove shell variables
+ */
+static int builtin_unset(char* args[], builtin_streams* streams) {
+  int status = 0;
+  int i;
+
+  for (i = 1; args[i] != NULL; i++) {
+    if (strcmp(args[i], "-v") == 0) {
+      continue;
+    }
+    if (!variable_name_is_valid(args[i], strlen(args[i]))) {
+      fprintf(stderr, "unset: `%s': not a valid identifier\n", args[i]);
+      status = 1;
+      continue;
+    }
+    variable_unset(args[i]);
+  }
+  return status;
+}
+
+/**
+ * let: evaluate each argument as an arithmetic expression.
+ * Returns 0 if the last value is non-zero, like the shell's let.
+ */
+static int builtin_let(char* args[], builtin_streams* streams) {
+  long long value = 0;
+  int i;
+
+  if (args[1] == NULL) {
+    fprintf(stderr, "let: expression expected\n");
+    return 1;
+  }
+  for (i = 1; args[i] != NULL; i++) {
+    if (!arithmetic_evaluate(args[i], &value)) {
+      return 1;
+    }
+  }
+  return value != 0 ? 0 : 1;
+}
+
+/**
+ * jobs: list background and stopped jobs
+ */
+static int builtin_jobs(char* args[], builtin_streams* streams) {
+  jobs_print(streams->output);
+  return 0;
+}
+
+/**
+ * fg: bring a job to the foreground and wait for it
+ */
+static int builtin_fg(char* args[], builtin_streams* streams) {
+  job* j = jobs_find(args[1]);
+  int status;
+
+  if (j == NULL) {
+    fprintf(stderr, "fg: %s: no such job\n", args[1] ? args[1] : "current");
+    return 1;
+  }
+  fprintf(streams->output, "%s\n", j->command_text);
+  fflush(streams->output);
+  status = jobs_continue(j, true);
+  if (status == -1) {
+    return 1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * bg: resume a stopped job in the background
+ */
+static int builtin_bg(char* args[], builtin_streams* streams) {
+  job* j = jobs_find(args[1]);
+
+  if (j == NULL) {
+    fprintf(stderr, "bg: %s: no such job\n", args[1] ? args[1] : "current");
+    return 1;
+  }
+  fprintf(streams->output, "[%d]+ %s &\n", j->id, j->command_text);
+  return jobs_continue(j, false);
+}
+
+/* Resources ulimit knows, with the unit its numbers are given in */
+typedef struct {
+  char option;
+  int resource;
+  rlim_t unit;
+  const char* description;
+} ulimit_resource;
+
+static const ulimit_resource ulimit_resources[] = {
+  { 'c', RLIMIT_CORE,    1024, "core file size          (blocks, -c)" },
+  { 'd', RLIMIT_DATA,    1024, "data seg size           (kbytes, -d)" },
+  { 'f', RLIMIT_FSIZE,   1024, "file size               (blocks, -f)" },
+  { 'l', RLIMIT_MEMLOCK, 1024, "max locked memory       (kbytes, -l)" },
+  { 'n', RLIMIT_NOFILE,  1,    "open files                      (-n)" },
+  { 's', RLIMIT_STACK,   1024, "stack size              (kbytes, -s)" },
+  { 't', RLIMIT_CPU,     1,    "cpu time               (seconds, -t)" },
+  { 'u', RLIMIT_NPROC,   1,    "max user processes              (-u)" },
+  { 'v', RLIMIT_AS,      1024, "virtual memory          (kbytes, -v)" },
+  { 0,   0,              0,    NULL }
+};
+
+static void print_ulimit_value(FILE* output, rlim_t value, rlim_t unit) {
+  if (value == RLIM_INFINITY) {
+    fprintf(output, "unlimited\n");
+  } else {
+    fprintf(output, "%llu\n", (unsigned long long)(value / unit));
+  }
+}
+
+/**
+ * ulimit: show or set a resource limit for the commands the shell runs.
+ * "ulimit [-SH] [-a | -cdflnstuv] [value|unlimited]". Setting without
+ * -S or -H changes both limits; showing defaults to the soft limit.
+ */
+static int builtin_ulimit(char* args[], builtin_streams* streams) {
+  const ulimit_resource* selected = &ulimit_resources[2]; /* -f */
+  const ulimit_resource* entry;
+  bool soft = false, hard = false, show_all = false;
+  const char* flag;
+  char* end;
+  rlim_t value;
+  int i;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    for (flag = args[i] + 1; *flag != '\0'; flag++) {
+      if (*flag == 'S') {
+        soft = true;
+      } else if (*flag == 'H') {
+        hard = true;
+      } else if (*flag == 'a') {
+        show_all = true;
+      } else {
+        for (entry = ulimit_resources; entry->option != 0 && entry->option != *flag; entry++) {
+        }
+        if (entry->option == 0) {
+          fprintf(stderr, "ulimit: -%c: invalid option\n", *flag);
+          return 1;
+        }
+        selected = entry;
+      }
+    }
+  }
+
+  if (show_all) {
+    for (entry = ulimit_resources; entry->option != 0; entry++) {
+      fprintf(streams->output, "%s ", entry->description);
+      print_ulimit_value(streams->output, limits_get(entry->resource, hard && !soft), entry->unit);
+    }
+    return 0;
+  }
+  if (args[i] == NULL) {
+    print_ulimit_value(streams->output, limits_get(selected->resource, hard && !soft), selected->unit);
+    return 0;
+  }
+
+  if (strcmp(args[i], "unlimited") == 0) {
+    value = RLIM_INFINITY;
+  } else {
+    value = strtoull(args[i], &end, 10);
+    if (args[i][0] == '\0' || args[i][0] == '-' || *end != '\0') {
+      fprintf(stderr, "ulimit: %s: invalid number\n", args[i]);
+      return 1;
+    }
+    value *= selected->unit;
+  }
+  if (!soft && !hard) {
+    soft = hard = true;
+  }
+  return limits_set(selected->resource, value, soft, hard) ? 0 : 1;
+}
+
+/**
+ * set: "set -o" lists the options, "set -o NAME[=VALUE]" turns one on
+ * and "set +o NAME" turns it off
+ */
+static int builtin_set(char* args[], builtin_streams* streams) {
+  int status = 0;
+  bool enable;
+  int i;
+
+  if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL)) {
+    options_print(streams->output);
+    return 0;
+  }
+  for (i = 1; args[i] != NULL; i++) {
+    if (strcmp(args[i], "-o") != 0 && strcmp(args[i], "+o") != 0) {
+      fprintf(stderr, "set: %s: invalid option\n", args[i]);
+      return 1;
+    }
+    enable = args[i][0] == '-';
+    if (args[++i] == NULL) {
+      fprintf(stderr, "set: option name expected\n");
+      return 1;
+    }
+    if (!options_set(args[i], enable)) {
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/**
+ * shstats: print the shell's internal counters; "shstats -r" zeroes them
+ */
+static int builtin_shstats(char* args[], builtin_streams* streams) {
+  if (args[1] != NULL && strcmp(args[1], "-r") == 0) {
+    stats_reset();
+    return 0;
+  }
+  if (args[1] != NULL) {
+    fprintf(stderr, "shstats: usage: shstats [-r]\n");
+    return 1;
+  }
+  stats_sample_descriptors();
+  stats_print(streams->output);
+  return 0;
+}
+
+/*
+ * Builtins marked in_process only read shell state, so command
+ * substitution may run them without forking. The others change the
+ * shell and run in a forked subshell there.
+ */
+static const builtin_command builtin_table[] = {
+  { "cd",      builtin_cd,      false },
+  { "pwd",     builtin_pwd,     true  },
+  { "echo",    builtin_echo,    true  },
+  { "exit",    builtin_exit,    false },
+  { "env",     builtin_env,     true  },
+  { "setenv",  builtin_setenv,  false },
+  { "export",  builtin_export,  false },
+  { "unset",   builtin_unset,   false },
+  { "let",     builtin_let,     false },
+  { "jobs",    builtin_jobs,    true  },
+  { "fg",      builtin_fg,      false },
+  { "bg",      builtin_bg,      false },
+  { "ulimit",  builtin_ulimit,  false },
+  { "set",     builtin_set,     false },
+  { "shstats", builtin_shstats, true  },
+  { NULL,      NULL,            false }
+};
+
+/**
+ * All builtins, ending with an entry whose name is NULL
+ */
+const builtin_command* builtins_all(void) {
+  return builtin_table;
+}
+
+/**
+ * Look up a builtin by command name
+ * @param name Command name
+ * @return Table entry, or NULL if name is not a builtin
+ */
+const builtin_command* find_builtin(const char* name) {
+  const builtin_command* entry;
+
+  for (entry = builtin_table; entry->name != NULL; entry++) {
+    if (strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
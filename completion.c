@@ -0,0 +1,344 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Tab completion.
+ *
+ * Command names come from a trie of every executable on PATH, so a
+ * completion is a walk down the typed prefix instead of a scan of
+ * every PATH directory. The trie is built on the first Tab and kept
+ * until PATH is changed (setenv/export bump variables_path_generation())
+ * or one of its directories gets a new mtime, which is checked with
+ * one stat() per directory. Other words complete as file names.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "shell2.h"
+
+#define NO_NODE 0
+
+/* Trie nodes live in one array and link by index; node 0 is the root */
+typedef struct {
+  unsigned int first_child;
+  unsigned int next_sibling;
+  char character;
+  bool terminal;        /* a command name ends here */
+} trie_node;
+
+typedef struct {
+  char* path;
+  struct timespec modified;
+} path_directory;
+
+static trie_node* trie_nodes;
+static size_t trie_node_count;
+static size_t trie_node_capacity;
+
+static path_directory* path_directories;
+static size_t path_directory_count;
+static unsigned long built_path_generation;
+static bool trie_built;
+
+static unsigned int new_trie_node(char character) {
+  if (trie_node_count == trie_node_capacity) {
+    trie_node_capacity = trie_node_capacity ? trie_node_capacity * 2 : 4096;
+    trie_nodes = realloc(trie_nodes, trie_node_capacity * sizeof(trie_node));
+    if (trie_nodes == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  memset(&trie_nodes[trie_node_count], 0, sizeof(trie_node));
+  trie_nodes[trie_node_count].character = character;
+  return trie_node_count++;
+}
+
+/**
+ * Find the child of node for character
+ * @param create Add the child if it is missing
+ * @return Child index, or NO_NODE
+ */
+static unsigned int trie_child(unsigned int node, char character, bool create) {
+  unsigned int child;
+
+  for (child = trie_nodes[node].first_child; child != NO_NODE; child = trie_nodes[child].next_sibling) {
+    if (trie_nodes[child].character == character) {
+      return child;
+    }
+  }
+  if (!create) {
+    return NO_NODE;
+  }
+  child = new_trie_node(character);
+  trie_nodes[child].next_sibling = trie_nodes[node].first_child;
+  trie_nodes[node].first_child = child;
+  return child;
+}
+
+static void trie_insert(const char* name) {
+  unsigned int node = 0;
+
+  for (; *name != '\0'; name++) {
+    node = trie_child(node, *name, true);
+  }
+  trie_nodes[node].terminal = true;
+}
+
+/**
+ * Add the executables of one PATH directory to the trie
+ */
+static void add_directory_commands(const char* directory) {
+  struct dirent* entry;
+  struct stat file_status;
+  DIR* stream = opendir(directory);
+
+  if (stream == NULL) {
+    return;
+  }
+  while ((entry = readdir(stream)) != NULL) {
+    if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+      continue;
+    }
+    if (faccessat(dirfd(stream), entry->d_name, X_OK, 0) != 0) {
+      continue;
+    }
+    /* A symlink or unknown type may still be a directory */
+    if (entry->d_type != DT_REG &&
+        (fstatat(dirfd(stream), entry->d_name, &file_status, 0) != 0 || S_ISDIR(file_status.st_mode))) {
+      continue;
+    }
+    trie_insert(entry->d_name);
+  }
+  closedir(stream);
+}
+
+static void forget_path_directories(void) {
+  size_t i;
+
+  for (i = 0; i < path_directory_count; i++) {
+    free(path_directories[i].path);
+  }
+  free(path_directories);
+  path_directories = NULL;
+  path_directory_count = 0;
+}
+
+/**
+ * Rebuild the trie from the current PATH, recording each directory's mtime
+ */
+static void build_command_trie(void) {
+  const char* path = variable_get("PATH");
+  const char* start;
+  const char* end;
+  struct stat directory_status;
+  size_t length;
+
+  forget_path_directories();
+  trie_node_count = 0;
+  new_trie_node('\0');
+  built_path_generation = variables_path_generation();
+  trie_built = true;
+  if (path == NULL) {
+    return;
+  }
+  path_directories = malloc((strlen(path) / 2 + 2) * sizeof(path_directory));
+  if (path_directories == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (start = path; ; start = end + 1) {
+    end = strchr(start, ':');
+    length = end != NULL ? (size_t)(end - start) : strlen(start);
+    /* An empty PATH entry means the current directory */
+    path_directories[path_directory_count].path = length > 0 ? strndup(start, length) : strdup(".");
+    if (path_directories[path_directory_count].path == NULL) {
+      perror("strndup");
+      exit(1);
+    }
+    if (stat(path_directories[path_directory_count].path, &directory_status) == 0) {
+      path_directories[path_directory_count].modified = directory_status.st_mtim;
+    }
+    else {
+      memset(&path_directories[path_directory_count].modified, 0, sizeof(struct timespec));
+    }
+    add_directory_commands(path_directories[path_directory_count].path);
+    path_directory_count++;
+    if (end == NULL) {
+      break;
+    }
+  }
+}
+
+/**
+ * Check whether the trie still matches PATH and the directories in it
+ */
+static bool command_trie_is_current(void) {
+  struct stat directory_status;
+  struct timespec modified;
+  size_t i;
+
+  if (!trie_built || built_path_generation != variables_path_generation()) {
+    return false;
+  }
+  for (i = 0; i < path_directory_count; i++) {
+    if (stat(path_directories[i].path, &directory_status) == 0) {
+      modified = directory_status.st_mtim;
+    }
+    else {
+      memset(&modified, 0, sizeof(modified));
+    }
+    if (modified.tv_sec != path_directories[i].modified.tv_sec ||
+        modified.tv_nsec != path_directories[i].modified.tv_nsec) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Push every command below node, spelled with the given prefix
+ */
+static void collect_commands(unsigned int node, char* spelling, size_t length, size_t capacity,
+                             argument_vector* output, string_arena* arena) {
+  unsigned int child;
+
+  if (trie_nodes[node].terminal) {
+    argument_vector_push(output, string_arena_strndup(arena, spelling, length));
+  }
+  if (length + 1 >= capacity) {
+    return;
+  }
+  for (child = trie_nodes[node].first_child; child != NO_NODE; child = trie_nodes[child].next_sibling) {
+    spelling[length] = trie_nodes[child].character;
+    collect_commands(child, spelling, length + 1, capacity, output, arena);
+  }
+}
+
+static void complete_command(const char* prefix, size_t prefix_length, argument_vector* output, string_arena* arena) {
+  char spelling[NAME_MAX + 1];
+  const builtin_command* builtin;
+  unsigned int node = 0;
+  size_t i;
+
+  if (!command_trie_is_current()) {
+    build_command_trie();
+  }
+  /* The root is node 0, so NO_NODE only means "missing" below it */
+  for (i = 0; i < prefix_length; i++) {
+    node = trie_child(node, prefix[i], false);
+    if (node == NO_NODE) {
+      break;
+    }
+  }
+  if (i == prefix_length && prefix_length < sizeof(spelling)) {
+    memcpy(spelling, prefix, prefix_length);
+    collect_commands(node, spelling, prefix_length, sizeof(spelling), output, arena);
+  }
+  for (builtin = builtins_all(); builtin->name != NULL; builtin++) {
+    if (strncmp(builtin->name, prefix, prefix_length) == 0) {
+      argument_vector_push(output, (char*)builtin->name);
+    }
+  }
+}
+
+/**
+ * Complete a file name: entries of the word's directory that start with
+ * its last component. Directories get a trailing '/'.
+ */
+static void complete_file(const char* word, size_t word_length, argument_vector* output, string_arena* arena) {
+  const char* slash = memrchr(word, '/', word_length);
+  size_t directory_length = slash != NULL ? (size_t)(slash - word) + 1 : 0;
+  const char* base = word + directory_length;
+  size_t base_length = word_length - directory_length;
+  char* directory;
+  char* candidate;
+  struct dirent* entry;
+  struct stat file_status;
+  size_t name_length;
+  bool is_directory;
+  DIR* stream;
+
+  directory = directory_length > 0 ? string_arena_strndup(arena, word, directory_length) : ".";
+  stream = opendir(directory);
+  if (stream == NULL) {
+    return;
+  }
+  while ((entry = readdir(stream)) != NULL) {
+    if (strncmp(entry->d_name, base, base_length) != 0) {
+      continue;
+    }
+    /* Hidden files only when asked for, and never "." or ".." */
+    if (entry->d_name[0] == '.' &&
+        (base_length == 0 || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)) {
+      continue;
+    }
+    is_directory = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      is_directory = fstatat(dirfd(stream), entry->d_name, &file_status, 0) == 0 && S_ISDIR(file_status.st_mode);
+    }
+    name_length = strlen(entry->d_name);
+    candidate = string_arena_alloc(arena, directory_length + name_length + 2);
+    memcpy(candidate, word, directory_length);
+    memcpy(candidate + directory_length, entry->d_name, name_length);
+    candidate[directory_length + name_length] = is_directory ? '/' : '\0';
+    candidate[directory_length + name_length + 1] = '\0';
+    argument_vector_push(output, candidate);
+  }
+  closedir(stream);
+}
+
+/**
+ * Completions for the word that ends at the cursor. The first word of
+ * a command (at the start of the line or after '|') without a '/'
+ * completes as a command name, anything else as a file name.
+ * @param line Line being edited
+ * @param cursor Cursor position in line
+ * @param word_start Receives where the word being completed starts
+ * @param output Receives the full replacement words, sorted
+ * @param arena Storage for the candidates
+ * @return Number of candidates
+ */
+size_t completion_candidates(const char* line, size_t cursor, size_t* word_start,
+                             argument_vector* output, string_arena* arena) {
+  size_t start = cursor;
+  size_t before, i, unique;
+  bool command_position;
+
+  while (start > 0 && strchr(" \t|&;<>", line[start - 1]) == NULL) {
+    start--;
+  }
+  before = start;
+  while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t')) {
+    before--;
+  }
+  command_position = before == 0 || strchr("|&;", line[before - 1]) != NULL;
+  *word_start = start;
+
+  argument_vector_clear(output);
+  if (command_position && memchr(line + start, '/', cursor - start) == NULL) {
+    complete_command(line + start, cursor - start, output, arena);
+  }
+  else {
+    complete_file(line + start, cursor - start, output, arena);
+  }
+  sort_strings(output->items, output->count);
+  /* A builtin may also exist on PATH, and a command in several directories */
+  for (i = 1, unique = output->count > 0 ? 1 : 0; i < output->count; i++) {
+    if (strcmp(output->items[i], output->items[unique - 1]) != 0) {
+      output->items[unique++] = output->items[i];
+    }
+  }
+  output->count = unique;
+  if (output->items != NULL) {
+    output->items[unique] = NULL;
+  }
+  return output->count;
+}
@@ -0,0 +1,123 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Central event loop.
+ *
+ * Everything the shell waits for is a file descriptor in one epoll
+ * set: the signalfd, the foreground timeout timerfd, one pidfd per
+ * running process and, at the prompt, stdin. Each registration carries
+ * the handler to run, so a wakeup goes straight to the process or
+ * timer that fired instead of scanning every job.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "shell2.h"
+
+#define EVENTS_PER_WAIT 64
+
+static int epoll_fd = -1;
+
+/**
+ * Create the epoll set. Must run before anything registers with it.
+ */
+void events_initialize(void) {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    perror("epoll_create1");
+    exit(1);
+  }
+}
+
+/**
+ * Watch source->fd for input and run source->handle when it is ready
+ * @return false if the descriptor cannot be watched
+ */
+bool events_add(event_source* source) {
+  struct epoll_event event;
+
+  event.events = EPOLLIN;
+  event.data.ptr = source;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, source->fd, &event) < 0) {
+    perror("epoll_ctl");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Stop watching a source. Call this before closing its descriptor:
+ * a child forked in the meantime may still hold a copy, and epoll keeps
+ * the registration until every copy is closed.
+ */
+void events_remove(event_source* source) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+}
+
+/**
+ * Wait for events and run their handlers
+ * @param timeout_ms Longest time to sleep; -1 waits forever, 0 only
+ *   collects what is already pending
+ */
+void events_dispatch(int timeout_ms) {
+  struct epoll_event ready[EVENTS_PER_WAIT];
+  event_source* source;
+  int count, i;
+
+  count = epoll_wait(epoll_fd, ready, EVENTS_PER_WAIT, timeout_ms);
+  if (count < 0) {
+    if (errno != EINTR) {
+      perror("epoll_wait");
+    }
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    source = ready[i].data.ptr;
+    source->handle(source, ready[i].events);
+  }
+}
+
+static void note_input_ready(event_source* source, unsigned int events) {
+  *(bool*)source->context = true;
+}
+
+/**
+ * Run the event loop until fd has input, so job and signal events are
+ * handled while the shell waits at the prompt
+ * @param fd Descriptor to wait on (a terminal or pipe; not a regular file)
+ * @param idle Called after each round of other events, may be NULL
+ */
+void events_wait_for_input(int fd, void (*idle)(void)) {
+  bool input_ready = false;
+  event_source input_event = { fd, note_input_ready, &input_ready };
+
+  if (!events_add(&input_event)) {
+    return;
+  }
+  while (!input_ready) {
+    events_dispatch(-1);
+    if (!input_ready && idle != NULL) {
+      idle();
+    }
+  }
+  events_remove(&input_event);
+}
+
+/**
+ * Open a pidfd for a child, which becomes readable when it exits
+ * @return Descriptor, or -1 if the kernel has no pidfd_open (before 5.3)
+ */
+int events_open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
@@ -0,0 +1,544 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Turns a command line into an argument list.
+ *
+ * Handles single and double quotes, backslash escapes, variable
+ * expansion with $NAME and ${NAME}, command substitution with $(...)
+ * and `...`, arithmetic expansion with $((...)), word splitting of
+ * unquoted expansion results, and pathname expansion of unquoted
+ * patterns.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "shell2.h"
+
+#define CAPTURE_INITIAL_CAPACITY 4096
+
+/**
+ * A word under construction. text is the final word; pattern is the
+ * same word with quoted glob characters escaped, for glob_expand_pattern().
+ */
+typedef struct {
+  char* text;
+  char* pattern;
+  size_t text_length;
+  size_t pattern_length;
+  size_t capacity;
+  bool started;     /* quotes make even an empty word count */
+  bool has_glob;    /* an unquoted *, ? or [ was seen */
+} word_builder;
+
+static bool is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_glob_char(char c) {
+  return c == '*' || c == '?' || c == '[' || c == ']' || c == '\\';
+}
+
+static void word_reserve(word_builder* word, size_t extra) {
+  size_t needed = word->pattern_length + extra + 1;
+
+  if (needed <= word->capacity) {
+    return;
+  }
+  while (word->capacity < needed) {
+    word->capacity = word->capacity ? word->capacity * 2 : 128;
+  }
+  word->text = realloc(word->text, word->capacity);
+  word->pattern = realloc(word->pattern, word->capacity);
+  if (word->text == NULL || word->pattern == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+}
+
+/**
+ * Append one character to the word
+ * @param quoted true if the character came from inside quotes or an escape
+ */
+static void word_append(word_builder* word, char c, bool quoted) {
+  word_reserve(word, 2);
+  word->text[word->text_length++] = c;
+  if (quoted && is_glob_char(c)) {
+    word->pattern[word->pattern_length++] = '\\';
+  }
+  else if (!quoted && (c == '*' || c == '?' || c == '[')) {
+    word->has_glob = true;
+  }
+  word->pattern[word->pattern_length++] = c;
+  word->started = true;
+}
+
+/**
+ * Emit the finished word (glob-expanded if needed) and start a new one
+ */
+static void word_finish(word_builder* word, argument_vector* output, string_arena* arena) {
+  if (!word->started) {
+    return;
+  }
+  word->text[word->text_length] = '\0';
+  word->pattern[word->pattern_length] = '\0';
+  if (!word->has_glob || !glob_has_magic(word->pattern) ||
+      glob_expand_pattern(word->pattern, output, arena) == 0) {
+    argument_vector_push(output, string_arena_strndup(arena, word->text, word->text_length));
+  }
+  word->text_length = 0;
+  word->pattern_length = 0;
+  word->started = false;
+  word->has_glob = false;
+}
+
+/**
+ * Append expansion output. Unquoted output is split on blanks into
+ * separate words; quoted output stays in the current word.
+ */
+static void word_append_substitution(word_builder* word, const char* text, bool quoted,
+                                     argument_vector* output, string_arena* arena) {
+  for (; *text != '\0'; text++) {
+    if (!quoted && is_blank(*text)) {
+      word_finish(word, output, arena);
+    } else {
+      word_append(word, *text, quoted);
+    }
+  }
+}
+
+static bool is_parameter_start(const char* cursor) {
+  return cursor[0] == '$' &&
+         (isalpha((unsigned char)cursor[1]) || cursor[1] == '_' || cursor[1] == '{');
+}
+
+/**
+ * Expand the $NAME or ${NAME} starting at cursor. Unset variables
+ * expand to nothing.
+ * @return Pointer just past the reference, or NULL on a syntax error
+ */
+static const char* expand_parameter(const char* cursor, word_builder* word, bool quoted,
+                                    argument_vector* output, string_arena* arena) {
+  const char* name_start;
+  const char* name_end;
+  const char* value;
+  char* name;
+
+  if (cursor[1] == '{') {
+    name_start = cursor + 2;
+    name_end = strchr(name_start, '}');
+    if (name_end == NULL || !variable_name_is_valid(name_start, name_end - name_start)) {
+      fprintf(stderr, "Bad substitution\n");
+      return NULL;
+    }
+    cursor = name_end + 1;
+  }
+  else {
+    name_start = cursor + 1;
+    for (name_end = name_start; isalnum((unsigned char)*name_end) || *name_end == '_'; name_end++) {
+    }
+    cursor = name_end;
+  }
+  if (quoted) {
+    word->started = true;
+  }
+  name = string_arena_strndup(arena, name_start, name_end - name_start);
+  value = variable_get(name);
+  if (value != NULL) {
+    word_append_substitution(word, value, quoted, output, arena);
+  }
+  return cursor;
+}
+
+/**
+ * Find the ')' that closes a $( whose body starts at cursor.
+ * Nested parentheses and quoted text are skipped.
+ * @return Pointer to the closing ')', or NULL if unterminated
+ */
+static const char* find_closing_paren(const char* cursor) {
+  int depth = 1;
+  char quote;
+
+  while (*cursor != '\0') {
+    if (*cursor == '\\' && cursor[1] != '\0') {
+      cursor += 2;
+      continue;
+    }
+    if (*cursor == '\'' || *cursor == '"') {
+      quote = *cursor++;
+      while (*cursor != '\0' && *cursor != quote) {
+        if (quote == '"' && *cursor == '\\' && cursor[1] != '\0') {
+          cursor++;
+        }
+        cursor++;
+      }
+      if (*cursor == '\0') {
+        return NULL;
+      }
+    }
+    else if (*cursor == '(') {
+      depth++;
+    }
+    else if (*cursor == ')' && --depth == 0) {
+      return cursor;
+    }
+    cursor++;
+  }
+  return NULL;
+}
+
+/**
+ * Find the "))" that closes a $(( whose expression starts at cursor
+ * @return Pointer to the first ')' of the pair, or NULL if unterminated
+ */
+static const char* find_arithmetic_end(const char* cursor) {
+  int depth = 0;
+
+  for (; *cursor != '\0'; cursor++) {
+    if (*cursor == '(') {
+      depth++;
+    }
+    else if (*cursor == ')') {
+      if (depth == 0) {
+        return cursor[1] == ')' ? cursor : NULL;
+      }
+      depth--;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Evaluate the $((...)) starting at cursor and append the result
+ * @return Pointer just past the expansion, or NULL on error
+ */
+static const char* expand_arithmetic(const char* cursor, word_builder* word, bool quoted,
+                                     argument_vector* output, string_arena* arena) {
+  const char* end = find_arithmetic_end(cursor + 3);
+  char* expression;
+  char result[32];
+  long long value;
+
+  if (end == NULL) {
+    fprintf(stderr, "Unterminated arithmetic expansion\n");
+    return NULL;
+  }
+  expression = string_arena_strndup(arena, cursor + 3, end - (cursor + 3));
+  if (!arithmetic_evaluate(expression, &value)) {
+    return NULL;
+  }
+  snprintf(result, sizeof(result), "%lld", value);
+  word_append_substitution(word, result, quoted, output, arena);
+  return end + 2;
+}
+
+/**
+ * Find the closing backtick, honouring backslash escapes
+ */
+static const char* find_closing_backtick(const char* cursor) {
+  while (*cursor != '\0' && *cursor != '`') {
+    if (*cursor == '\\' && cursor[1] != '\0') {
+      cursor++;
+    }
+    cursor++;
+  }
+  return *cursor == '`' ? cursor : NULL;
+}
+
+/**
+ * Run the substitution starting at cursor ("$(" or "`") and append its
+ * output to the word
+ * @return Pointer just past the substitution, or NULL on a syntax error
+ */
+static const char* expand_substitution(const char* cursor, word_builder* word, bool quoted,
+                                       argument_vector* output, string_arena* arena) {
+  const char* body;
+  const char* end;
+  char* command_text;
+  char* result;
+  char* out;
+
+  if (*cursor == '`') {
+    body = cursor + 1;
+    end = find_closing_backtick(body);
+    if (end == NULL) {
+      fprintf(stderr, "Unterminated backquote\n");
+      return NULL;
+    }
+    /* Inside backquotes, \` \$ and \\ stand for the plain character */
+    command_text = string_arena_alloc(arena, end - body + 1);
+    for (out = command_text; body < end; body++) {
+      if (*body == '\\' && (body[1] == '`' || body[1] == '$' || body[1] == '\\')) {
+        body++;
+      }
+      *out++ = *body;
+    }
+    *out = '\0';
+  }
+  else {
+    body = cursor + 2;
+    end = find_closing_paren(body);
+    if (end == NULL) {
+      fprintf(stderr, "Unterminated command substitution\n");
+      return NULL;
+    }
+    command_text = string_arena_strndup(arena, body, end - body);
+  }
+  /* An empty substitution still marks a quoted word as present */
+  if (quoted) {
+    word->started = true;
+  }
+  result = capture_command_output(command_text, arena);
+  word_append_substitution(word, result, quoted, output, arena);
+  return end + 1;
+}
+
+/**
+ * Split a command line into words, performing quote removal, command
+ * substitution and pathname expansion
+ * @param line Command line
+ * @param output Receives the words (strings owned by arena)
+ * @param arena Arena for the resulting strings
+ * @return false on a syntax error (message already printed)
+ */
+bool expand_words(const char* line, argument_vector* output, string_arena* arena) {
+  word_builder word = {0};
+  const char* cursor = line;
+  bool ok = true;
+
+  while (ok && *cursor != '\0') {
+    if (is_blank(*cursor)) {
+      word_finish(&word, output, arena);
+      cursor++;
+    }
+    else if (*cursor == '\\') {
+      /* Backslash-newline is a line continuation; otherwise quote one character */
+      if (cursor[1] != '\0' && cursor[1] != '\n') {
+        word_append(&word, cursor[1], true);
+      }
+      cursor += cursor[1] != '\0' ? 2 : 1;
+    }
+    else if (*cursor == '\'') {
+      word.started = true;
+      for (cursor++; *cursor != '\0' && *cursor != '\''; cursor++) {
+        word_append(&word, *cursor, true);
+      }
+      if (*cursor == '\0') {
+        fprintf(stderr, "Unterminated quote\n");
+        ok = false;
+      } else {
+        cursor++;
+      }
+    }
+    else if (*cursor == '"') {
+      word.started = true;
+      cursor++;
+      while (ok && *cursor != '\0' && *cursor != '"') {
+        if (*cursor == '\\' && strchr("\"\\$`", cursor[1]) != NULL && cursor[1] != '\0') {
+          word_append(&word, cursor[1], true);
+          cursor += 2;
+        }
+        else if (is_parameter_start(cursor)) {
+          cursor = expand_parameter(cursor, &word, true, output, arena);
+          ok = (cursor != NULL);
+        }
+        else if (*cursor == '$' && cursor[1] == '(' && cursor[2] == '(' &&
+                 find_arithmetic_end(cursor + 3) != NULL) {
+          cursor = expand_arithmetic(cursor, &word, true, output, arena);
+          ok = (cursor != NULL);
+        }
+        else if ((*cursor == '$' && cursor[1] == '(') || *cursor == '`') {
+          cursor = expand_substitution(cursor, &word, true, output, arena);
+          ok = (cursor != NULL);
+        }
+        else {
+          word_append(&word, *cursor++, true);
+        }
+      }
+      if (ok && *cursor == '\0') {
+        fprintf(stderr, "Unterminated quote\n");
+        ok = false;
+      } else if (ok) {
+        cursor++;
+      }
+    }
+    else if (is_parameter_start(cursor)) {
+      cursor = expand_parameter(cursor, &word, false, output, arena);
+      ok = (cursor != NULL);
+    }
+    else if (*cursor == '$' && cursor[1] == '(' && cursor[2] == '(' &&
+             find_arithmetic_end(cursor + 3) != NULL) {
+      /* $(( is arithmetic when it closes with "))", else a nested $( ( ) ) */
+      cursor = expand_arithmetic(cursor, &word, false, output, arena);
+      ok = (cursor != NULL);
+    }
+    else if ((*cursor == '$' && cursor[1] == '(') || *cursor == '`') {
+      cursor = expand_substitution(cursor, &word, false, output, arena);
+      ok = (cursor != NULL);
+    }
+    else {
+      word_append(&word, *cursor++, false);
+    }
+  }
+  if (ok) {
+    word_finish(&word, output, arena);
+  }
+  free(word.text);
+  free(word.pattern);
+  return ok;
+}
+
+/**
+ * Read everything from a file descriptor into a growable buffer
+ * @param fd Descriptor to drain until end of file
+ * @param length Receives the number of bytes read
+ * @return malloc'd buffer (caller frees)
+ */
+static char* read_all(int fd, size_t* length) {
+  size_t capacity = CAPTURE_INITIAL_CAPACITY;
+  char* buffer = malloc(capacity);
+  ssize_t bytes_read;
+
+  *length = 0;
+  while (buffer != NULL) {
+    if (capacity - *length < CAPTURE_INITIAL_CAPACITY) {
+      capacity *= 2;
+      buffer = realloc(buffer, capacity);
+      if (buffer == NULL) {
+        break;
+      }
+    }
+    bytes_read = read(fd, buffer + *length, capacity - *length);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      break;
+    }
+    *length += bytes_read;
+  }
+  if (buffer == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+  return buffer;
+}
+
+/**
+ * Check whether a word list is a plain command, with no pipe or redirection
+ */
+static bool is_simple_command(char* args[]) {
+  int i;
+
+  for (i = 0; args[i] != NULL; i++) {
+    if (strcmp(args[i], "|") == 0 || strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Run a command and capture its standard output, without temp files.
+ * Side-effect-free builtins run in the shell process and write to an
+ * in-memory stream; anything else runs in a child connected by a pipe.
+ * @param command_text Command line inside the substitution
+ * @param arena Arena that owns the result
+ * @return Output with trailing newlines removed (never NULL)
+ */
+char* capture_command_output(const char* command_text, string_arena* arena) {
+  argument_vector arguments = {0};
+  const builtin_command* builtin = NULL;
+  builtin_streams streams;
+  char* buffer = NULL;
+  size_t length = 0;
+  char* result;
+  int capture_pipe[2];
+  int exit_status;
+  pid_t child_pid;
+
+  if (!expand_words(command_text, &arguments, arena) || arguments.count == 0) {
+    free(arguments.items);
+    return "";
+  }
+  builtin = find_builtin(arguments.items[0]);
+
+  if (builtin != NULL && builtin->in_process && is_simple_command(arguments.items)) {
+    streams.output = open_memstream(&buffer, &length);
+    if (streams.output == NULL) {
+      perror("open_memstream");
+      free(arguments.items);
+      return "";
+    }
+    builtin->function(arguments.items, &streams);
+    fclose(streams.output);
+  }
+  else {
+    if (pipe2(capture_pipe, O_CLOEXEC) < 0) {
+      perror("pipe");
+      free(arguments.items);
+      return "";
+    }
+    stats_note_descriptor(capture_pipe[0] > capture_pipe[1] ? capture_pipe[0] : capture_pipe[1]);
+    io_core_flush();
+    variables_environment();
+    child_pid = fork();
+    if (child_pid < 0) {
+      perror("fork");
+      close(capture_pipe[0]);
+      close(capture_pipe[1]);
+      free(arguments.items);
+      return "";
+    }
+    if (child_pid == 0) {
+      /*
+       * Child: a subshell whose stdout is the capture pipe. It leaves
+       * with _exit so stdio does not rewind the shell's shared stdin.
+       */
+      signals_reset_in_child();
+      close(capture_pipe[0]);
+      if (dup2(capture_pipe[1], STDOUT_FILENO) < 0) {
+        perror("dup2");
+        _exit(1);
+      }
+      close(capture_pipe[1]);
+      if (builtin != NULL && is_simple_command(arguments.items)) {
+        streams.output = stdout;
+        exit_status = builtin->function(arguments.items, &streams);
+        io_core_flush();
+        _exit(exit_status);
+      }
+      if (is_simple_command(arguments.items)) {
+        /* One external command: this child becomes it, no second fork */
+        close_descriptors_in_child();
+        execute_single_command(arguments.items, NULL);
+        _exit(1);
+      }
+      exit_status = execute_command_with_pipes_and_redirection(arguments.items);
+      _exit(exit_status >= 0 && WIFEXITED(exit_status) ? WEXITSTATUS(exit_status) : 1);
+    }
+    /* Counted here, not before the branch: the page is shared with the child */
+    stats_add(COUNTER_FORKS, 1);
+    close(capture_pipe[1]);
+    buffer = read_all(capture_pipe[0], &length);
+    close(capture_pipe[0]);
+    while (waitpid(child_pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+  }
+  free(arguments.items);
+
+  while (length > 0 && buffer[length - 1] == '\n') {
+    length--;
+  }
+  result = string_arena_strndup(arena, buffer, length);
+  free(buffer);
+  return result;
+}
@@ -0,0 +1,261 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Pipeline fusion, turned on with "set -o fusion" (it needs "set -o
+ * utilities" too).
+ *
+ * Adjacent pipeline stages that are in-process utilities are started as
+ * one process instead of one each. Every stage but the last runs on a
+ * thread of its own and the last runs on the process's main thread.
+ * Between two fused stages there is no kernel pipe but a ring buffer
+ * with one writer and one reader: the writer only moves head and the
+ * reader only moves tail, so passing data takes no lock and no system
+ * call. A side only sleeps (on a futex) when the ring is empty or full,
+ * and is only woken by a system call if it is actually asleep. Kernel
+ * pipes remain at the edges, where the fused process meets other
+ * stages or the terminal.
+ *
+ * The utilities keep talking to descriptors 0 and 1; utility_read()
+ * and utility_write_all() send those to the thread's rings.
+ *
+ * The process exits with the last stage's status as soon as that stage
+ * is done, which also ends the stages before it, the way SIGPIPE
+ * would.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "shell2.h"
+
+#define FUSION_RING_SIZE (256 * 1024) /* a power of two */
+#define CACHE_LINE_SIZE 64
+
+struct fusion_ring {
+  char* data;
+  /* Each side's counter on its own cache line, so they do not bounce */
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;     /* bytes written so far */
+  _Atomic unsigned int data_event;    /* changes when head moves or the writer is done */
+  _Atomic bool reader_waiting;
+  _Atomic bool writer_done;
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;     /* bytes read so far */
+  _Atomic unsigned int space_event;   /* changes when tail moves or the reader is done */
+  _Atomic bool writer_waiting;
+  _Atomic bool reader_done;
+};
+
+typedef struct {
+  char** args;
+  utility_function utility;
+  fusion_ring* input;   /* NULL: the process's standard input */
+  fusion_ring* output;  /* NULL: the process's standard output */
+  int status;
+} fused_stage;
+
+/* The rings standing in for descriptors 0 and 1 on this thread */
+static __thread fusion_ring* thread_input;
+static __thread fusion_ring* thread_output;
+
+/**
+ * Bump an event and wake its sleeper, if there is one
+ */
+static void signal_event(_Atomic unsigned int* event, _Atomic bool* waiting) {
+  atomic_fetch_add(event, 1);
+  if (atomic_load(waiting)) {
+    syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+/**
+ * Sleep until an event changes, unless it already changed since seen.
+ * The caller checks its condition again after setting waiting, so a
+ * wakeup cannot be missed.
+ */
+static void wait_for_event(_Atomic unsigned int* event, unsigned int seen) {
+  syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+/**
+ * Ring for descriptor 0 or 1 of a fused stage
+ * @return The ring, or NULL if fd is a real descriptor on this thread
+ */
+fusion_ring* fusion_ring_for(int fd) {
+  if (fd == STDIN_FILENO) {
+    return thread_input;
+  }
+  if (fd == STDOUT_FILENO) {
+    return thread_output;
+  }
+  return NULL;
+}
+
+/**
+ * Read what the ring holds, up to size bytes, waiting if it is empty
+ * @return Bytes read, or 0 once the writer is done and the ring is empty
+ */
+ssize_t fusion_ring_read(fusion_ring* ring, char* buffer, size_t size) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t available, offset, first;
+  unsigned int seen;
+
+  while ((available = atomic_load(&ring->head) - tail) == 0) {
+    if (atomic_load(&ring->writer_done)) {
+      /* head is final once writer_done is seen; look once more */
+      if (atomic_load(&ring->head) == tail) {
+        return 0;
+      }
+      continue;
+    }
+    seen = atomic_load(&ring->data_event);
+    atomic_store(&ring->reader_waiting, true);
+    if (atomic_load(&ring->head) == tail && !atomic_load(&ring->writer_done)) {
+      wait_for_event(&ring->data_event, seen);
+    }
+    atomic_store(&ring->reader_waiting, false);
+  }
+  if (available > size) {
+    available = size;
+  }
+  offset = tail & (FUSION_RING_SIZE - 1);
+  first = available < FUSION_RING_SIZE - offset ? available : FUSION_RING_SIZE - offset;
+  memcpy(buffer, ring->data + offset, first);
+  memcpy(buffer + first, ring->data, available - first);
+  atomic_store(&ring->tail, tail + available);
+  signal_event(&ring->space_event, &ring->writer_waiting);
+  return available;
+}
+
+/**
+ * Write all of data, waiting whenever the ring is full
+ * @return false with errno EPIPE if the reader is done
+ */
+bool fusion_ring_write(fusion_ring* ring, const char* data, size_t length) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t space, offset, first, count;
+  unsigned int seen;
+
+  while (length > 0) {
+    if (atomic_load(&ring->reader_done)) {
+      errno = EPIPE;
+      return false;
+    }
+    space = FUSION_RING_SIZE - (head - atomic_load(&ring->tail));
+    if (space == 0) {
+      seen = atomic_load(&ring->space_event);
+      atomic_store(&ring->writer_waiting, true);
+      if (head - atomic_load(&ring->tail) == FUSION_RING_SIZE && !atomic_load(&ring->reader_done)) {
+        wait_for_event(&ring->space_event, seen);
+      }
+      atomic_store(&ring->writer_waiting, false);
+      continue;
+    }
+    count = length < space ? length : space;
+    offset = head & (FUSION_RING_SIZE - 1);
+    first = count < FUSION_RING_SIZE - offset ? count : FUSION_RING_SIZE - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, count - first);
+    head += count;
+    data += count;
+    length -= count;
+    atomic_store(&ring->head, head);
+    signal_event(&ring->data_event, &ring->reader_waiting);
+  }
+  return true;
+}
+
+static void* run_fused_stage(void* argument) {
+  fused_stage* stage = argument;
+
+  thread_input = stage->input;
+  thread_output = stage->output;
+  stage->status = stage->utility(stage->args, false);
+  /* Like closing both pipe ends: the next stage sees end of file, the previous one EPIPE */
+  if (stage->output != NULL) {
+    atomic_store(&stage->output->writer_done, true);
+    signal_event(&stage->output->data_event, &stage->output->reader_waiting);
+  }
+  if (stage->input != NULL) {
+    atomic_store(&stage->input->reader_done, true);
+    signal_event(&stage->input->space_event, &stage->input->writer_waiting);
+  }
+  return NULL;
+}
+
+/**
+ * Check whether a pipeline stage may be fused with its neighbours: an
+ * in-process utility with arguments it handles and no redirection
+ */
+bool fusion_stage_fusable(char* args[]) {
+  utility_function utility;
+  int i;
+
+  if (!option_enabled(OPTION_FUSION) || args[0] == NULL) {
+    return false;
+  }
+  utility = find_utility(args[0]);
+  if (utility == NULL) {
+    return false;
+  }
+  for (i = 1; args[i] != NULL; i++) {
+    if (strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0) {
+      return false;
+    }
+  }
+  return utility(args, true) == 0;
+}
+
+/**
+ * Run fused stages in this (forked) process and exit with the last
+ * stage's status
+ * @param stages Arguments of each stage, all accepted by fusion_stage_fusable()
+ */
+void fusion_run(char** stages[], int stage_count) {
+  fused_stage* fused;
+  fusion_ring* rings;
+  pthread_t thread;
+  int i, status;
+
+  limits_apply_in_child();
+  sched_apply_in_child(NULL);
+  stats_check_descriptors(stages[0][0], false);
+  fused = calloc(stage_count, sizeof(fused_stage));
+  rings = aligned_alloc(CACHE_LINE_SIZE, (stage_count - 1) * sizeof(fusion_ring));
+  if (fused == NULL || rings == NULL) {
+    perror("fusion");
+    _exit(1);
+  }
+  memset(rings, 0, (stage_count - 1) * sizeof(fusion_ring));
+  for (i = 0; i < stage_count; i++) {
+    fused[i].args = stages[i];
+    fused[i].utility = find_utility(stages[i][0]);
+    fused[i].input = i > 0 ? &rings[i - 1] : NULL;
+    fused[i].output = i < stage_count - 1 ? &rings[i] : NULL;
+    if (fused[i].output != NULL) {
+      fused[i].output->data = malloc(FUSION_RING_SIZE);
+      if (fused[i].output->data == NULL) {
+        perror("fusion");
+        _exit(1);
+      }
+    }
+  }
+  for (i = 0; i < stage_count - 1; i++) {
+    if (pthread_create(&thread, NULL, run_fused_stage, &fused[i]) != 0) {
+      perror("pthread_create");
+      _exit(1);
+    }
+    pthread_detach(thread);
+  }
+  stats_add(COUNTER_UTILITY_RUNS, stage_count);
+  stats_add(COUNTER_FUSED_STAGES, stage_count);
+  run_fused_stage(&fused[stage_count - 1]);
+  status = fused[stage_count - 1].status;
+  _exit(status == UTILITY_UNSUPPORTED ? 1 : status);
+}
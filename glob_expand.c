@@ -0,0 +1,545 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Pathname expansion for unquoted words containing *, ? or [...].
+ *
+ * Directories are read with getdents64 into one large buffer and the
+ * listings are cached until glob_cache_reset() is called, so a command
+ * line such as "cp *.a *.b dest" reads each directory only once.
+ * "**" matches zero or more directories. Matches of each pattern are
+ * sorted in byte order; the caller decides what to do when a pattern
+ * matches nothing.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "shell2.h"
+
+#define GETDENTS_BUFFER_SIZE (1024 * 1024)
+#define DIRECTORY_CACHE_INITIAL_SLOTS 64
+#define INSERTION_SORT_THRESHOLD 16
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+typedef struct {
+  char* name;
+  unsigned char type;
+} directory_entry;
+
+typedef struct {
+  char* path;
+  directory_entry* entries;
+  size_t count;
+  bool readable;
+} directory_listing;
+
+/* Open-addressing table of listings, keyed by directory path */
+static directory_listing* cache_slots;
+static size_t cache_slot_count;
+static size_t cache_used_count;
+static string_arena cache_arena;
+static char* getdents_buffer;
+
+/**
+ * Check whether a word needs pathname expansion
+ * @param pattern Word to inspect
+ * @return true if it holds an unescaped *, ? or a bracket expression
+ */
+bool glob_has_magic(const char* pattern) {
+  const char* cursor;
+
+  for (cursor = pattern; *cursor != '\0'; cursor++) {
+    if (*cursor == '\\' && cursor[1] != '\0') {
+      cursor++;
+    }
+    else if (*cursor == '*' || *cursor == '?') {
+      return true;
+    }
+    else if (*cursor == '[' && strchr(cursor + 1, ']') != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Match a bracket expression starting after '['
+ * @param pattern Pointer just past '['
+ * @param c Character to test
+ * @param matched Set to whether c is in the set
+ * @return Pointer just past the closing ']', or NULL if unterminated
+ */
+static const char* match_bracket(const char* pattern, unsigned char c, bool* matched) {
+  bool negate = false;
+  bool found = false;
+  unsigned char low, high;
+
+  if (*pattern == '!' || *pattern == '^') {
+    negate = true;
+    pattern++;
+  }
+  /* A ']' right after '[' or '[!' is literal */
+  if (*pattern == ']') {
+    found = (c == ']');
+    pattern++;
+  }
+  while (*pattern != ']') {
+    if (*pattern == '\0') {
+      return NULL;
+    }
+    if (*pattern == '\\' && pattern[1] != '\0') {
+      pattern++;
+    }
+    low = (unsigned char)*pattern++;
+    high = low;
+    if (*pattern == '-' && pattern[1] != ']' && pattern[1] != '\0') {
+      pattern++;
+      if (*pattern == '\\' && pattern[1] != '\0') {
+        pattern++;
+      }
+      high = (unsigned char)*pattern++;
+    }
+    if (c >= low && c <= high) {
+      found = true;
+    }
+  }
+  *matched = (found != negate);
+  return pattern + 1;
+}
+
+/**
+ * Match one path component against one pattern component.
+ * Uses a single backtrack point for '*', so it runs in linear time
+ * for the usual patterns.
+ * @return true on match
+ */
+static bool match_component(const char* pattern, const char* name) {
+  const char* star_pattern = NULL;
+  const char* star_name = NULL;
+  const char* next;
+  bool matched;
+
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      star_pattern = ++pattern;
+      star_name = name;
+      continue;
+    }
+    if (*pattern == '?') {
+      pattern++;
+      name++;
+      continue;
+    }
+    if (*pattern == '[') {
+      next = match_bracket(pattern + 1, (unsigned char)*name, &matched);
+      if (next != NULL) {
+        if (matched) {
+          pattern = next;
+          name++;
+          continue;
+        }
+      }
+      else if (*name == '[') {
+        /* Unterminated bracket is a literal '[' */
+        pattern++;
+        name++;
+        continue;
+      }
+    }
+    else {
+      if (*pattern == '\\' && pattern[1] != '\0') {
+        pattern++;
+      }
+      if (*pattern == *name) {
+        pattern++;
+        name++;
+        continue;
+      }
+    }
+    if (star_pattern == NULL) {
+      return false;
+    }
+    pattern = star_pattern;
+    name = ++star_name;
+  }
+  while (*pattern == '*') {
+    pattern++;
+  }
+  return *pattern == '\0';
+}
+
+/**
+ * Return byte depth of a string, treating the terminator as 0
+ */
+static inline int char_at(const char* text, size_t depth) {
+  return (unsigned char)text[depth];
+}
+
+static void swap_strings(char** strings, size_t a, size_t b) {
+  char* temp = strings[a];
+  strings[a] = strings[b];
+  strings[b] = temp;
+}
+
+/**
+ * Multikey quicksort (Bentley and Sedgewick). Each string byte is
+ * compared at most a few times, and small partitions finish with an
+ * insertion sort that compares from the current depth onward.
+ */
+static void multikey_quicksort(char** strings, size_t count, size_t depth) {
+  size_t less_end, greater_start, scan, i, j;
+  int pivot, current;
+
+  while (count > INSERTION_SORT_THRESHOLD) {
+    swap_strings(strings, 0, count / 2);
+    pivot = char_at(strings[0], depth);
+    less_end = 1;
+    scan = 1;
+    greater_start = count;
+    /* Three-way partition: [1,less_end) < pivot, ... , [greater_start,count) > pivot */
+    while (scan < greater_start) {
+      current = char_at(strings[scan], depth);
+      if (current < pivot) {
+        swap_strings(strings, less_end++, scan++);
+      }
+      else if (current > pivot) {
+        swap_strings(strings, scan, --greater_start);
+      }
+      else {
+        scan++;
+      }
+    }
+    /* Move the pivot into the equal range */
+    swap_strings(strings, 0, less_end - 1);
+    multikey_quicksort(strings, less_end - 1, depth);
+    multikey_quicksort(strings + greater_start, count - greater_start, depth);
+    if (pivot == 0) {
+      return;
+    }
+    strings += less_end - 1;
+    count = greater_start - (less_end - 1);
+    depth++;
+  }
+  for (i = 1; i < count; i++) {
+    for (j = i; j > 0 && strcmp(strings[j - 1] + depth, strings[j] + depth) > 0; j--) {
+      swap_strings(strings, j - 1, j);
+    }
+  }
+}
+
+/**
+ * Sort strings in byte order
+ * @param strings Array of strings
+ * @param count Number of strings
+ */
+void sort_strings(char** strings, size_t count) {
+  multikey_quicksort(strings, count, 0);
+}
+
+static size_t hash_path(const char* path) {
+  size_t hash = 14695981039346656037ULL;
+  while (*path != '\0') {
+    hash = (hash ^ (unsigned char)*path++) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+ * Find the slot for path, growing the table if it is getting full
+ */
+static directory_listing* cache_lookup_slot(const char* path) {
+  directory_listing* old_slots;
+  size_t old_count, index, mask;
+
+  if (cache_used_count * 2 >= cache_slot_count) {
+    old_slots = cache_slots;
+    old_count = cache_slot_count;
+    cache_slot_count = old_count ? old_count * 2 : DIRECTORY_CACHE_INITIAL_SLOTS;
+    cache_slots = calloc(cache_slot_count, sizeof(directory_listing));
+    if (cache_slots == NULL) {
+      perror("calloc");
+      exit(1);
+    }
+    for (index = 0; index < old_count; index++) {
+      if (old_slots[index].path != NULL) {
+        *cache_lookup_slot(old_slots[index].path) = old_slots[index];
+      }
+    }
+    free(old_slots);
+  }
+  mask = cache_slot_count - 1;
+  index = hash_path(path) & mask;
+  while (cache_slots[index].path != NULL && strcmp(cache_slots[index].path, path) != 0) {
+    index = (index + 1) & mask;
+  }
+  return &cache_slots[index];
+}
+
+/**
+ * Read a directory with getdents64, using the cached listing if this
+ * command line has already read it
+ * @param path Directory path ("" means the current directory)
+ * @return Listing; readable is false if the directory could not be opened
+ */
+static directory_listing* read_directory(const char* path) {
+  directory_listing* listing = cache_lookup_slot(path);
+  directory_entry* entries = NULL;
+  size_t capacity = 0;
+  struct linux_dirent64* record;
+  long bytes_read, offset;
+  int directory_fd;
+
+  if (listing->path != NULL) {
+    return listing;
+  }
+  listing->path = string_arena_strdup(&cache_arena, path);
+  listing->entries = NULL;
+  listing->count = 0;
+  listing->readable = false;
+  cache_used_count++;
+
+  directory_fd = open(path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directory_fd < 0) {
+    return listing;
+  }
+  if (getdents_buffer == NULL) {
+    getdents_buffer = malloc(GETDENTS_BUFFER_SIZE);
+    if (getdents_buffer == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+  }
+  while ((bytes_read = syscall(SYS_getdents64, directory_fd, getdents_buffer, GETDENTS_BUFFER_SIZE)) > 0) {
+    for (offset = 0; offset < bytes_read; offset += record->d_reclen) {
+      record = (struct linux_dirent64*)(getdents_buffer + offset);
+      if (record->d_name[0] == '.' &&
+          (record->d_name[1] == '\0' || (record->d_name[1] == '.' && record->d_name[2] == '\0'))) {
+        continue;
+      }
+      if (listing->count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        entries = realloc(entries, capacity * sizeof(directory_entry));
+        if (entries == NULL) {
+          perror("realloc");
+          exit(1);
+        }
+      }
+      entries[listing->count].name = string_arena_strdup(&cache_arena, record->d_name);
+      entries[listing->count].type = record->d_type;
+      listing->count++;
+    }
+  }
+  close(directory_fd);
+  listing->entries = entries;
+  listing->readable = true;
+  return listing;
+}
+
+/**
+ * Forget every cached directory listing. Called once per command line
+ * so later commands see files created by earlier ones.
+ */
+void glob_cache_reset(void) {
+  size_t index;
+
+  for (index = 0; index < cache_slot_count; index++) {
+    free(cache_slots[index].entries);
+  }
+  free(cache_slots);
+  cache_slots = NULL;
+  cache_slot_count = 0;
+  cache_used_count = 0;
+  string_arena_reset(&cache_arena);
+}
+
+/**
+ * Check whether a directory entry is a directory, without following
+ * symlinks (so "**" cannot loop)
+ */
+static bool entry_is_directory(const char* base, const directory_entry* entry) {
+  struct stat status;
+  char* path;
+  bool result;
+
+  if (entry->type != DT_UNKNOWN) {
+    return entry->type == DT_DIR;
+  }
+  path = malloc(strlen(base) + strlen(entry->name) + 2);
+  if (path == NULL) {
+    return false;
+  }
+  sprintf(path, "%s%s%s", base, base[0] && base[strlen(base) - 1] != '/' ? "/" : "", entry->name);
+  result = lstat(path, &status) == 0 && S_ISDIR(status.st_mode);
+  free(path);
+  return result;
+}
+
+static char* join_path(string_arena* arena, const char* base, const char* name, size_t name_length) {
+  size_t base_length = strlen(base);
+  bool needs_slash = base_length > 0 && base[base_length - 1] != '/';
+  char* path = string_arena_alloc(arena, base_length + needs_slash + name_length + 1);
+
+  memcpy(path, base, base_length);
+  if (needs_slash) {
+    path[base_length] = '/';
+  }
+  memcpy(path + base_length + needs_slash, name, name_length);
+  path[base_length + needs_slash + name_length] = '\0';
+  return path;
+}
+
+/**
+ * Copy a literal component, dropping backslash escapes
+ */
+static char* unescape_component(string_arena* arena, const char* component) {
+  char* result = string_arena_alloc(arena, strlen(component) + 1);
+  char* out = result;
+
+  while (*component != '\0') {
+    if (*component == '\\' && component[1] != '\0') {
+      component++;
+    }
+    *out++ = *component++;
+  }
+  *out = '\0';
+  return result;
+}
+
+/**
+ * Recursive worker: expand components[index..] below base
+ * @param base Path matched so far ("" for relative patterns)
+ * @param components Pattern split on '/'
+ * @param component_count Number of components
+ * @param index Component to match next
+ */
+static void expand_components(const char* base, char** components, size_t component_count,
+                              size_t index, argument_vector* output, string_arena* arena) {
+  const char* component;
+  directory_listing* listing;
+  struct stat status;
+  char* path;
+  char* literal;
+  size_t entry_index;
+  bool is_last;
+
+  if (index == component_count) {
+    argument_vector_push(output, (char*)base);
+    return;
+  }
+  component = components[index];
+  is_last = (index + 1 == component_count);
+
+  if (!glob_has_magic(component)) {
+    literal = unescape_component(arena, component);
+    path = join_path(arena, base, literal, strlen(literal));
+    if (is_last) {
+      if (lstat(path, &status) == 0) {
+        argument_vector_push(output, path);
+      }
+      return;
+    }
+    expand_components(path, components, component_count, index + 1, output, arena);
+    return;
+  }
+
+  listing = read_directory(base);
+  if (!listing->readable) {
+    return;
+  }
+
+  if (strcmp(component, "**") == 0) {
+    if (!is_last) {
+      /* "**" matching zero directories */
+      expand_components(base, components, component_count, index + 1, output, arena);
+      listing = read_directory(base);
+    }
+    for (entry_index = 0; entry_index < listing->count; entry_index++) {
+      directory_entry* entry = &listing->entries[entry_index];
+      if (entry->name[0] == '.') {
+        continue;
+      }
+      path = join_path(arena, base, entry->name, strlen(entry->name));
+      if (is_last) {
+        argument_vector_push(output, path);
+      }
+      if (entry_is_directory(base, entry)) {
+        expand_components(path, components, component_count, index, output, arena);
+        /* read_directory may have grown the cache table */
+        listing = read_directory(base);
+      }
+    }
+    return;
+  }
+
+  for (entry_index = 0; entry_index < listing->count; entry_index++) {
+    directory_entry* entry = &listing->entries[entry_index];
+    /* Leading dots must be matched explicitly */
+    if (entry->name[0] == '.' && component[0] != '.') {
+      continue;
+    }
+    if (!match_component(component, entry->name)) {
+      continue;
+    }
+    path = join_path(arena, base, entry->name, strlen(entry->name));
+    if (is_last) {
+      argument_vector_push(output, path);
+    }
+    else if (entry_is_directory(base, entry) || entry->type == DT_LNK) {
+      expand_components(path, components, component_count, index + 1, output, arena);
+      listing = read_directory(base);
+    }
+  }
+}
+
+/**
+ * Expand a pattern and append the sorted matches to output
+ * @param pattern Word to expand
+ * @param output Argument list to append to
+ * @param arena Arena that owns the resulting strings
+ * @return Number of matches appended (0 if nothing matched)
+ */
+size_t glob_expand_pattern(const char* pattern, argument_vector* output, string_arena* arena) {
+  argument_vector components = {0};
+  size_t first_match = output->count;
+  char* copy = string_arena_strdup(arena, pattern);
+  char* cursor = copy;
+  char* slash;
+  const char* base = "";
+
+  if (*cursor == '/') {
+    base = "/";
+    while (*cursor == '/') {
+      cursor++;
+    }
+  }
+  while ((slash = strchr(cursor, '/')) != NULL) {
+    *slash = '\0';
+    if (*cursor != '\0') {
+      argument_vector_push(&components, cursor);
+    }
+    cursor = slash + 1;
+  }
+  /* A trailing slash leaves an empty last component: only directories match */
+  argument_vector_push(&components, cursor);
+
+  expand_components(base, components.items, components.count, 0, output, arena);
+  free(components.items);
+
+  sort_strings(output->items + first_match, output->count - first_match);
+  return output->count - first_match;
+}
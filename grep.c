@@ -0,0 +1,632 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * In-process grep for "set -o utilities": fixed strings and simple
+ * basic regular expressions (literals, ".", "*", "^" and "$").
+ *
+ * Rather than testing line by line, the whole input block is searched
+ * for the pattern's longest required literal, and a line is only looked
+ * at when that literal turns up in it. The search compares the
+ * literal's first and last bytes against 32 (AVX2) or 16 (SSE2)
+ * positions at a time and checks the rest of the literal only where
+ * both agree; without either instruction set it falls back to memmem().
+ * The SIMD version is picked once, from what the CPU supports.
+ *
+ * Regular files are mapped instead of read, and selected lines are
+ * written in large blocks. Options: -F, -i, -v, -c, -n and -q. Bracket
+ * expressions, backslashes and any other option go to the real grep.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GREP_X86_SIMD 1
+#endif
+#include "shell2.h"
+
+#define GREP_BUFFER_SIZE (256 * 1024)
+#define GREP_OUTPUT_SIZE (128 * 1024)
+
+typedef struct grep_search grep_search;
+
+typedef const char* (*literal_finder)(const grep_search* search, const char* text, size_t length);
+
+struct grep_search {
+  const char* pattern;        /* regular expression, without a leading "^" */
+  size_t pattern_length;
+  bool anchored;              /* pattern started with "^" */
+  bool literal_is_pattern;    /* finding the literal is a match: no regex check */
+  const char* literal;        /* longest run every match must contain */
+  size_t literal_length;
+  unsigned char first[2];     /* literal's first byte, in both cases */
+  unsigned char last[2];      /* literal's last byte, in both cases */
+  bool ignore_case, invert, count_only, quiet, line_numbers;
+  unsigned char fold[256];    /* byte to compare by: lower case with -i */
+  literal_finder find;
+  const char* prefix;         /* "NAME:" in front of output lines, or NULL */
+  unsigned long long line_number;  /* of the next line to be scanned */
+  unsigned long long selected;     /* lines selected in this input; blocks
+                                      written whole count once */
+  char output[GREP_OUTPUT_SIZE];
+  size_t output_length;
+};
+
+/**
+ * Compare two byte runs, ignoring case if asked
+ */
+static bool bytes_equal(const grep_search* search, const char* left, const char* right, size_t length) {
+  size_t i;
+
+  if (!search->ignore_case) {
+    return memcmp(left, right, length) == 0;
+  }
+  for (i = 0; i < length; i++) {
+    if (search->fold[(unsigned char)left[i]] != search->fold[(unsigned char)right[i]]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Search without SIMD: memmem(), or a first-byte scan when ignoring case
+ */
+static const char* find_literal_scalar(const grep_search* search, const char* text, size_t length) {
+  const char* end = text + length;
+  const char* scan;
+
+  if (!search->ignore_case) {
+    return memmem(text, length, search->literal, search->literal_length);
+  }
+  for (scan = text; (size_t)(end - scan) >= search->literal_length; scan++) {
+    if (search->fold[(unsigned char)*scan] == search->first[0] &&
+        bytes_equal(search, scan, search->literal, search->literal_length)) {
+      return scan;
+    }
+  }
+  return NULL;
+}
+
+#ifdef GREP_X86_SIMD
+/**
+ * Search 32 candidate positions per step with AVX2
+ */
+__attribute__((target("avx2")))
+static const char* find_literal_avx2(const grep_search* search, const char* text, size_t length) {
+  const __m256i first_lower = _mm256_set1_epi8(search->first[0]);
+  const __m256i first_upper = _mm256_set1_epi8(search->first[1]);
+  const __m256i last_lower = _mm256_set1_epi8(search->last[0]);
+  const __m256i last_upper = _mm256_set1_epi8(search->last[1]);
+  size_t last_offset = search->literal_length - 1;
+  __m256i block_first, block_last, hits;
+  unsigned int mask;
+  const char* found;
+  size_t i;
+
+  for (i = 0; i + last_offset + 32 <= length; i += 32) {
+    block_first = _mm256_loadu_si256((const __m256i*)(text + i));
+    block_last = _mm256_loadu_si256((const __m256i*)(text + i + last_offset));
+    hits = _mm256_and_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block_first, first_lower),
+                                            _mm256_cmpeq_epi8(block_first, first_upper)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(block_last, last_lower),
+                                            _mm256_cmpeq_epi8(block_last, last_upper)));
+    for (mask = _mm256_movemask_epi8(hits); mask != 0; mask &= mask - 1) {
+      found = text + i + __builtin_ctz(mask);
+      if (bytes_equal(search, found, search->literal, search->literal_length)) {
+        return found;
+      }
+    }
+  }
+  return find_literal_scalar(search, text + i, length - i);
+}
+
+/**
+ * Search 16 candidate positions per step with SSE2
+ */
+__attribute__((target("sse2")))
+static const char* find_literal_sse2(const grep_search* search, const char* text, size_t length) {
+  const __m128i first_lower = _mm_set1_epi8(search->first[0]);
+  const __m128i first_upper = _mm_set1_epi8(search->first[1]);
+  const __m128i last_lower = _mm_set1_epi8(search->last[0]);
+  const __m128i last_upper = _mm_set1_epi8(search->last[1]);
+  size_t last_offset = search->literal_length - 1;
+  __m128i block_first, block_last, hits;
+  unsigned int mask;
+  const char* found;
+  size_t i;
+
+  for (i = 0; i + last_offset + 16 <= length; i += 16) {
+    block_first = _mm_loadu_si128((const __m128i*)(text + i));
+    block_last = _mm_loadu_si128((const __m128i*)(text + i + last_offset));
+    hits = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(block_first, first_lower),
+                                      _mm_cmpeq_epi8(block_first, first_upper)),
+                         _mm_or_si128(_mm_cmpeq_epi8(block_last, last_lower),
+                                      _mm_cmpeq_epi8(block_last, last_upper)));
+    for (mask = _mm_movemask_epi8(hits); mask != 0; mask &= mask - 1) {
+      found = text + i + __builtin_ctz(mask);
+      if (bytes_equal(search, found, search->literal, search->literal_length)) {
+        return found;
+      }
+    }
+  }
+  return find_literal_scalar(search, text + i, length - i);
+}
+#endif
+
+/**
+ * Pick the fastest literal search this CPU can run
+ */
+static literal_finder choose_finder(void) {
+#ifdef GREP_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return find_literal_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return find_literal_sse2;
+  }
+#endif
+  return find_literal_scalar;
+}
+
+/**
+ * Find the next place the required literal occurs
+ * @return Position of the literal, or NULL if it is not in the text
+ */
+static const char* find_literal(const grep_search* search, const char* text, size_t length) {
+  if (search->literal_length == 0) {
+    return length > 0 ? text : NULL;
+  }
+  if (search->literal_length == 1 && !search->ignore_case) {
+    return memchr(text, search->literal[0], length);
+  }
+  return search->find(search, text, length);
+}
+
+static bool match_here(const grep_search* search, const char* pattern, const char* text, const char* end);
+
+/**
+ * Match "c*" followed by the rest of the pattern
+ */
+static bool match_star(const grep_search* search, char c, const char* pattern, const char* text, const char* end) {
+  while (true) {
+    if (match_here(search, pattern, text, end)) {
+      return true;
+    }
+    if (text == end || (c != '.' && !bytes_equal(search, text, &c, 1))) {
+      return false;
+    }
+    text++;
+  }
+}
+
+/**
+ * Match the pattern from this point of the line
+ */
+static bool match_here(const grep_search* search, const char* pattern, const char* text, const char* end) {
+  const char* pattern_end = search->pattern + search->pattern_length;
+  const char* rest;
+
+  if (pattern == pattern_end) {
+    return true;
+  }
+  if (pattern + 1 < pattern_end && pattern[1] == '*') {
+    /* As in GNU grep, "a**" is "a*": further stars repeat nothing new */
+    for (rest = pattern + 2; rest < pattern_end && *rest == '*'; rest++) {
+    }
+    return match_star(search, pattern[0], rest, text, end);
+  }
+  if (pattern[0] == '$' && pattern + 1 == pattern_end) {
+    return text == end;
+  }
+  if (text < end && (pattern[0] == '.' || bytes_equal(search, pattern, text, 1))) {
+    return match_here(search, pattern + 1, text + 1, end);
+  }
+  return false;
+}
+
+/**
+ * Check the whole regular expression against one line (without its newline)
+ */
+static bool line_matches(const grep_search* search, const char* line, const char* end) {
+  const char* start;
+
+  if (search->literal_is_pattern) {
+    return true;
+  }
+  if (search->anchored) {
+    return match_here(search, search->pattern, line, end);
+  }
+  for (start = line; ; start++) {
+    if (match_here(search, search->pattern, start, end)) {
+      return true;
+    }
+    if (start == end) {
+      return false;
+    }
+  }
+}
+
+static bool flush_output(grep_search* search) {
+  bool ok = utility_write_all(STDOUT_FILENO, search->output, search->output_length);
+
+  search->output_length = 0;
+  return ok;
+}
+
+static bool emit(grep_search* search, const char* data, size_t length) {
+  if (search->output_length + length > sizeof(search->output) && !flush_output(search)) {
+    return false;
+  }
+  if (length >= sizeof(search->output)) {
+    return utility_write_all(STDOUT_FILENO, data, length);
+  }
+  memcpy(search->output + search->output_length, data, length);
+  search->output_length += length;
+  return true;
+}
+
+static unsigned long long count_lines(const char* start, const char* end) {
+  unsigned long long lines = 0;
+
+  while ((start = memchr(start, '\n', end - start)) != NULL) {
+    start++;
+    lines++;
+  }
+  return lines;
+}
+
+/**
+ * Step over lines that are not selected, keeping the line number right
+ */
+static void skip_lines(grep_search* search, const char* start, const char* end) {
+  if (search->line_numbers && start < end) {
+    search->line_number += count_lines(start, end);
+  }
+}
+
+/**
+ * Output (or count) the whole lines in [start, end)
+ * @return false on a write error
+ */
+static bool select_lines(grep_search* search, const char* start, const char* end) {
+  char number[32];
+  const char* line_end;
+  unsigned long long lines;
+
+  if (start == end) {
+    return true;
+  }
+  if (search->count_only || search->quiet) {
+    lines = count_lines(start, end);
+    search->selected += lines;
+    search->line_number += lines;
+    return true;
+  }
+  if (search->prefix == NULL && !search->line_numbers) {
+    search->selected += 1;
+    return emit(search, start, end - start);
+  }
+  for (; start < end; start = line_end) {
+    line_end = (const char*)memchr(start, '\n', end - start) + 1;
+    search->selected++;
+    search->line_number++;
+    if ((search->prefix != NULL && !emit(search, search->prefix, strlen(search->prefix))) ||
+        (search->line_numbers &&
+         !emit(search, number, snprintf(number, sizeof(number), "%llu:", search->line_number))) ||
+        !emit(search, start, line_end - start)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Search a block of whole lines, each ending in a newline
+ * @return false on a write error
+ */
+static bool scan_block(grep_search* search, const char* start, const char* end) {
+  const char* hit;
+  const char* line_start;
+  const char* line_end;
+  bool matched;
+
+  while (start < end) {
+    if (search->quiet && search->selected > 0) {
+      return true;
+    }
+    hit = find_literal(search, start, end - start);
+    if (hit == NULL) {
+      if (search->invert) {
+        return select_lines(search, start, end);
+      }
+      skip_lines(search, start, end);
+      return true;
+    }
+    line_start = memrchr(start, '\n', hit - start);
+    line_start = line_start != NULL ? line_start + 1 : start;
+    line_end = (const char*)memchr(hit, '\n', end - hit) + 1;
+    matched = line_matches(search, line_start, line_end - 1);
+    if (search->invert) {
+      if (!select_lines(search, start, matched ? line_start : line_end)) {
+        return false;
+      }
+      if (matched) {
+        skip_lines(search, line_start, line_end);
+      }
+    } else if (matched) {
+      skip_lines(search, start, line_start);
+      if (!select_lines(search, line_start, line_end)) {
+        return false;
+      }
+    } else {
+      skip_lines(search, start, line_end);
+    }
+    start = line_end;
+  }
+  return true;
+}
+
+/**
+ * Search a partial last line, which has no newline of its own
+ */
+static bool scan_last_line(grep_search* search, const char* text, size_t length) {
+  char* line = malloc(length + 1);
+  bool ok;
+
+  if (line == NULL) {
+    perror("malloc");
+    return false;
+  }
+  memcpy(line, text, length);
+  line[length] = '\n';
+  ok = scan_block(search, line, line + length + 1);
+  free(line);
+  return ok;
+}
+
+/**
+ * Search a regular file through a read-only mapping
+ * @return 1 if it was searched, 0 if it could not be mapped, -1 on a write error
+ */
+static int scan_mapped(grep_search* search, int fd, const struct stat* file_status) {
+  const char* text;
+  const char* last_newline;
+  size_t length = file_status->st_size;
+  bool ok;
+
+  text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED) {
+    return 0;
+  }
+  madvise((void*)text, length, MADV_SEQUENTIAL);
+  last_newline = memrchr(text, '\n', length);
+  ok = scan_block(search, text, last_newline != NULL ? last_newline + 1 : text);
+  if (ok && last_newline != text + length - 1) {
+    last_newline = last_newline != NULL ? last_newline + 1 : text;
+    ok = scan_last_line(search, last_newline, text + length - last_newline);
+  }
+  munmap((void*)text, length);
+  return ok ? 1 : -1;
+}
+
+/**
+ * Search everything readable from fd
+ * @return false on a read or write error
+ */
+static bool scan_input(grep_search* search, int fd) {
+  struct stat file_status;
+  char* buffer = NULL;
+  char* grown;
+  const char* last_newline;
+  size_t kept = 0, capacity = 0, used;
+  ssize_t count;
+  int mapped;
+  bool ok = true;
+
+  if (utility_regular_file(fd, &file_status) && file_status.st_size > 0) {
+    mapped = scan_mapped(search, fd, &file_status);
+    if (mapped != 0) {
+      return mapped > 0;
+    }
+  }
+  while (ok && !(search->quiet && search->selected > 0)) {
+    /* A line longer than the buffer makes it grow */
+    if (kept == capacity) {
+      capacity = capacity > 0 ? capacity * 2 : GREP_BUFFER_SIZE;
+      grown = realloc(buffer, capacity);
+      if (grown == NULL) {
+        perror("realloc");
+        ok = false;
+        break;
+      }
+      buffer = grown;
+    }
+    count = utility_read(fd, buffer + kept, capacity - kept);
+    if (count < 0) {
+      perror("read");
+      ok = false;
+      break;
+    }
+    if (count == 0) {
+      if (kept > 0) {
+        ok = scan_last_line(search, buffer, kept);
+      }
+      break;
+    }
+    last_newline = memrchr(buffer + kept, '\n', count);
+    kept += count;
+    if (last_newline == NULL) {
+      continue;
+    }
+    used = last_newline + 1 - buffer;
+    ok = scan_block(search, buffer, buffer + used);
+    memmove(buffer, buffer + used, kept - used);
+    kept -= used;
+  }
+  free(buffer);
+  return ok;
+}
+
+/**
+ * Set up the literal search and check the pattern is one we handle
+ * @return false if the real grep is needed
+ */
+static bool compile_pattern(grep_search* search, const char* pattern, bool fixed) {
+  size_t length = strlen(pattern);
+  size_t run_start = 0, run_length = 0, i;
+  bool is_literal;
+
+  if (strchr(pattern, '\n') != NULL) {
+    return false;
+  }
+  search->anchored = !fixed && pattern[0] == '^';
+  if (search->anchored) {
+    pattern++;
+    length--;
+  }
+  search->pattern = pattern;
+  search->pattern_length = length;
+  search->literal = pattern;
+  search->literal_length = 0;
+  search->literal_is_pattern = fixed;
+  if (fixed) {
+    search->literal_length = length;
+  } else {
+    if (strpbrk(pattern, "[\\") != NULL || pattern[0] == '*') {
+      return false;
+    }
+    /* Longest run of characters that are neither "." nor starred */
+    for (i = 0; i <= length; i++) {
+      is_literal = i < length && pattern[i] != '.' && pattern[i] != '*' && pattern[i + 1] != '*' &&
+                   !(pattern[i] == '$' && i + 1 == length);
+      if (is_literal) {
+        run_length++;
+        continue;
+      }
+      if (run_length > search->literal_length) {
+        search->literal = pattern + run_start;
+        search->literal_length = run_length;
+      }
+      run_start = i + 1;
+      run_length = 0;
+    }
+    /* A pattern with nothing but literal characters needs no matcher */
+    search->literal_is_pattern = !search->anchored && search->literal_length == length;
+  }
+  for (i = 0; i < 256; i++) {
+    search->fold[i] = search->ignore_case ? tolower(i) : i;
+  }
+  if (search->literal_length > 0) {
+    search->first[0] = search->fold[(unsigned char)search->literal[0]];
+    search->first[1] = search->ignore_case ? toupper(search->first[0]) : search->first[0];
+    search->last[0] = search->fold[(unsigned char)search->literal[search->literal_length - 1]];
+    search->last[1] = search->ignore_case ? toupper(search->last[0]) : search->last[0];
+  }
+  search->find = choose_finder();
+  return true;
+}
+
+/**
+ * Parse the options and the pattern
+ * @param first Receives the index of the first file operand
+ * @return false if the real grep is needed
+ */
+static bool parse_grep_arguments(grep_search* search, char* args[], int* first) {
+  const char* option;
+  bool fixed = false;
+  int i;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    for (option = args[i] + 1; *option != '\0'; option++) {
+      switch (*option) {
+      case 'F': fixed = true; break;
+      case 'i': search->ignore_case = true; break;
+      case 'v': search->invert = true; break;
+      case 'c': search->count_only = true; break;
+      case 'n': search->line_numbers = true; break;
+      case 'q': search->quiet = true; break;
+      default: return false;
+      }
+    }
+  }
+  *first = i + 1;
+  return args[i] != NULL && compile_pattern(search, args[i], fixed);
+}
+
+/**
+ * grep [-Fivcnq] PATTERN [FILE...]: print the lines that match
+ * @return 0 if a line was selected, 1 if none was, 2 on an error
+ */
+int utility_grep(char* args[], bool check_only) {
+  grep_search* search;
+  char* standard_input[] = { "-", NULL };
+  char prefix[WORKING_DIR_BUFFER_SIZE];
+  char count_line[WORKING_DIR_BUFFER_SIZE + 32];
+  char** operands;
+  unsigned long long total_selected = 0;
+  bool several;
+  int first, fd, status = 0;
+
+  /* Each grep has its own state, so fused stages can run side by side */
+  search = calloc(1, sizeof(grep_search));
+  if (search == NULL) {
+    perror("calloc");
+    return 2;
+  }
+  if (!parse_grep_arguments(search, args, &first)) {
+    free(search);
+    return UTILITY_UNSUPPORTED;
+  }
+  if (check_only) {
+    free(search);
+    return 0;
+  }
+  operands = args[first] != NULL ? args + first : standard_input;
+  several = operands[0] != NULL && operands[1] != NULL;
+
+  for (; *operands != NULL; operands++) {
+    fd = utility_open_operand(args[0], *operands);
+    if (fd < 0) {
+      status = 2;
+      continue;
+    }
+    snprintf(prefix, sizeof(prefix), "%s:", strcmp(*operands, "-") == 0 ? "(standard input)" : *operands);
+    search->prefix = several ? prefix : NULL;
+    search->line_number = 0;
+    search->selected = 0;
+    if (!scan_input(search, fd)) {
+      status = 2;
+    }
+    utility_close_operand(fd);
+    total_selected += search->selected;
+    if (search->count_only && !search->quiet) {
+      emit(search, count_line, snprintf(count_line, sizeof(count_line), "%s%llu\n",
+                                        several ? prefix : "", search->selected));
+    }
+    if (search->quiet && total_selected > 0) {
+      break;
+    }
+  }
+  if (!flush_output(search)) {
+    status = 2;
+  }
+  free(search);
+  if (status != 0) {
+    return status;
+  }
+  return total_selected > 0 ? 0 : 1;
+}
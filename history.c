@@ -0,0 +1,196 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Command history.
+ *
+ * The history file ($HISTFILE, default ~/.shell2_history) is an
+ * append-only log of lines. At startup it is mapped read-only and
+ * never parsed: entries are found by walking newlines backwards from
+ * the end, and only as far as the user scrolls or searches, so a huge
+ * history costs nothing to load. Each new line is appended with a
+ * single O_APPEND write(), so concurrent shells can add to the same
+ * file without rewriting or clobbering it. Lines added by this shell
+ * are also kept in memory, newest last.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell2.h"
+
+#define HISTORY_PATH_SIZE 4096
+
+static bool history_loaded;
+static int history_fd = -1;
+
+/* The file as it was at startup */
+static const char* mapped_history;
+static size_t mapped_size;
+
+/* Lines entered in this session */
+static argument_vector session_lines;
+
+/* Last entry found in the mapping, to make stepping to a neighbour O(line) */
+static size_t cached_age = (size_t)-1;
+static size_t cached_start;
+static size_t cached_end;
+
+/**
+ * Open and map the history file, once
+ */
+static void history_load(void) {
+  char path[HISTORY_PATH_SIZE];
+  const char* file_name = variable_get("HISTFILE");
+  const char* home = variable_get("HOME");
+  struct stat file_status;
+  void* mapping;
+
+  if (history_loaded) {
+    return;
+  }
+  history_loaded = true;
+  if (file_name == NULL) {
+    if (home == NULL) {
+      return;
+    }
+    snprintf(path, sizeof(path), "%s/.shell2_history", home);
+    file_name = path;
+  }
+  history_fd = open(file_name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (history_fd < 0) {
+    return;
+  }
+  if (fstat(history_fd, &file_status) < 0 || file_status.st_size == 0) {
+    return;
+  }
+  mapping = mmap(NULL, file_status.st_size, PROT_READ, MAP_SHARED, history_fd, 0);
+  if (mapping == MAP_FAILED) {
+    perror("mmap");
+    return;
+  }
+  mapped_history = mapping;
+  mapped_size = file_status.st_size;
+  cached_end = mapped_size;
+  if (mapped_history[mapped_size - 1] == '\n') {
+    cached_end--;
+  }
+  else if (write(history_fd, "\n", 1) < 0) {
+    /* A log cut short by a crash: end its last line before appending */
+    perror("history");
+  }
+}
+
+/**
+ * Make the cache hold the mapped entry with the given age (0 is the
+ * newest line in the file)
+ * @return false if the file has fewer entries
+ */
+static bool seek_mapped_entry(size_t age) {
+  const char* newline;
+
+  if (mapped_size == 0) {
+    return false;
+  }
+  if (cached_age == (size_t)-1) {
+    /* First use: the newest line ends at cached_end, set by history_load() */
+    newline = memrchr(mapped_history, '\n', cached_end);
+    cached_start = newline != NULL ? (size_t)(newline - mapped_history) + 1 : 0;
+    cached_age = 0;
+  }
+  while (cached_age < age) {
+    if (cached_start == 0) {
+      return false;
+    }
+    cached_end = cached_start - 1;
+    newline = memrchr(mapped_history, '\n', cached_end);
+    cached_start = newline != NULL ? (size_t)(newline - mapped_history) + 1 : 0;
+    cached_age++;
+  }
+  while (cached_age > age) {
+    cached_start = cached_end + 1;
+    newline = memchr(mapped_history + cached_start, '\n', mapped_size - cached_start);
+    cached_end = newline != NULL ? (size_t)(newline - mapped_history) : mapped_size;
+    cached_age--;
+  }
+  return true;
+}
+
+/**
+ * Look up a history entry
+ * @param age 0 for the most recent entry, 1 for the one before, ...
+ * @param text Receives the entry; it is not NUL-terminated
+ * @param length Receives its length
+ * @return false if there are fewer entries
+ */
+bool history_get(size_t age, const char** text, size_t* length) {
+  history_load();
+  if (age < session_lines.count) {
+    *text = session_lines.items[session_lines.count - 1 - age];
+    *length = strlen(*text);
+    return true;
+  }
+  if (!seek_mapped_entry(age - session_lines.count)) {
+    return false;
+  }
+  *text = mapped_history + cached_start;
+  *length = cached_end - cached_start;
+  return true;
+}
+
+/**
+ * Find the newest entry at or older than age that contains query
+ * @return Age of the match, or (size_t)-1 if there is none
+ */
+size_t history_search(const char* query, size_t age) {
+  size_t query_length = strlen(query);
+  const char* text;
+  size_t length;
+
+  for (; history_get(age, &text, &length); age++) {
+    if (memmem(text, length, query, query_length) != NULL) {
+      return age;
+    }
+  }
+  return (size_t)-1;
+}
+
+/**
+ * Record an entered line, in memory and at the end of the history file.
+ * Blank lines and repeats of the previous entry are skipped.
+ */
+void history_add(const char* line) {
+  const char* previous;
+  size_t previous_length;
+  size_t length = strlen(line);
+  char* entry;
+
+  history_load();
+  if (strspn(line, " \t") == length) {
+    return;
+  }
+  if (history_get(0, &previous, &previous_length) && previous_length == length &&
+      memcmp(previous, line, length) == 0) {
+    return;
+  }
+  entry = malloc(length + 2);
+  if (entry == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  memcpy(entry, line, length);
+  if (history_fd >= 0) {
+    /* One write, so lines from concurrent shells never interleave */
+    entry[length] = '\n';
+    if (write(history_fd, entry, length + 1) < 0) {
+      perror("history");
+    }
+  }
+  entry[length] = '\0';
+  argument_vector_push(&session_lines, entry);
+}
@@ -0,0 +1,350 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * The shell's own I/O when it reads commands from a script or pipe.
+ *
+ * Script lines are read from stdin through a 64 KiB buffer. Builtin
+ * output normally costs one write() per command line. With
+ * "set -o uring" it is held back instead. Pending output is written
+ * only when the shell is about to read more input, fork, write to
+ * stderr or exit. The write and the next input read then go to the
+ * kernel as one linked io_uring submission, a single io_uring_enter().
+ * A script of builtins then costs about one system call per 64 KiB of
+ * input instead of one per line.
+ *
+ * io_uring is driven with raw system calls. If the kernel lacks it or
+ * refuses it, the same buffering runs on plain write() and read().
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "shell2.h"
+
+#define INPUT_BUFFER_SIZE 65536
+#define OUTPUT_BUFFER_SIZE 65536
+#define RING_ENTRIES 4
+
+typedef struct {
+  int fd;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+} submission_ring;
+
+static submission_ring ring = { -1 };
+static bool ring_setup_failed;
+
+static char input_buffer[INPUT_BUFFER_SIZE];
+static size_t input_start, input_end;
+static bool input_at_end;
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_used;
+
+/* The shell's original stdout and stderr while the deferred ones are in place */
+static FILE* direct_stdout;
+static FILE* direct_stderr;
+
+/**
+ * Create the ring. Failure (no io_uring, or disabled by sysctl or
+ * seccomp) is remembered and the plain system calls are used.
+ */
+static bool ring_setup(void) {
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+  struct io_uring_params parameters;
+  size_t sq_size, cq_size;
+  char* sq_pointer;
+  char* cq_pointer;
+
+  if (ring.fd >= 0 || ring_setup_failed) {
+    return ring.fd >= 0;
+  }
+  ring_setup_failed = true;
+  memset(&parameters, 0, sizeof(parameters));
+  ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &parameters);
+  if (ring.fd < 0) {
+    return false;
+  }
+  /* Reads and writes at the current file position need 5.6 */
+  if (!(parameters.features & IORING_FEAT_RW_CUR_POS)) {
+    close(ring.fd);
+    ring.fd = -1;
+    return false;
+  }
+  sq_size = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+  cq_size = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+  if (parameters.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+  }
+  sq_pointer = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  cq_pointer = sq_pointer;
+  if (sq_pointer != MAP_FAILED && !(parameters.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq_pointer = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+  }
+  ring.sqes = mmap(NULL, parameters.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if (sq_pointer == MAP_FAILED || cq_pointer == MAP_FAILED || ring.sqes == MAP_FAILED) {
+    close(ring.fd);
+    ring.fd = -1;
+    return false;
+  }
+  ring.sq_tail = (unsigned int*)(sq_pointer + parameters.sq_off.tail);
+  ring.sq_mask = (unsigned int*)(sq_pointer + parameters.sq_off.ring_mask);
+  ring.sq_array = (unsigned int*)(sq_pointer + parameters.sq_off.array);
+  ring.cq_head = (unsigned int*)(cq_pointer + parameters.cq_off.head);
+  ring.cq_tail = (unsigned int*)(cq_pointer + parameters.cq_off.tail);
+  ring.cq_mask = (unsigned int*)(cq_pointer + parameters.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(cq_pointer + parameters.cq_off.cqes);
+  ring_setup_failed = false;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Queue a read or write at the file's current position
+ * @param user_data Returned with the completion
+ */
+static void ring_queue(unsigned char opcode, int fd, void* buffer, size_t length, bool link,
+                       unsigned long long user_data) {
+  unsigned int tail = *ring.sq_tail;
+  unsigned int index = tail & *ring.sq_mask;
+  struct io_uring_sqe* entry = &ring.sqes[index];
+
+  memset(entry, 0, sizeof(*entry));
+  entry->opcode = opcode;
+  entry->fd = fd;
+  entry->addr = (unsigned long long)(unsigned long)buffer;
+  entry->len = length;
+  entry->off = (unsigned long long)-1;
+  entry->flags = link ? IOSQE_IO_LINK : 0;
+  entry->user_data = user_data;
+  ring.sq_array[index] = index;
+  __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submit everything queued and wait for that many completions
+ * @param results Receives each result, indexed by user_data
+ * @return false if io_uring_enter() failed
+ */
+static bool ring_submit_and_wait(unsigned int count, int* results) {
+  unsigned int head, seen = 0;
+  long entered;
+
+  do {
+    entered = syscall(__NR_io_uring_enter, ring.fd, seen == 0 ? count : 0, count - seen,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+    if (entered < 0 && errno != EINTR) {
+      return false;
+    }
+    head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      results[ring.cqes[head & *ring.cq_mask].user_data] = ring.cqes[head & *ring.cq_mask].res;
+      head++;
+      seen++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  } while (seen < count);
+  return true;
+}
+
+/**
+ * Write all of buffer with write(), as the fallback and for short writes
+ */
+static void write_fully(int fd, const char* buffer, size_t length) {
+  ssize_t written;
+
+  while (length > 0) {
+    written = write(fd, buffer, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buffer += written;
+    length -= written;
+  }
+}
+
+/**
+ * Write pending output, then read more input into the free part of the
+ * input buffer; with io_uring both happen in one system call
+ * @return Bytes read, 0 at end of input, -1 on error
+ */
+static ssize_t flush_and_read(void) {
+  int results[2] = { 0, 0 };
+  size_t room = INPUT_BUFFER_SIZE - input_end;
+  ssize_t count;
+
+  if (option_enabled(OPTION_URING) && ring_setup()) {
+    if (output_used > 0) {
+      ring_queue(IORING_OP_WRITE, STDOUT_FILENO, output_buffer, output_used, true, 0);
+    }
+    ring_queue(IORING_OP_READ, STDIN_FILENO, input_buffer + input_end, room, false, 1);
+    if (ring_submit_and_wait(output_used > 0 ? 2 : 1, results)) {
+      stats_add(COUNTER_URING_SUBMISSIONS, 1);
+      /* A failed or short write cancels the linked read; finish both by hand */
+      if (output_used > 0 && results[0] >= 0 && (size_t)results[0] < output_used) {
+        write_fully(STDOUT_FILENO, output_buffer + results[0], output_used - results[0]);
+      }
+      output_used = 0;
+      if (results[1] != -ECANCELED) {
+        if (results[1] < 0) {
+          errno = -results[1];
+          return -1;
+        }
+        return results[1];
+      }
+    }
+  }
+  write_fully(STDOUT_FILENO, output_buffer, output_used);
+  output_used = 0;
+  do {
+    count = read(STDIN_FILENO, input_buffer + input_end, room);
+  } while (count < 0 && errno == EINTR);
+  return count;
+}
+
+/**
+ * Write everything the shell has printed to stdout so far. Called
+ * before anything else may write to the same file (a forked command,
+ * stderr) and at exit.
+ */
+void io_core_flush(void) {
+  fflush(stdout);
+  write_fully(STDOUT_FILENO, output_buffer, output_used);
+  output_used = 0;
+}
+
+/* stdout while deferred: collects into output_buffer */
+static ssize_t deferred_stdout_write(void* cookie, const char* data, size_t length) {
+  if (output_used + length > OUTPUT_BUFFER_SIZE) {
+    write_fully(STDOUT_FILENO, output_buffer, output_used);
+    output_used = 0;
+  }
+  if (length >= OUTPUT_BUFFER_SIZE) {
+    write_fully(STDOUT_FILENO, data, length);
+  } else {
+    memcpy(output_buffer + output_used, data, length);
+    output_used += length;
+  }
+  return length;
+}
+
+/* stderr while stdout is deferred: keeps the two in order */
+static ssize_t ordered_stderr_write(void* cookie, const char* data, size_t length) {
+  io_core_flush();
+  write_fully(STDERR_FILENO, data, length);
+  return length;
+}
+
+static void flush_at_exit(void) {
+  if (direct_stdout != NULL) {
+    io_core_flush();
+  }
+}
+
+/**
+ * Put the deferred stdout and ordered stderr in place while
+ * "set -o uring" is on, and the original streams back when it is off
+ */
+static void follow_uring_option(void) {
+  cookie_io_functions_t stdout_functions = { NULL, deferred_stdout_write, NULL, NULL };
+  cookie_io_functions_t stderr_functions = { NULL, ordered_stderr_write, NULL, NULL };
+  static bool exit_hook_installed;
+  FILE* deferred_stdout;
+  FILE* ordered_stderr;
+
+  if (option_enabled(OPTION_URING) == (direct_stdout != NULL)) {
+    return;
+  }
+  if (direct_stdout != NULL) {
+    io_core_flush();
+    fclose(stdout);
+    fclose(stderr);
+    stdout = direct_stdout;
+    stderr = direct_stderr;
+    direct_stdout = direct_stderr = NULL;
+    return;
+  }
+  deferred_stdout = fopencookie(NULL, "w", stdout_functions);
+  ordered_stderr = fopencookie(NULL, "w", stderr_functions);
+  if (deferred_stdout == NULL || ordered_stderr == NULL) {
+    perror("fopencookie");
+    if (deferred_stdout != NULL) {
+      fclose(deferred_stdout);
+    }
+    options_set("uring", false);
+    return;
+  }
+  setvbuf(ordered_stderr, NULL, _IONBF, 0);
+  fflush(stdout);
+  direct_stdout = stdout;
+  direct_stderr = stderr;
+  stdout = deferred_stdout;
+  stderr = ordered_stderr;
+  if (!exit_hook_installed) {
+    atexit(flush_at_exit);
+    exit_hook_installed = true;
+  }
+}
+
+/**
+ * Read one command line from stdin, like fgets()
+ * @param buffer Receives the line, with its newline if it fits
+ * @param size Size of buffer
+ * @return 1 for a line, 0 at end of input, -1 on a read error
+ */
+int io_core_read_line(char* buffer, size_t size) {
+  char* newline;
+  size_t available, length;
+  ssize_t count;
+
+  follow_uring_option();
+  fflush(stdout);
+  while (true) {
+    available = input_end - input_start;
+    newline = memchr(input_buffer + input_start, '\n', available);
+    if (newline != NULL || available >= size - 1 || (input_at_end && available > 0)) {
+      length = newline != NULL ? (size_t)(newline - (input_buffer + input_start)) + 1 : available;
+      if (length > size - 1) {
+        length = size - 1;
+      }
+      memcpy(buffer, input_buffer + input_start, length);
+      buffer[length] = '\0';
+      input_start += length;
+      return 1;
+    }
+    if (input_at_end) {
+      return 0;
+    }
+    /* Keep the partial line and make room behind it */
+    memmove(input_buffer, input_buffer + input_start, available);
+    input_start = 0;
+    input_end = available;
+    count = flush_and_read();
+    if (count < 0) {
+      return -1;
+    }
+    if (count == 0) {
+      input_at_end = true;
+    }
+    input_end += count;
+  }
+}
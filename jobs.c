@@ -0,0 +1,595 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Job control.
+ *
+ * Every command line that runs external programs becomes a job. When
+ * the shell is interactive, all of its pipeline stages share one
+ * process group of their own; otherwise (scripts, "shell2 -c") they
+ * stay in the shell's group, as in other shells. The interactive shell
+ * owns the terminal and hands it to the foreground job
+ * with tcsetpgrp(), so Ctrl+C and Ctrl+Z reach the job directly and a
+ * background job that reads the terminal is stopped by SIGTTIN
+ * instead of stealing keystrokes. fg and bg resume stopped jobs.
+ *
+ * Each process is watched through a pidfd in the event loop, so its
+ * exit wakes the shell with a pointer to exactly that process. SIGCHLD
+ * is then only needed for stops and continues.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "shell2.h"
+
+static job** job_table;
+static int job_count;
+static int job_capacity;
+
+static bool shell_is_interactive;
+static pid_t shell_process_group;
+static struct termios shell_terminal_modes;
+
+/* Job being waited for in jobs_wait_foreground(), if any */
+static job* foreground_job;
+static int foreground_timeout_seconds;
+
+static event_source signal_event;
+/* Created on the first foreground wait, so "shell2 -c" builtins never pay for it */
+static event_source timeout_event = { -1, NULL, NULL };
+
+/* Cleared when pidfd_open() is unavailable; exits then come via SIGCHLD */
+static bool pidfds_available = true;
+
+static void handle_signals(event_source* source, unsigned int events);
+static void handle_timeout(event_source* source, unsigned int events);
+
+/**
+ * Set up job control. Registers the signalfd with the event loop.
+ * When stdin is a terminal, waits
+ * until the shell is in the foreground, puts it in its own process
+ * group and takes the terminal. Must run after signals_initialize()
+ * and events_initialize().
+ * @param job_control false to never take the terminal, as for "shell2 -c"
+ */
+void jobs_initialize(bool job_control) {
+  signal_event.fd = signals_get_fd();
+  signal_event.handle = handle_signals;
+  events_add(&signal_event);
+
+  shell_is_interactive = job_control && isatty(STDIN_FILENO);
+  if (!shell_is_interactive) {
+    return;
+  }
+  /* If started in the background, stop until brought to the foreground */
+  while (tcgetpgrp(STDIN_FILENO) != (shell_process_group = getpgrp())) {
+    kill(-shell_process_group, SIGTTIN);
+  }
+  signals_ignore_job_control();
+  shell_process_group = getpid();
+  if (setpgid(shell_process_group, shell_process_group) < 0 && errno != EPERM) {
+    perror("setpgid");
+  }
+  shell_process_group = getpgrp();
+  tcsetpgrp(STDIN_FILENO, shell_process_group);
+  tcgetattr(STDIN_FILENO, &shell_terminal_modes);
+}
+
+bool jobs_interactive(void) {
+  return shell_is_interactive;
+}
+
+static bool job_is_completed(const job* j) {
+  int i;
+
+  for (i = 0; i < j->process_count; i++) {
+    if (j->processes[i].state != PROCESS_DONE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool job_is_stopped(const job* j) {
+  int i;
+
+  for (i = 0; i < j->process_count; i++) {
+    if (j->processes[i].state == PROCESS_RUNNING) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const char* job_state_name(const job* j) {
+  if (job_is_completed(j)) {
+    return "Done";
+  }
+  return job_is_stopped(j) ? "Stopped" : "Running";
+}
+
+/**
+ * Stop watching a process's pidfd once it has been reaped
+ */
+static void close_process_pidfd(job_process* process) {
+  if (process->exit_event.fd >= 0) {
+    events_remove(&process->exit_event);
+    close(process->exit_event.fd);
+    process->exit_event.fd = -1;
+  }
+}
+
+/**
+ * Record a status change reported by waitpid()
+ * @return false if pid does not belong to any job
+ */
+static bool mark_process_status(pid_t pid, int status) {
+  int job_index, i;
+  job_process* process;
+
+  for (job_index = 0; job_index < job_count; job_index++) {
+    for (i = 0; i < job_table[job_index]->process_count; i++) {
+      process = &job_table[job_index]->processes[i];
+      if (process->pid != pid) {
+        continue;
+      }
+      if (WIFSTOPPED(status)) {
+        process->state = PROCESS_STOPPED;
+        job_table[job_index]->notified = false;
+      }
+      else if (WIFCONTINUED(status)) {
+        process->state = PROCESS_RUNNING;
+      }
+      else {
+        process->state = PROCESS_DONE;
+        process->status = status;
+        close_process_pidfd(process);
+        if (trace_enabled()) {
+          trace_instant("reap", pid, NULL);
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * A process's pidfd became readable: it exited, so reap exactly that
+ * process
+ */
+static void handle_process_exit(event_source* source, unsigned int events) {
+  job_process* process = source->context;
+  int status;
+  pid_t reaped;
+
+  if (trace_enabled()) {
+    trace_instant("exit", process->pid, NULL);
+  }
+  reaped = waitpid(process->pid, &status, WNOHANG);
+  if (reaped == 0) {
+    return;
+  }
+  if (trace_enabled()) {
+    trace_instant("reap", process->pid, NULL);
+  }
+  process->state = PROCESS_DONE;
+  /* ECHILD: already reaped elsewhere; report it as a plain exit */
+  process->status = reaped > 0 ? status : 0;
+  close_process_pidfd(process);
+}
+
+/**
+ * SIGCHLD arrived. With pidfds only stops and continues are left to
+ * collect here; exits were delivered to handle_process_exit(). Without
+ * pidfds every pending change is collected with waitpid(-1).
+ */
+static void collect_child_changes(void) {
+  siginfo_t info;
+  pid_t pid;
+  int status;
+
+  if (!pidfds_available) {
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+      mark_process_status(pid, status);
+    }
+    return;
+  }
+  while (true) {
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) < 0 || info.si_pid == 0) {
+      return;
+    }
+    if (info.si_code == CLD_CONTINUED) {
+      mark_process_status(info.si_pid, 0xffff);
+    }
+    else {
+      mark_process_status(info.si_pid, (info.si_status << 8) | 0x7f);
+    }
+  }
+}
+
+/**
+ * Send a signal to every process of a job: to its process group, or,
+ * when it has none (no job control), to each unfinished process
+ * @return -1 if a kill() failed
+ */
+static int signal_job(job* j, int signal_number) {
+  int i, result = 0;
+
+  if (j->pgid > 0) {
+    return kill(-j->pgid, signal_number);
+  }
+  for (i = 0; i < j->process_count; i++) {
+    if (j->processes[i].state != PROCESS_DONE && kill(j->processes[i].pid, signal_number) < 0) {
+      result = -1;
+    }
+  }
+  return result;
+}
+
+/**
+ * Read the signalfd. Ctrl+C goes to the foreground job's process group;
+ * at the prompt it is dropped. A job in the shell's own group already
+ * got a Ctrl+C from the terminal, so only a SIGINT sent with kill() is
+ * passed on to its processes.
+ */
+static void handle_signals(event_source* source, unsigned int events) {
+  struct signalfd_siginfo info;
+  bool child_changed = false;
+
+  while (read(source->fd, &info, sizeof(info)) == sizeof(info)) {
+    stats_add(COUNTER_SIGNALS, 1);
+    if (info.ssi_signo == SIGINT && foreground_job != NULL &&
+        (foreground_job->pgid > 0 || info.ssi_code == SI_USER)) {
+      signal_job(foreground_job, SIGINT);
+    }
+    else if (info.ssi_signo == SIGCHLD) {
+      child_changed = true;
+    }
+  }
+  if (child_changed) {
+    collect_child_changes();
+  }
+}
+
+/**
+ * The foreground timeout expired: interrupt the job
+ */
+static void handle_timeout(event_source* source, unsigned int events) {
+  uint64_t expirations;
+
+  if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations) || foreground_job == NULL) {
+    return;
+  }
+  stats_add(COUNTER_TIMEOUTS, 1);
+  printf("Foreground process timed out after %d seconds.\n", foreground_timeout_seconds);
+  io_core_flush();
+  signal_job(foreground_job, SIGINT);
+}
+
+/**
+ * Start (or with 0, stop) the foreground timeout timer
+ */
+static void set_foreground_timeout(int seconds) {
+  struct itimerspec timeout = {{0, 0}, {seconds, 0}};
+
+  if (timeout_event.fd < 0) {
+    if (seconds == 0) {
+      return;
+    }
+    timeout_event.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    timeout_event.handle = handle_timeout;
+    if (timeout_event.fd < 0) {
+      perror("timerfd_create");
+      return;
+    }
+    events_add(&timeout_event);
+  }
+  timerfd_settime(timeout_event.fd, 0, &timeout, NULL);
+}
+
+static void free_job(job* j) {
+  int i;
+
+  if (j->trace_start != 0) {
+    trace_span("job", j->processes[0].pid, j->trace_start, j->command_text);
+  }
+  for (i = 0; i < j->process_count; i++) {
+    close_process_pidfd(&j->processes[i]);
+  }
+  if (j->cgroup_path != NULL) {
+    cgroup_finish_job(j->cgroup_path, j->id);
+    free(j->cgroup_path);
+  }
+  free(j->processes);
+  free(j->command_text);
+  free(j);
+}
+
+static void remove_job(job* j) {
+  int i;
+
+  for (i = 0; i < job_count; i++) {
+    if (job_table[i] == j) {
+      memmove(&job_table[i], &job_table[i + 1], (job_count - i - 1) * sizeof(job*));
+      job_count--;
+      free_job(j);
+      return;
+    }
+  }
+}
+
+/**
+ * Smallest job number not in use
+ */
+static int next_job_id(void) {
+  int id, i;
+  bool used;
+
+  for (id = 1; ; id++) {
+    used = false;
+    for (i = 0; i < job_count; i++) {
+      if (job_table[i]->id == id) {
+        used = true;
+      }
+    }
+    if (!used) {
+      return id;
+    }
+  }
+}
+
+/**
+ * Start a command line as a new job
+ * @param command_arguments Expanded words, "|" separating stages
+ * @param command_text Original text, shown by jobs/fg/bg
+ * @param background true for "command &"
+ * @return The job, or NULL if nothing could be started
+ */
+job* jobs_launch(char* command_arguments[], const char* command_text, bool background) {
+  spawn_options options;
+  pid_t* stage_pids;
+  job* new_job;
+  char* cgroup_path = NULL;
+  int job_id = next_job_id();
+  long long trace_start = trace_enabled() ? trace_now() : 0;
+  int stage_count, highest_pidfd = -1, i;
+
+  /* Without job control the job stays in the shell's group and never takes the terminal */
+  options.process_group = shell_is_interactive ? 0 : -1;
+  options.take_terminal = shell_is_interactive && !background;
+  /* Without job control a background job must not read the shell's input */
+  options.stdin_from_null = background && !shell_is_interactive;
+  options.cgroup_procs_fd = -1;
+  if (option_enabled(OPTION_CGROUP)) {
+    cgroup_path = cgroup_create_job(job_id, &options.cgroup_procs_fd);
+  }
+
+  stage_count = spawn_pipeline(command_arguments, &options, &stage_pids);
+  if (options.cgroup_procs_fd >= 0) {
+    close(options.cgroup_procs_fd);
+  }
+  if (stage_count <= 0) {
+    if (cgroup_path != NULL) {
+      rmdir(cgroup_path);
+      free(cgroup_path);
+    }
+    return NULL;
+  }
+  new_job = calloc(1, sizeof(job));
+  if (new_job == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  new_job->processes = calloc(stage_count, sizeof(job_process));
+  new_job->command_text = strdup(command_text);
+  if (new_job->processes == NULL || new_job->command_text == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for (i = 0; i < stage_count; i++) {
+    new_job->processes[i].pid = stage_pids[i];
+    new_job->processes[i].state = PROCESS_RUNNING;
+    new_job->processes[i].exit_event.fd = -1;
+    new_job->processes[i].exit_event.handle = handle_process_exit;
+    new_job->processes[i].exit_event.context = &new_job->processes[i];
+    if (!pidfds_available) {
+      continue;
+    }
+    new_job->processes[i].exit_event.fd = events_open_pidfd(stage_pids[i]);
+    if (new_job->processes[i].exit_event.fd < 0) {
+      if (errno == ENOSYS) {
+        pidfds_available = false;
+      } else {
+        perror("pidfd_open");
+      }
+    }
+    else if (!events_add(&new_job->processes[i].exit_event)) {
+      close_process_pidfd(&new_job->processes[i]);
+    }
+    else if (new_job->processes[i].exit_event.fd > highest_pidfd) {
+      highest_pidfd = new_job->processes[i].exit_event.fd;
+    }
+  }
+  free(stage_pids);
+  stats_note_descriptor(highest_pidfd);
+  new_job->process_count = stage_count;
+  new_job->pgid = options.process_group; /* -1 without job control */
+  new_job->id = job_id;
+  new_job->cgroup_path = cgroup_path;
+  new_job->trace_start = trace_start;
+
+  if (job_count == job_capacity) {
+    job_capacity = job_capacity ? job_capacity * 2 : 16;
+    job_table = realloc(job_table, job_capacity * sizeof(job*));
+    if (job_table == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  job_table[job_count++] = new_job;
+  return new_job;
+}
+
+/**
+ * Wait until a foreground job finishes or stops, running the event
+ * loop meanwhile. Ctrl+C is forwarded to the job's process group, as
+ * is the timeout. The terminal is given to the job while it runs.
+ * @param j Job to wait for
+ * @param timeout_seconds Interrupt the job after this long (0: never)
+ * @return waitpid() status of the last stage, or -1 if the job stopped
+ */
+int jobs_wait_foreground(job* j, int timeout_seconds) {
+  int status;
+
+  if (shell_is_interactive) {
+    tcsetpgrp(STDIN_FILENO, j->pgid);
+    if (j->has_terminal_modes) {
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &j->terminal_modes);
+    }
+  }
+  foreground_job = j;
+  foreground_timeout_seconds = timeout_seconds;
+  if (timeout_seconds > 0) {
+    set_foreground_timeout(timeout_seconds);
+  }
+
+  /* Check before sleeping: the job may have changed state already */
+  events_dispatch(0);
+  while (!job_is_completed(j) && !job_is_stopped(j)) {
+    events_dispatch(-1);
+  }
+
+  foreground_job = NULL;
+  if (timeout_seconds > 0) {
+    set_foreground_timeout(0);
+  }
+
+  if (shell_is_interactive) {
+    /* Take the terminal back, remembering the job's modes if it stopped */
+    tcsetpgrp(STDIN_FILENO, shell_process_group);
+    if (!job_is_completed(j)) {
+      j->has_terminal_modes = tcgetattr(STDIN_FILENO, &j->terminal_modes) == 0;
+    }
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_terminal_modes);
+  }
+
+  if (!job_is_completed(j)) {
+    printf("\n[%d]+  Stopped\t\t%s\n", j->id, j->command_text);
+    j->notified = true;
+    return -1;
+  }
+  status = j->processes[j->process_count - 1].status;
+  if (shell_is_interactive && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+    /* Move past the ^C the terminal echoed */
+    printf("\n");
+  }
+  remove_job(j);
+  return status;
+}
+
+/**
+ * Report background jobs that finished or stopped since the last
+ * report, and forget the finished ones
+ * @return true if anything was printed
+ */
+bool jobs_notify(void) {
+  bool printed = false;
+  int i;
+  job* j;
+
+  events_dispatch(0);
+  for (i = 0; i < job_count; i++) {
+    j = job_table[i];
+    if (job_is_completed(j)) {
+      if (shell_is_interactive) {
+        printf("[%d]+  Done\t\t%s\n", j->id, j->command_text);
+        printed = true;
+      }
+      remove_job(j);
+      i--;
+    }
+    else if (job_is_stopped(j) && !j->notified) {
+      printf("[%d]+  Stopped\t\t%s\n", j->id, j->command_text);
+      j->notified = true;
+      printed = true;
+    }
+  }
+  return printed;
+}
+
+/**
+ * Find a job by specification: "%N", "N", or NULL for the most recent
+ * @return Job, or NULL if there is no such job
+ */
+job* jobs_find(const char* spec) {
+  int id, i;
+
+  if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+    return job_count > 0 ? job_table[job_count - 1] : NULL;
+  }
+  if (spec[0] == '%') {
+    spec++;
+  }
+  id = atoi(spec);
+  for (i = 0; i < job_count; i++) {
+    if (job_table[i]->id == id) {
+      return job_table[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Resume a stopped job
+ * @param j Job to continue
+ * @param foreground true for fg (waits), false for bg
+ * @return Same as jobs_wait_foreground() for fg, 0 for bg
+ */
+int jobs_continue(job* j, bool foreground) {
+  int i;
+
+  for (i = 0; i < j->process_count; i++) {
+    if (j->processes[i].state == PROCESS_STOPPED) {
+      j->processes[i].state = PROCESS_RUNNING;
+    }
+  }
+  j->notified = false;
+  io_core_flush();
+  if (foreground && shell_is_interactive) {
+    /* Hand over the terminal before the job can run */
+    tcsetpgrp(STDIN_FILENO, j->pgid);
+  }
+  if (signal_job(j, SIGCONT) < 0) {
+    perror("kill (SIGCONT)");
+  }
+  if (foreground) {
+    return jobs_wait_foreground(j, TIMEOUT_SECONDS);
+  }
+  return 0;
+}
+
+/**
+ * Print the job table, as the jobs builtin does
+ */
+void jobs_print(FILE* output) {
+  int i;
+
+  events_dispatch(0);
+  for (i = 0; i < job_count; i++) {
+    fprintf(output, "[%d]%c  %-8s\t%s\n", job_table[i]->id, i == job_count - 1 ? '+' : ' ',
+            job_state_name(job_table[i]), job_table[i]->command_text);
+    job_table[i]->notified = true;
+  }
+}
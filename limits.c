@@ -0,0 +1,346 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Resource limits for the commands the shell runs.
+ *
+ * ulimit does not change the shell's own limits: the requested values
+ * are kept here and applied with setrlimit() in each child right
+ * before exec, so a low limit cannot break the shell itself.
+ *
+ * With "set -o cgroup" every job also gets its own cgroup v2 leaf
+ * with memory.max and cpu.max taken from the cgroup_memory_max and
+ * cgroup_cpu_max options. A runaway job is throttled or OOM-killed
+ * inside its leaf instead of starving the host, and its peak memory
+ * and CPU time are reported when it finishes. The shell needs a
+ * delegated cgroup for this (for example started with
+ * "systemd-run --user --scope -p Delegate=yes shell2").
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "shell2.h"
+
+#define CGROUP_PATH_SIZE 4096
+/* Room for a file or leaf name after a cgroup directory */
+#define CGROUP_NAME_SIZE 64
+
+static struct rlimit pending_limits[RLIM_NLIMITS];
+static bool pending_soft[RLIM_NLIMITS];
+static bool pending_hard[RLIM_NLIMITS];
+
+/* Directory under which job leaves are created, empty until set up */
+static char cgroup_base[CGROUP_PATH_SIZE];
+static bool cgroup_setup_failed;
+
+/**
+ * Limit that commands will run with
+ * @param resource RLIMIT_* constant
+ * @param hard true for the hard limit, false for the soft limit
+ */
+rlim_t limits_get(int resource, bool hard) {
+  struct rlimit current;
+
+  if (hard ? pending_hard[resource] : pending_soft[resource]) {
+    return hard ? pending_limits[resource].rlim_max : pending_limits[resource].rlim_cur;
+  }
+  if (getrlimit(resource, &current) < 0) {
+    return RLIM_INFINITY;
+  }
+  return hard ? current.rlim_max : current.rlim_cur;
+}
+
+/**
+ * Set the limit future commands run with
+ * @param resource RLIMIT_* constant
+ * @param value New limit (RLIM_INFINITY for unlimited)
+ * @param soft Change the soft limit
+ * @param hard Change the hard limit
+ * @return false if the soft limit would exceed the hard limit, or the
+ *   hard limit would be raised without the privilege to do so (every
+ *   command would then fail in setrlimit)
+ */
+bool limits_set(int resource, rlim_t value, bool soft, bool hard) {
+  rlim_t new_soft = soft ? value : limits_get(resource, false);
+  rlim_t new_hard = hard ? value : limits_get(resource, true);
+  struct rlimit current;
+
+  if (new_hard != RLIM_INFINITY && (new_soft == RLIM_INFINITY || new_soft > new_hard)) {
+    fprintf(stderr, "ulimit: soft limit cannot exceed hard limit\n");
+    return false;
+  }
+  /* RLIM_INFINITY is the largest rlim_t, so plain comparison works */
+  if (getrlimit(resource, &current) == 0 && new_hard > current.rlim_max && geteuid() != 0) {
+    fprintf(stderr, "ulimit: cannot raise the hard limit: %s\n", strerror(EPERM));
+    return false;
+  }
+  if (soft) {
+    pending_limits[resource].rlim_cur = value;
+    pending_soft[resource] = true;
+  }
+  if (hard) {
+    pending_limits[resource].rlim_max = value;
+    pending_hard[resource] = true;
+  }
+  return true;
+}
+
+/**
+ * Check whether ulimit changed anything that children must apply
+ */
+bool limits_pending(void) {
+  int resource;
+
+  for (resource = 0; resource < RLIM_NLIMITS; resource++) {
+    if (pending_soft[resource] || pending_hard[resource]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Apply the ulimit settings in a forked child before exec. The command
+ * is not run if a limit cannot be applied.
+ */
+void limits_apply_in_child(void) {
+  struct rlimit limit;
+  int resource;
+
+  for (resource = 0; resource < RLIM_NLIMITS; resource++) {
+    if (!pending_soft[resource] && !pending_hard[resource]) {
+      continue;
+    }
+    limit.rlim_cur = limits_get(resource, false);
+    limit.rlim_max = limits_get(resource, true);
+    if (setrlimit(resource, &limit) < 0) {
+      perror("ulimit");
+      _exit(1);
+    }
+  }
+}
+
+/**
+ * Write a string to a cgroup control file
+ * @return false on error, with errno set
+ */
+static bool write_cgroup_file(const char* directory, const char* file, const char* text) {
+  char path[CGROUP_PATH_SIZE + CGROUP_NAME_SIZE * 2];
+  ssize_t written;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/%s", directory, file);
+  fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  written = write(fd, text, strlen(text));
+  close(fd);
+  return written == (ssize_t)strlen(text);
+}
+
+/**
+ * Find the shell's own cgroup v2 directory: the cgroup2 mount point
+ * from /proc/self/mountinfo joined with the "0::" line of
+ * /proc/self/cgroup
+ */
+static bool find_own_cgroup(char* path, size_t size) {
+  char line[CGROUP_PATH_SIZE];
+  char mount_point[CGROUP_PATH_SIZE] = "";
+  char* separator;
+  FILE* file;
+  bool found = false;
+
+  file = fopen("/proc/self/mountinfo", "re");
+  if (file == NULL) {
+    return false;
+  }
+  while (fgets(line, sizeof(line), file) != NULL) {
+    /* "id parent dev root mount-point options ... - cgroup2 ..." */
+    separator = strstr(line, " - cgroup2 ");
+    if (separator != NULL && sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) == 1) {
+      break;
+    }
+    mount_point[0] = '\0';
+  }
+  fclose(file);
+  if (mount_point[0] == '\0') {
+    return false;
+  }
+
+  file = fopen("/proc/self/cgroup", "re");
+  if (file == NULL) {
+    return false;
+  }
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, "0::", 3) == 0) {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(path, size, "%s%s", mount_point, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+      found = true;
+      break;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/**
+ * Prepare the shell's cgroup for job leaves, once. A non-root cgroup
+ * may not both hold processes and hand controllers to children, so the
+ * shell first moves itself into a "shell" leaf of its own cgroup.
+ */
+static bool setup_cgroup_base(void) {
+  char pid_text[32];
+  char shell_leaf[CGROUP_PATH_SIZE + CGROUP_NAME_SIZE];
+  char own_cgroup[CGROUP_PATH_SIZE];
+
+  if (cgroup_base[0] != '\0') {
+    return true;
+  }
+  if (cgroup_setup_failed) {
+    return false;
+  }
+  cgroup_setup_failed = true;
+  if (!find_own_cgroup(own_cgroup, sizeof(own_cgroup))) {
+    fprintf(stderr, "cgroup: no cgroup v2 hierarchy found\n");
+    return false;
+  }
+  if (access(own_cgroup, W_OK) != 0) {
+    fprintf(stderr, "cgroup: %s: %s\n", own_cgroup, strerror(errno));
+    return false;
+  }
+  snprintf(pid_text, sizeof(pid_text), "%d", (int)getpid());
+  snprintf(shell_leaf, sizeof(shell_leaf), "%s/shell", own_cgroup);
+  if (mkdir(shell_leaf, 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "cgroup: mkdir %s: %s\n", shell_leaf, strerror(errno));
+    return false;
+  }
+  if (!write_cgroup_file(shell_leaf, "cgroup.procs", pid_text)) {
+    fprintf(stderr, "cgroup: cannot move the shell to %s: %s\n", shell_leaf, strerror(errno));
+    return false;
+  }
+  /* Jobs can still be placed and measured if a controller is unavailable */
+  if (!write_cgroup_file(own_cgroup, "cgroup.subtree_control", "+memory")) {
+    fprintf(stderr, "cgroup: memory controller unavailable: %s\n", strerror(errno));
+  }
+  if (!write_cgroup_file(own_cgroup, "cgroup.subtree_control", "+cpu")) {
+    fprintf(stderr, "cgroup: cpu controller unavailable: %s\n", strerror(errno));
+  }
+  snprintf(cgroup_base, sizeof(cgroup_base), "%s", own_cgroup);
+  cgroup_setup_failed = false;
+  return true;
+}
+
+/**
+ * Create the cgroup leaf for a new job and apply the memory and CPU
+ * limits to it
+ * @param job_id Job number, used in the leaf name
+ * @param procs_fd Receives an O_CLOEXEC descriptor for the leaf's
+ *   cgroup.procs; each stage writes "0" to it to join the leaf
+ * @return malloc'd leaf path, or NULL if the job runs without a cgroup
+ */
+char* cgroup_create_job(int job_id, int* procs_fd) {
+  char path[CGROUP_PATH_SIZE + CGROUP_NAME_SIZE];
+  char* leaf;
+
+  *procs_fd = -1;
+  if (!setup_cgroup_base()) {
+    return NULL;
+  }
+  snprintf(path, sizeof(path), "%s/job-%d-%d", cgroup_base, (int)getpid(), job_id);
+  if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "cgroup: mkdir %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  if (strcmp(option_value(OPTION_CGROUP_MEMORY_MAX), "max") != 0 &&
+      !write_cgroup_file(path, "memory.max", option_value(OPTION_CGROUP_MEMORY_MAX))) {
+    fprintf(stderr, "cgroup: memory.max: %s\n", strerror(errno));
+  }
+  if (strcmp(option_value(OPTION_CGROUP_CPU_MAX), "max 100000") != 0 &&
+      !write_cgroup_file(path, "cpu.max", option_value(OPTION_CGROUP_CPU_MAX))) {
+    fprintf(stderr, "cgroup: cpu.max: %s\n", strerror(errno));
+  }
+  leaf = strdup(path);
+  if (leaf == NULL) {
+    perror("strdup");
+    exit(1);
+  }
+  strncat(path, "/cgroup.procs", sizeof(path) - strlen(path) - 1);
+  *procs_fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (*procs_fd < 0) {
+    fprintf(stderr, "cgroup: %s: %s\n", path, strerror(errno));
+    rmdir(leaf);
+    free(leaf);
+    return NULL;
+  }
+  return leaf;
+}
+
+/**
+ * Read "key value" from a flat-keyed cgroup file such as cpu.stat
+ * @return false if the file or key is missing
+ */
+static bool read_cgroup_key(const char* leaf, const char* file, const char* key, unsigned long long* value) {
+  char path[CGROUP_PATH_SIZE + CGROUP_NAME_SIZE * 2];
+  char name[64];
+  unsigned long long number;
+  FILE* stream;
+  bool found = false;
+
+  snprintf(path, sizeof(path), "%s/%s", leaf, file);
+  stream = fopen(path, "re");
+  if (stream == NULL) {
+    return false;
+  }
+  while (fscanf(stream, "%63s %llu", name, &number) == 2) {
+    if (strcmp(name, key) == 0) {
+      *value = number;
+      found = true;
+      break;
+    }
+  }
+  fclose(stream);
+  return found;
+}
+
+/**
+ * Report a finished job's peak memory and CPU time, then remove its
+ * cgroup leaf. All of the job's processes must have been reaped.
+ * @param leaf Path returned by cgroup_create_job()
+ * @param job_id Job number, for the report
+ */
+void cgroup_finish_job(const char* leaf, int job_id) {
+  char path[CGROUP_PATH_SIZE + CGROUP_NAME_SIZE * 2];
+  unsigned long long peak_bytes = 0, usage_usec = 0, oom_kills = 0;
+  bool have_peak;
+  FILE* stream;
+
+  snprintf(path, sizeof(path), "%s/memory.peak", leaf);
+  stream = fopen(path, "re");
+  have_peak = stream != NULL && fscanf(stream, "%llu", &peak_bytes) == 1;
+  if (stream != NULL) {
+    fclose(stream);
+  }
+  read_cgroup_key(leaf, "cpu.stat", "usage_usec", &usage_usec);
+  read_cgroup_key(leaf, "memory.events", "oom_kill", &oom_kills);
+
+  fprintf(stderr, "[%d] cgroup: cpu %llu.%03llus", job_id, usage_usec / 1000000, usage_usec / 1000 % 1000);
+  if (have_peak) {
+    fprintf(stderr, ", peak memory %llu KiB", peak_bytes / 1024);
+  }
+  if (oom_kills > 0) {
+    fprintf(stderr, ", %llu process(es) killed by memory.max", oom_kills);
+  }
+  fprintf(stderr, "\n");
+
+  if (rmdir(leaf) < 0) {
+    fprintf(stderr, "cgroup: rmdir %s: %s\n", leaf, strerror(errno));
+  }
+}
@@ -0,0 +1,455 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Interactive line editor.
+ *
+ * Reads one line from the terminal in raw mode with emacs-style keys:
+ *   Left/Right, Ctrl+B/F      move by character
+ *   Home/End, Ctrl+A/E        move to start/end of line
+ *   Backspace, Delete, Ctrl+D delete (Ctrl+D on an empty line is EOF)
+ *   Ctrl+K/U/W                delete to end, to start, previous word
+ *   Up/Down, Ctrl+P/N         step through history
+ *   Ctrl+R                    incremental reverse history search
+ *   Tab                       complete a command or file name
+ *   Ctrl+C                    discard the line, Ctrl+L clears the screen
+ * Keys are read one at a time through the event loop, so job reports
+ * still appear while the user is typing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include "shell2.h"
+
+#define KEY_CTRL(letter) ((letter) & 0x1f)
+#define KEY_ESCAPE 27
+#define KEY_BACKSPACE 127
+
+/* No history entry is being shown */
+#define HISTORY_NONE ((size_t)-1)
+
+typedef struct {
+  char* buffer;
+  size_t size;          /* capacity, including the NUL */
+  size_t length;
+  size_t cursor;
+  const char* prompt;
+  size_t history_age;   /* entry being shown, HISTORY_NONE for the edited line */
+  char* saved_line;     /* the edited line while browsing history */
+  bool searching;
+  char search_query[128];
+  size_t search_age;    /* entry matched by the search, HISTORY_NONE if none */
+} line_state;
+
+static line_state* active_line;
+static bool (*active_report)(void);
+
+static void report_while_editing(void);
+
+/**
+ * Read one byte from the terminal, running the event loop while idle
+ * @return The byte, or -1 at end of input
+ */
+static int read_key(void) {
+  unsigned char key;
+
+  events_wait_for_input(STDIN_FILENO, report_while_editing);
+  if (read(STDIN_FILENO, &key, 1) != 1) {
+    return -1;
+  }
+  stats_add(COUNTER_STDIN_BYTES, 1);
+  return key;
+}
+
+/**
+ * Redraw the prompt and line, leaving the terminal cursor at the
+ * editing position
+ */
+static void refresh_line(line_state* line) {
+  const char* text;
+  size_t length;
+  size_t column;
+
+  fputs("\r", stdout);
+  if (line->searching) {
+    if (line->search_age == HISTORY_NONE || !history_get(line->search_age, &text, &length)) {
+      text = "";
+      length = 0;
+    }
+    printf("(reverse-i-search)`%s': %.*s\x1b[K", line->search_query, (int)length, text);
+    fflush(stdout);
+    return;
+  }
+  printf("%s%.*s\x1b[K", line->prompt, (int)line->length, line->buffer);
+  column = strlen(line->prompt) + line->cursor;
+  printf("\r");
+  if (column > 0) {
+    printf("\x1b[%zuC", column);
+  }
+  fflush(stdout);
+}
+
+/**
+ * Event loop callback: print job reports on their own line and then
+ * redraw the line being edited below them
+ */
+static void report_while_editing(void) {
+  if (active_report == NULL || active_line == NULL) {
+    return;
+  }
+  printf("\r\x1b[K");
+  active_report();
+  refresh_line(active_line);
+}
+
+/**
+ * Replace the edited text
+ */
+static void set_line(line_state* line, const char* text, size_t length) {
+  if (length > line->size - 1) {
+    length = line->size - 1;
+  }
+  memcpy(line->buffer, text, length);
+  line->buffer[length] = '\0';
+  line->length = length;
+  line->cursor = length;
+}
+
+/**
+ * Show an older (direction 1) or newer (direction -1) history entry.
+ * Stepping past the newest entry brings back the line being edited.
+ */
+static void step_history(line_state* line, int direction) {
+  const char* text;
+  size_t length;
+  size_t age;
+
+  if (direction > 0) {
+    age = line->history_age == HISTORY_NONE ? 0 : line->history_age + 1;
+    if (!history_get(age, &text, &length)) {
+      return;
+    }
+    if (line->history_age == HISTORY_NONE) {
+      free(line->saved_line);
+      line->saved_line = strdup(line->buffer);
+    }
+    line->history_age = age;
+    set_line(line, text, length);
+  }
+  else {
+    if (line->history_age == HISTORY_NONE) {
+      return;
+    }
+    if (line->history_age == 0) {
+      line->history_age = HISTORY_NONE;
+      text = line->saved_line != NULL ? line->saved_line : "";
+      set_line(line, text, strlen(text));
+      return;
+    }
+    line->history_age--;
+    if (history_get(line->history_age, &text, &length)) {
+      set_line(line, text, length);
+    }
+  }
+}
+
+static void insert_character(line_state* line, char character) {
+  if (line->length + 1 >= line->size) {
+    return;
+  }
+  memmove(line->buffer + line->cursor + 1, line->buffer + line->cursor, line->length - line->cursor + 1);
+  line->buffer[line->cursor++] = character;
+  line->length++;
+}
+
+/**
+ * Delete count characters starting at from
+ */
+static void delete_range(line_state* line, size_t from, size_t count) {
+  memmove(line->buffer + from, line->buffer + from + count, line->length - from - count + 1);
+  line->length -= count;
+  line->cursor = from;
+}
+
+/**
+ * Handle a key while Ctrl+R search is active
+ * @return true if the key ended the search and should also be handled
+ *   as a normal editing key
+ */
+static bool handle_search_key(line_state* line, int key) {
+  size_t query_length = strlen(line->search_query);
+  const char* text;
+  size_t length;
+
+  if (key == KEY_CTRL('R')) {
+    /* Next older match */
+    if (line->search_age != HISTORY_NONE) {
+      line->search_age = history_search(line->search_query, line->search_age + 1);
+    }
+    return false;
+  }
+  if (key == KEY_BACKSPACE || key == KEY_CTRL('H')) {
+    if (query_length > 0) {
+      line->search_query[query_length - 1] = '\0';
+    }
+    line->search_age = history_search(line->search_query, 0);
+    return false;
+  }
+  if (key >= 32 && key < 127) {
+    if (query_length + 1 < sizeof(line->search_query)) {
+      line->search_query[query_length] = key;
+      line->search_query[query_length + 1] = '\0';
+    }
+    line->search_age = history_search(line->search_query,
+                                      line->search_age == HISTORY_NONE ? 0 : line->search_age);
+    return false;
+  }
+  line->searching = false;
+  if (key == KEY_CTRL('G')) {
+    /* Cancel: back to the line as it was */
+    return false;
+  }
+  if (line->search_age != HISTORY_NONE && history_get(line->search_age, &text, &length)) {
+    line->history_age = HISTORY_NONE;
+    set_line(line, text, length);
+  }
+  return key != KEY_ESCAPE;
+}
+
+/**
+ * Handle the rest of an escape sequence (arrow keys and friends)
+ */
+static void handle_escape_sequence(line_state* line) {
+  int first = read_key();
+  int second;
+
+  if (first != '[' && first != 'O') {
+    return;
+  }
+  second = read_key();
+  if (second >= '0' && second <= '9') {
+    /* "ESC [ 3 ~" is Delete; other numbered keys are ignored */
+    if (read_key() == '~' && second == '3' && line->cursor < line->length) {
+      delete_range(line, line->cursor, 1);
+    }
+    return;
+  }
+  switch (second) {
+    case 'A': step_history(line, 1); break;
+    case 'B': step_history(line, -1); break;
+    case 'C': if (line->cursor < line->length) line->cursor++; break;
+    case 'D': if (line->cursor > 0) line->cursor--; break;
+    case 'H': line->cursor = 0; break;
+    case 'F': line->cursor = line->length; break;
+  }
+}
+
+/**
+ * Tab: complete the word before the cursor. One candidate replaces the
+ * word; several extend it to their common prefix, and if that adds
+ * nothing they are listed below the line.
+ */
+static void complete_word(line_state* line) {
+  static argument_vector candidates;
+  static string_arena candidate_arena;
+  size_t word_start, common, i, inserted;
+  const char* replacement;
+
+  string_arena_reset(&candidate_arena);
+  if (completion_candidates(line->buffer, line->cursor, &word_start, &candidates, &candidate_arena) == 0) {
+    return;
+  }
+  replacement = candidates.items[0];
+  common = strlen(replacement);
+  for (i = 1; i < candidates.count; i++) {
+    while (common > 0 && strncmp(candidates.items[i], replacement, common) != 0) {
+      common--;
+    }
+  }
+  if (candidates.count > 1 && common <= line->cursor - word_start) {
+    printf("\n");
+    for (i = 0; i < candidates.count; i++) {
+      printf("%s%s", candidates.items[i], i + 1 < candidates.count ? "  " : "\n");
+    }
+    return;
+  }
+  /* Replace the typed part of the word with the completed part */
+  delete_range(line, word_start, line->cursor - word_start);
+  for (inserted = 0; inserted < common; inserted++) {
+    insert_character(line, replacement[inserted]);
+  }
+  if (candidates.count == 1 && replacement[common - 1] != '/') {
+    insert_character(line, ' ');
+  }
+}
+
+/**
+ * Put the terminal in raw mode, keeping output processing so "\n"
+ * still moves to the start of the next line
+ */
+static bool enter_raw_mode(struct termios* original) {
+  struct termios raw;
+
+  if (tcgetattr(STDIN_FILENO, original) < 0) {
+    return false;
+  }
+  raw = *original;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_cflag |= CS8;
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0;
+}
+
+/**
+ * Read a line from the terminal with editing and history
+ * @param prompt Prompt to show
+ * @param buffer Receives the line, without a newline
+ * @param size Size of buffer
+ * @param report Called when events arrive while waiting for keys;
+ *   returns true if it printed something
+ * @return false at end of input (Ctrl+D on an empty line)
+ */
+bool line_editor_read(const char* prompt, char* buffer, size_t size, bool (*report)(void)) {
+  struct termios original_modes;
+  line_state line;
+  bool have_line = true;
+  bool done = false;
+  int key;
+
+  if (!enter_raw_mode(&original_modes)) {
+    fputs(prompt, stdout);
+    fflush(stdout);
+    return fgets(buffer, size, stdin) != NULL;
+  }
+  memset(&line, 0, sizeof(line));
+  line.buffer = buffer;
+  line.size = size;
+  line.prompt = prompt;
+  line.history_age = HISTORY_NONE;
+  line.search_age = HISTORY_NONE;
+  buffer[0] = '\0';
+  active_line = &line;
+  active_report = report;
+  refresh_line(&line);
+
+  while (!done) {
+    key = read_key();
+    if (key < 0) {
+      have_line = false;
+      break;
+    }
+    if (line.searching && !handle_search_key(&line, key)) {
+      refresh_line(&line);
+      continue;
+    }
+    switch (key) {
+      case '\r':
+      case '\n':
+        done = true;
+        break;
+      case KEY_CTRL('A'):
+        line.cursor = 0;
+        break;
+      case KEY_CTRL('E'):
+        line.cursor = line.length;
+        break;
+      case KEY_CTRL('B'):
+        if (line.cursor > 0) {
+          line.cursor--;
+        }
+        break;
+      case KEY_CTRL('F'):
+        if (line.cursor < line.length) {
+          line.cursor++;
+        }
+        break;
+      case KEY_BACKSPACE:
+      case KEY_CTRL('H'):
+        if (line.cursor > 0) {
+          delete_range(&line, line.cursor - 1, 1);
+        }
+        break;
+      case KEY_CTRL('D'):
+        if (line.length == 0) {
+          have_line = false;
+          done = true;
+        }
+        else if (line.cursor < line.length) {
+          delete_range(&line, line.cursor, 1);
+        }
+        break;
+      case KEY_CTRL('K'):
+        line.buffer[line.cursor] = '\0';
+        line.length = line.cursor;
+        break;
+      case KEY_CTRL('U'):
+        delete_range(&line, 0, line.cursor);
+        break;
+      case KEY_CTRL('W'): {
+        size_t start = line.cursor;
+
+        while (start > 0 && line.buffer[start - 1] == ' ') {
+          start--;
+        }
+        while (start > 0 && line.buffer[start - 1] != ' ') {
+          start--;
+        }
+        delete_range(&line, start, line.cursor - start);
+        break;
+      }
+      case KEY_CTRL('P'):
+        step_history(&line, 1);
+        break;
+      case KEY_CTRL('N'):
+        step_history(&line, -1);
+        break;
+      case KEY_CTRL('R'):
+        line.searching = true;
+        line.search_query[0] = '\0';
+        line.search_age = history_search("", 0);
+        break;
+      case KEY_CTRL('C'):
+        /* Abandon the line and start over on a fresh prompt */
+        printf("^C\n");
+        set_line(&line, "", 0);
+        line.history_age = HISTORY_NONE;
+        break;
+      case '\t':
+        complete_word(&line);
+        break;
+      case KEY_CTRL('L'):
+        printf("\x1b[H\x1b[2J");
+        break;
+      case KEY_ESCAPE:
+        handle_escape_sequence(&line);
+        break;
+      default:
+        if (key >= 32 && key != KEY_BACKSPACE) {
+          insert_character(&line, key);
+        }
+        break;
+    }
+    if (!done) {
+      refresh_line(&line);
+    }
+  }
+
+  /* Leave the finished line on screen and move below it */
+  line.searching = false;
+  line.cursor = line.length;
+  refresh_line(&line);
+  printf("\n");
+  fflush(stdout);
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &original_modes);
+  active_line = NULL;
+  free(line.saved_line);
+  if (have_line) {
+    history_add(buffer);
+  }
+  return have_line || line.length > 0;
+}
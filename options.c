@@ -0,0 +1,108 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Shell options, changed with "set -o NAME[=VALUE]" and "set +o NAME".
+ *
+ * Options are looked up by index, so checking one on the command path
+ * is an array access rather than a string comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell2.h"
+
+typedef struct {
+  const char* name;
+  const char* default_value;  /* NULL for on/off options */
+  bool enabled;
+  char* value;                /* set with NAME=VALUE, NULL for the default */
+} shell_option_entry;
+
+static shell_option_entry option_table[OPTION_COUNT] = {
+  [OPTION_CGROUP]            = { "cgroup",            NULL,           false, NULL },
+  [OPTION_CGROUP_MEMORY_MAX] = { "cgroup_memory_max", "max",          false, NULL },
+  [OPTION_CGROUP_CPU_MAX]    = { "cgroup_cpu_max",    "max 100000",   false, NULL },
+  [OPTION_TRACE]             = { "trace",             "/tmp/shell2-trace.json", false, NULL },
+  [OPTION_STATS]             = { "stats",             NULL,           false, NULL },
+  [OPTION_ZYGOTE]            = { "zygote",            NULL,           false, NULL },
+  [OPTION_URING]             = { "uring",             NULL,           false, NULL },
+  [OPTION_UTILITIES]         = { "utilities",         NULL,           false, NULL },
+  [OPTION_FUSION]            = { "fusion",            NULL,           false, NULL },
+  [OPTION_CPUS]              = { "cpus",              "all",          false, NULL },
+  [OPTION_NICE]              = { "nice",              "0",            false, NULL },
+  [OPTION_IONICE]            = { "ionice",            "none",         false, NULL },
+  [OPTION_SCHED_BATCH]       = { "sched_batch",       NULL,           false, NULL },
+  [OPTION_FDCHECK]           = { "fdcheck",           NULL,           false, NULL },
+  [OPTION_PATH_CACHE]        = { "pathcache",         NULL,           false, NULL },
+};
+
+/**
+ * Check whether an on/off option is on
+ */
+bool option_enabled(shell_option option) {
+  return option_table[option].enabled;
+}
+
+/**
+ * Current value of an option that takes one
+ * @return Value set by the user, or the option's default
+ */
+const char* option_value(shell_option option) {
+  return option_table[option].value != NULL ? option_table[option].value : option_table[option].default_value;
+}
+
+/**
+ * Apply "set -o SPEC" or "set +o SPEC"
+ * @param spec NAME or NAME=VALUE
+ * @param enable true for -o, false for +o (which also restores the default value)
+ * @return false if there is no such option
+ */
+bool options_set(const char* spec, bool enable) {
+  const char* equals = strchr(spec, '=');
+  size_t name_length = equals != NULL ? (size_t)(equals - spec) : strlen(spec);
+  shell_option_entry* entry;
+  int i;
+
+  for (i = 0; i < OPTION_COUNT; i++) {
+    entry = &option_table[i];
+    if (strlen(entry->name) != name_length || strncmp(entry->name, spec, name_length) != 0) {
+      continue;
+    }
+    if (equals != NULL && entry->default_value == NULL) {
+      fprintf(stderr, "set: %s: option does not take a value\n", entry->name);
+      return false;
+    }
+    entry->enabled = enable;
+    free(entry->value);
+    entry->value = NULL;
+    if (enable && equals != NULL) {
+      entry->value = strdup(equals + 1);
+      if (entry->value == NULL) {
+        perror("strdup");
+        exit(1);
+      }
+    }
+    return true;
+  }
+  fprintf(stderr, "set: %.*s: invalid option name\n", (int)name_length, spec);
+  return false;
+}
+
+/**
+ * Print every option and its state, as "set -o" does, followed by the
+ * value for an option that takes one and is on (NAME=VALUE turns it on)
+ */
+void options_print(FILE* output) {
+  int i;
+
+  for (i = 0; i < OPTION_COUNT; i++) {
+    if (option_table[i].default_value == NULL || !option_table[i].enabled) {
+      fprintf(output, "%-20s%s\n", option_table[i].name, option_table[i].enabled ? "on" : "off");
+    }
+    else {
+      fprintf(output, "%-20son  %s\n", option_table[i].name, option_value(i));
+    }
+  }
+}
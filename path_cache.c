@@ -0,0 +1,125 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Command path cache, turned on with "set -o pathcache".
+ *
+ * The shell resolves a command name against PATH before forking and
+ * remembers the result, so repeated commands exec their full path
+ * directly instead of execvp() trying every PATH directory in each
+ * child. Like the completion trie, the whole cache is dropped when
+ * PATH changes. An entry that has gone stale (the file was removed)
+ * is not checked here: the child falls back to execvp().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "shell2.h"
+
+#define PATH_CACHE_SLOTS 256
+
+typedef struct {
+  char* name;           /* NULL if the slot is free */
+  char* path;
+} path_cache_slot;
+
+static path_cache_slot path_cache[PATH_CACHE_SLOTS];
+static size_t path_cache_used;
+static unsigned long cached_path_generation;
+
+static size_t hash_command(const char* name) {
+  size_t hash = 14695981039346656037ULL;
+
+  for (; *name != '\0'; name++) {
+    hash = (hash ^ (unsigned char)*name) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void forget_all(void) {
+  size_t i;
+
+  for (i = 0; i < PATH_CACHE_SLOTS; i++) {
+    free(path_cache[i].name);
+    free(path_cache[i].path);
+    path_cache[i].name = NULL;
+    path_cache[i].path = NULL;
+  }
+  path_cache_used = 0;
+}
+
+/**
+ * Search PATH for an executable regular file called name
+ * @return malloc'd full path, or NULL if there is none
+ */
+static char* search_path(const char* name) {
+  const char* path = variable_get("PATH");
+  const char* start;
+  const char* end;
+  char candidate[PATH_MAX];
+  struct stat file_status;
+  size_t length;
+
+  if (path == NULL) {
+    return NULL;
+  }
+  for (start = path; ; start = end + 1) {
+    end = strchr(start, ':');
+    length = end != NULL ? (size_t)(end - start) : strlen(start);
+    /* An empty PATH entry means the current directory */
+    if (snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(length > 0 ? length : 1),
+                 length > 0 ? start : ".", name) < (int)sizeof(candidate) &&
+        access(candidate, X_OK) == 0 && stat(candidate, &file_status) == 0 && S_ISREG(file_status.st_mode)) {
+      return strdup(candidate);
+    }
+    if (end == NULL) {
+      return NULL;
+    }
+  }
+}
+
+/**
+ * Full path that exec should use for a command
+ * @param name Command name without a '/'
+ * @return Cached path, or NULL if it is not on PATH (let execvp report it).
+ *   Valid until the next lookup.
+ */
+const char* path_cache_lookup(const char* name) {
+  path_cache_slot* slot;
+  size_t index;
+
+  if (cached_path_generation != variables_path_generation()) {
+    forget_all();
+    cached_path_generation = variables_path_generation();
+  }
+  for (index = hash_command(name) % PATH_CACHE_SLOTS; path_cache[index].name != NULL;
+       index = (index + 1) % PATH_CACHE_SLOTS) {
+    if (strcmp(path_cache[index].name, name) == 0) {
+      stats_add(COUNTER_PATH_CACHE_HITS, 1);
+      return path_cache[index].path;
+    }
+  }
+  stats_add(COUNTER_PATH_CACHE_MISSES, 1);
+  /* Keep the table at most three quarters full so probes stay short */
+  if ((path_cache_used + 1) * 4 > PATH_CACHE_SLOTS * 3) {
+    forget_all();
+    index = hash_command(name) % PATH_CACHE_SLOTS;
+  }
+  slot = &path_cache[index];
+  slot->path = search_path(name);
+  if (slot->path == NULL) {
+    return NULL;
+  }
+  slot->name = strdup(name);
+  if (slot->name == NULL) {
+    free(slot->path);
+    slot->path = NULL;
+    return NULL;
+  }
+  path_cache_used++;
+  return slot->path;
+}
@@ -0,0 +1,326 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * CPU placement and scheduling for the commands the shell runs.
+ *
+ * For every job, the options "cpus", "nice", "ionice" and "sched_batch"
+ * (changed with "set -o") set the CPU affinity, nice increment, I/O
+ * class and SCHED_BATCH policy. "cpus=spread" puts the processes of a
+ * pipeline on the shell's allowed CPUs in turn, one stage per CPU.
+ *
+ * For one pipeline stage, the prefix
+ *   sched [-c CPUS] [-n INCREMENT] [-i CLASS[:LEVEL]] [-b] COMMAND [ARGS...]
+ * changes the same settings on top of the options, for example
+ * "sched -c 0 producer | sched -c 1 consumer" to keep a producer and
+ * its consumer on sibling cores.
+ *
+ * Like the ulimit settings, all of this is applied in the forked child
+ * right before exec, and the command is not run if a setting cannot
+ * be applied.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "shell2.h"
+
+/* From linux/ioprio.h, which older kernel headers lack */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_LEVEL_COUNT 8
+
+typedef struct {
+  bool has_cpus;
+  cpu_set_t cpus;
+  bool spread;            /* one allowed CPU per pipeline process */
+  int nice_increment;
+  int io_class;           /* 0 to leave the I/O class alone */
+  int io_level;
+  bool batch;
+} sched_settings;
+
+/* Position of this process in its pipeline, set in the forked child */
+static int process_index;
+
+/**
+ * Parse a CPU list such as "0,2-3"
+ * @return false if the list is malformed or names a CPU out of range
+ */
+static bool parse_cpu_list(const char* text, cpu_set_t* cpus) {
+  char* end;
+  long first, last, cpu;
+
+  CPU_ZERO(cpus);
+  do {
+    first = strtol(text, &end, 10);
+    if (end == text || first < 0) {
+      return false;
+    }
+    last = first;
+    if (*end == '-') {
+      text = end + 1;
+      last = strtol(text, &end, 10);
+      if (end == text || last < first) {
+        return false;
+      }
+    }
+    if (last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, cpus);
+    }
+    text = end + 1;
+  } while (*end == ',');
+  return *end == '\0';
+}
+
+/**
+ * Parse an I/O class: "none", "idle", "best-effort" or "be", or
+ * "realtime" or "rt", the last two optionally followed by ":LEVEL"
+ * @return false if the class or level is unknown
+ */
+static bool parse_io_class(const char* text, sched_settings* settings) {
+  static const struct { const char* name; int io_class; } classes[] = {
+    { "none", 0 }, { "realtime", 1 }, { "rt", 1 },
+    { "best-effort", 2 }, { "be", 2 }, { "idle", 3 },
+  };
+  size_t name_length = strcspn(text, ":");
+  char* end;
+  size_t i;
+
+  for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+    if (strlen(classes[i].name) == name_length && strncmp(classes[i].name, text, name_length) == 0) {
+      break;
+    }
+  }
+  if (i == sizeof(classes) / sizeof(classes[0])) {
+    return false;
+  }
+  settings->io_class = classes[i].io_class;
+  settings->io_level = 4; /* the kernel's default level */
+  if (text[name_length] == ':') {
+    if (settings->io_class == 0 || settings->io_class == 3) {
+      return false;
+    }
+    settings->io_level = strtol(text + name_length + 1, &end, 10);
+    if (end == text + name_length + 1 || *end != '\0' ||
+        settings->io_level < 0 || settings->io_level >= IOPRIO_LEVEL_COUNT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Parse a nice increment
+ * @return false if it is not a number
+ */
+static bool parse_nice_increment(const char* text, int* increment) {
+  char* end;
+
+  *increment = strtol(text, &end, 10);
+  return end != text && *end == '\0';
+}
+
+/**
+ * Check whether the sched options differ from their defaults, so a
+ * command must apply them (the zygote does not know about them)
+ */
+bool sched_pending(void) {
+  return strcmp(option_value(OPTION_CPUS), "all") != 0 ||
+         strcmp(option_value(OPTION_NICE), "0") != 0 ||
+         strcmp(option_value(OPTION_IONICE), "none") != 0 ||
+         option_enabled(OPTION_SCHED_BATCH);
+}
+
+/**
+ * Record this process's position in its pipeline, for "cpus=spread"
+ * @param index 0 for the first process of the pipeline
+ */
+void sched_set_process_index(int index) {
+  process_index = index;
+}
+
+/**
+ * Pick the index-th of the CPUs this process may run on, wrapping
+ * around
+ * @return false if the allowed CPUs cannot be read
+ */
+static bool spread_cpu(int index, cpu_set_t* cpus) {
+  cpu_set_t allowed;
+  int cpu, count;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+    return false;
+  }
+  index %= CPU_COUNT(&allowed);
+  for (cpu = 0, count = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed) && count++ == index) {
+      break;
+    }
+  }
+  CPU_ZERO(cpus);
+  CPU_SET(cpu, cpus);
+  return true;
+}
+
+/**
+ * Read the settings from the sched options
+ * @return false, after a message, if an option has a bad value
+ */
+static bool settings_from_options(sched_settings* settings) {
+  const char* cpus = option_value(OPTION_CPUS);
+
+  memset(settings, 0, sizeof(*settings));
+  if (strcmp(cpus, "spread") == 0) {
+    settings->spread = true;
+  }
+  else if (strcmp(cpus, "all") != 0) {
+    if (!parse_cpu_list(cpus, &settings->cpus)) {
+      fprintf(stderr, "sched: cpus: %s: invalid CPU list\n", cpus);
+      return false;
+    }
+    settings->has_cpus = true;
+  }
+  if (!parse_nice_increment(option_value(OPTION_NICE), &settings->nice_increment)) {
+    fprintf(stderr, "sched: nice: %s: invalid increment\n", option_value(OPTION_NICE));
+    return false;
+  }
+  if (!parse_io_class(option_value(OPTION_IONICE), settings)) {
+    fprintf(stderr, "sched: ionice: %s: invalid class\n", option_value(OPTION_IONICE));
+    return false;
+  }
+  settings->batch = option_enabled(OPTION_SCHED_BATCH);
+  return true;
+}
+
+/**
+ * Read the flags of a "sched" prefix over the settings
+ * @return Number of words of the prefix, or -1 after a message
+ */
+static int parse_prefix(char* args[], sched_settings* settings) {
+  int i;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(args[i], "-b") == 0) {
+      settings->batch = true;
+      continue;
+    }
+    if (args[i][1] == '\0' || args[i][2] != '\0' || strchr("cni", args[i][1]) == NULL || args[i + 1] == NULL) {
+      fprintf(stderr, "usage: sched [-c CPUS] [-n INCREMENT] [-i CLASS[:LEVEL]] [-b] COMMAND [ARGS...]\n");
+      return -1;
+    }
+    i++;
+    switch (args[i - 1][1]) {
+      case 'c':
+        if (!parse_cpu_list(args[i], &settings->cpus)) {
+          fprintf(stderr, "sched: %s: invalid CPU list\n", args[i]);
+          return -1;
+        }
+        settings->has_cpus = true;
+        settings->spread = false;
+        break;
+      case 'n':
+        if (!parse_nice_increment(args[i], &settings->nice_increment)) {
+          fprintf(stderr, "sched: %s: invalid increment\n", args[i]);
+          return -1;
+        }
+        break;
+      default:
+        if (!parse_io_class(args[i], settings)) {
+          fprintf(stderr, "sched: %s: invalid class\n", args[i]);
+          return -1;
+        }
+        break;
+    }
+  }
+  if (args[i] == NULL) {
+    fprintf(stderr, "sched: command expected\n");
+    return -1;
+  }
+  return i;
+}
+
+/**
+ * Change this process's scheduling as the settings say
+ * @return false, after a message, if a setting could not be applied
+ */
+static bool apply_settings(const sched_settings* settings) {
+  struct sched_param parameters = { 0 };
+  cpu_set_t spread;
+
+  if (settings->spread) {
+    if (!spread_cpu(process_index, &spread) || sched_setaffinity(0, sizeof(spread), &spread) < 0) {
+      perror("sched: cpus");
+      return false;
+    }
+  }
+  else if (settings->has_cpus && sched_setaffinity(0, sizeof(settings->cpus), &settings->cpus) < 0) {
+    perror("sched: cpus");
+    return false;
+  }
+  if (settings->nice_increment != 0) {
+    /* nice() may return -1 on success */
+    errno = 0;
+    if (nice(settings->nice_increment) == -1 && errno != 0) {
+      perror("sched: nice");
+      return false;
+    }
+  }
+  if (settings->io_class != 0 &&
+      syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+              settings->io_class << IOPRIO_CLASS_SHIFT | settings->io_level) < 0) {
+    perror("sched: ionice");
+    return false;
+  }
+  if (settings->batch && sched_setscheduler(0, SCHED_BATCH, &parameters) < 0) {
+    perror("sched: SCHED_BATCH");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Apply the sched options, and a leading "sched" prefix, in a forked
+ * child before exec. The prefix words are removed from args, so the
+ * command follows. The command is not run if a setting is invalid or
+ * cannot be applied.
+ * @param args Command and arguments, after any NAME=VALUE words
+ */
+void sched_apply_in_child(char* args[]) {
+  sched_settings settings;
+  int prefix_length = 0;
+  int i;
+
+  if (!sched_pending() && (args == NULL || args[0] == NULL || strcmp(args[0], "sched") != 0)) {
+    return;
+  }
+  if (!settings_from_options(&settings)) {
+    _exit(1);
+  }
+  if (args != NULL && args[0] != NULL && strcmp(args[0], "sched") == 0) {
+    prefix_length = parse_prefix(args, &settings);
+    if (prefix_length < 0) {
+      _exit(2);
+    }
+  }
+  if (!apply_settings(&settings)) {
+    _exit(1);
+  }
+  if (prefix_length > 0) {
+    for (i = 0; (args[i] = args[i + prefix_length]) != NULL; i++) {
+    }
+  }
+}
@@ -0,0 +1,332 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Command server: "shell2 --server SOCKET" keeps one warm shell (with
+ * its variables, PATH cache and jobs) and runs command lines sent by
+ * local clients, so they do not pay for a shell start per command.
+ *
+ * The socket is SOCK_SEQPACKET, so message boundaries are kept. A
+ * request is one message holding the command line, with the client's
+ * stdin, stdout and stderr attached as SCM_RIGHTS. The server puts those
+ * on its own descriptors 0-2 while the command runs and answers with
+ * one message, the exit status as decimal text. "exit" in a request
+ * ends that request with its status, not the server.
+ *
+ * Connections are watched in the shell's epoll set, so an idle client
+ * does not hold up the others. A connection may send any number of
+ * requests. Requests run one at a time; a connection that is ready
+ * waits in a queue and gets one request served per turn.
+ *
+ * "shell2 --client SOCKET COMMAND" is the matching client: it sends its
+ * own stdio and exits with the status it gets back.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "shell2.h"
+
+#define SERVER_BACKLOG 64
+#define SERVER_STDIO_COUNT 3
+
+/**
+ * Fill a sockaddr_un for path
+ * @return false if path does not fit
+ */
+static bool make_address(const char* path, struct sockaddr_un* address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    fprintf(stderr, "shell2: %s: socket path too long\n", path);
+    return false;
+  }
+  strcpy(address->sun_path, path);
+  return true;
+}
+
+/**
+ * Receive one request
+ * @param command Receives the command line, NUL-terminated
+ * @param stdio_fds Receives the client's stdin, stdout and stderr
+ * @return 1 on a request, 0 when the client is done, -1 on a bad request
+ */
+static int receive_request(int client_fd, char* command, size_t size, int* stdio_fds) {
+  char control[CMSG_SPACE(SERVER_STDIO_COUNT * sizeof(int))];
+  struct iovec data = { command, size - 1 };
+  struct msghdr message;
+  struct cmsghdr* header;
+  size_t fd_count = 0;
+  ssize_t length;
+  int* received;
+  size_t i;
+
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  length = recvmsg(client_fd, &message, MSG_CMSG_CLOEXEC);
+  if (length <= 0) {
+    return length == 0 ? 0 : -1;
+  }
+  command[length] = '\0';
+  for (header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    received = (int*)CMSG_DATA(header);
+    for (i = 0; i < (header->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+      if (fd_count < SERVER_STDIO_COUNT) {
+        stdio_fds[fd_count++] = received[i];
+      } else {
+        close(received[i]);
+      }
+    }
+  }
+  if (fd_count != SERVER_STDIO_COUNT || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+    fprintf(stderr, "shell2: server: request needs a command and exactly 3 descriptors\n");
+    for (i = 0; i < fd_count; i++) {
+      close(stdio_fds[i]);
+    }
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * Run one command line with the client's descriptors as stdin, stdout
+ * and stderr, then put the server's own back
+ */
+static int run_with_stdio(char* command, int* stdio_fds) {
+  int saved_fds[SERVER_STDIO_COUNT];
+  int status, i;
+
+  fflush(stdout);
+  for (i = 0; i < SERVER_STDIO_COUNT; i++) {
+    saved_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, SERVER_STDIO_COUNT);
+    dup2(stdio_fds[i], i);
+    close(stdio_fds[i]);
+  }
+  clearerr(stdin);
+  status = run_command_line(command);
+  fflush(stdout);
+  for (i = 0; i < SERVER_STDIO_COUNT; i++) {
+    if (saved_fds[i] >= 0) {
+      dup2(saved_fds[i], i);
+      close(saved_fds[i]);
+    } else {
+      close(i);
+    }
+  }
+  return status;
+}
+
+/* A client connection, watched for requests or queued to be served */
+typedef struct server_connection {
+  event_source event;
+  struct server_connection* next_ready;
+} server_connection;
+
+static bool serving;
+static server_connection* first_ready;
+static server_connection* last_ready;
+
+/**
+ * Check whether this process is answering requests, so "exit" ends
+ * only the current one
+ */
+bool server_serving(void) {
+  return serving;
+}
+
+/**
+ * A connection has a request or was closed. It leaves the epoll set
+ * until served: requests run from the loop in server_run, not inside
+ * a handler, and a command waiting on its job must not be woken for it.
+ */
+static void queue_connection(event_source* source, unsigned int events) {
+  server_connection* connection = source->context;
+
+  events_remove(source);
+  connection->next_ready = NULL;
+  if (last_ready != NULL) {
+    last_ready->next_ready = connection;
+  } else {
+    first_ready = connection;
+  }
+  last_ready = connection;
+}
+
+/**
+ * Accept a client and watch it. Only processes of the same user are
+ * kept.
+ */
+static void accept_connection(event_source* source, unsigned int events) {
+  server_connection* connection;
+  struct ucred peer;
+  socklen_t peer_length = sizeof(peer);
+  int client_fd;
+
+  client_fd = accept4(source->fd, NULL, NULL, SOCK_CLOEXEC);
+  if (client_fd < 0) {
+    if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+      perror("accept4");
+    }
+    return;
+  }
+  if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) < 0 || peer.uid != getuid()) {
+    close(client_fd);
+    return;
+  }
+  connection = malloc(sizeof(server_connection));
+  if (connection == NULL) {
+    perror("malloc");
+    close(client_fd);
+    return;
+  }
+  connection->event.fd = client_fd;
+  connection->event.handle = queue_connection;
+  connection->event.context = connection;
+  if (!events_add(&connection->event)) {
+    close(client_fd);
+    free(connection);
+  }
+}
+
+/**
+ * Answer one request on a connection, then watch it again, or close
+ * it if the client is done
+ */
+static void serve_request(server_connection* connection) {
+  char command[MAX_INPUT_LENGTH];
+  char reply[16];
+  int stdio_fds[SERVER_STDIO_COUNT];
+  int result, status, length;
+
+  result = receive_request(connection->event.fd, command, sizeof(command), stdio_fds);
+  if (result > 0) {
+    status = run_with_stdio(command, stdio_fds);
+    length = snprintf(reply, sizeof(reply), "%d\n", status);
+    if (send(connection->event.fd, reply, length, MSG_NOSIGNAL) == length &&
+        events_add(&connection->event)) {
+      return;
+    }
+  }
+  close(connection->event.fd);
+  free(connection);
+}
+
+/**
+ * Accept clients on a Unix socket and answer their requests forever.
+ * Only processes of the same user may connect: the socket is mode 0600
+ * and peers are checked.
+ * @param socket_path Path to create the socket at; a stale socket there is replaced
+ * @return Exit status if the socket cannot be set up
+ */
+int server_run(const char* socket_path) {
+  struct sockaddr_un address;
+  struct stat existing;
+  event_source listen_event = { -1, accept_connection, NULL };
+  server_connection* connection;
+  int listen_fd;
+
+  if (!make_address(socket_path, &address)) {
+    return 2;
+  }
+  /* A client that goes away mid-command must not kill the server */
+  signal(SIGPIPE, SIG_IGN);
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listen_fd < 0) {
+    perror("socket");
+    return 1;
+  }
+  if (lstat(socket_path, &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+    unlink(socket_path);
+  }
+  if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+      chmod(socket_path, 0600) < 0 || listen(listen_fd, SERVER_BACKLOG) < 0) {
+    perror(socket_path);
+    close(listen_fd);
+    return 1;
+  }
+  listen_event.fd = listen_fd;
+  if (!events_add(&listen_event)) {
+    close(listen_fd);
+    return 1;
+  }
+  serving = true;
+  while (true) {
+    /* Job and signal events keep being handled while clients are idle */
+    events_dispatch(-1);
+    while (first_ready != NULL) {
+      connection = first_ready;
+      first_ready = connection->next_ready;
+      if (first_ready == NULL) {
+        last_ready = NULL;
+      }
+      serve_request(connection);
+      jobs_notify();
+    }
+  }
+}
+
+/**
+ * Send one command line with this process's stdio to a server
+ * @return The command's exit status, or 255 if the server could not run it
+ */
+int server_client(const char* socket_path, const char* command) {
+  struct sockaddr_un address;
+  int stdio_fds[SERVER_STDIO_COUNT] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(stdio_fds))];
+  struct iovec data = { (char*)command, strlen(command) };
+  struct msghdr message;
+  struct cmsghdr* header;
+  char reply[16];
+  ssize_t length;
+  int server_fd;
+
+  if (!make_address(socket_path, &address)) {
+    return 255;
+  }
+  if (data.iov_len == 0 || data.iov_len >= MAX_INPUT_LENGTH) {
+    fprintf(stderr, "shell2: --client: command must be 1 to %d bytes\n", MAX_INPUT_LENGTH - 1);
+    return 255;
+  }
+  server_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (server_fd < 0 || connect(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    perror(socket_path);
+    return 255;
+  }
+  memset(&message, 0, sizeof(message));
+  memset(control, 0, sizeof(control));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(stdio_fds));
+  memcpy(CMSG_DATA(header), stdio_fds, sizeof(stdio_fds));
+  if (sendmsg(server_fd, &message, MSG_NOSIGNAL) < 0) {
+    perror("sendmsg");
+    return 255;
+  }
+  length = recv(server_fd, reply, sizeof(reply) - 1, 0);
+  close(server_fd);
+  if (length <= 0) {
+    fprintf(stderr, "shell2: server closed the connection\n");
+    return 255;
+  }
+  reply[length] = '\0';
+  return atoi(reply);
+}
@@ -6,17 +6,38 @@
  * 
  * This program implements a basic Unix shell with built-in commands,
  * process execution, background processes, piping, I/O redirection,
- * signal handling, and timeouts for long-running processes.
+ * signal handling, timeouts for long-running processes, pathname
+ * expansion and command substitution.
+ *
+ * "shell2 --server SOCKET" serves command lines to local clients
+ * instead of reading them from stdin.
  *
  * Built-in commands:
  * - cd: changes the current working directory
  * - pwd: prints the current working directory
- * - echo: prints a message and environment variables
+ * - echo: prints a message
  * - exit: terminates the shell
  * - env: prints current values of environment variables
  * - setenv: sets an environment variable
+ * - export: exports shell variables to commands
+ * - unset: removes shell variables
+ * - let: evaluates arithmetic expressions
+ * - jobs, fg, bg: job control
+ * - ulimit: limits resources of the commands the shell runs
+ * - set: changes shell options ("set -o cgroup" runs jobs in cgroups)
+ * - shstats: prints internal counters ("set -o stats" also prints them at exit)
+ *
+ * With "set -o utilities", cat, grep, head, sort, tail and wc run in
+ * the forked child without an exec (utilities.c), and with "set -o
+ * fusion" adjacent ones share one process (fusion.c).
+ *
+ * "sched [-c CPUS] [-n INCREMENT] [-i CLASS[:LEVEL]] [-b] COMMAND" runs
+ * a command or pipeline stage with a CPU affinity, nice increment, I/O
+ * class or SCHED_BATCH; the cpus, nice, ionice and sched_batch options
+ * do the same for every job (sched.c).
  */
 
+#define _GNU_SOURCE
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,78 +48,235 @@
 #include <signal.h>
 #include <assert.h>
 #include <errno.h>
-
-#define MAX_INPUT_LENGTH 1024
-#define MAX_ARGUMENTS 128
-#define WORKING_DIR_BUFFER_SIZE 400
-#define TIMEOUT_SECONDS 10
+#include "shell2.h"
 
 char SHELL_PROMPT[] = "> ";
-char TOKEN_DELIMITERS[] = " \t\r\n";
 extern char **environ;
-int foreground_process_id = -1;
-
-void execute_command_with_pipes_and_redirection(char* command_arguments[]);
-void process_token_quotes(char* token);
-void terminate_after_timeout(int seconds, int process_id);
-void handle_interrupt_signal(int signal_number);
-void execute_single_command(char* args[]);
 
 /**
- * Main function - Shell entry point
- * Processes user input and executes commands
+ * Build the prompt: working directory followed by SHELL_PROMPT
  */
-int main() {
-  char user_input_buffer[MAX_INPUT_LENGTH];
-  
-  /* Buffer for working directory path */
+static void build_prompt(char* prompt, size_t size) {
   char working_directory_buffer[WORKING_DIR_BUFFER_SIZE];
-  char *working_directory_path;
-  
-  /* Stores the tokenized command line input */
-  char *command_arguments[MAX_ARGUMENTS];
-  
-  /* Set up signal handler for Ctrl+C */
-  signal(SIGINT, handle_interrupt_signal);
 
+  if (getcwd(working_directory_buffer, WORKING_DIR_BUFFER_SIZE) == NULL) {
+    perror("getcwd");
+    exit(1);
+  }
+  snprintf(prompt, size, "%s %s", working_directory_buffer, SHELL_PROMPT);
+}
+
+/**
+ * With SHELL2_ZYGOTE=1, fork the zygote now, while the shell is smallest
+ */
+static void start_requested_zygote(void) {
+  const char* setting = getenv("SHELL2_ZYGOTE");
+
+  if (setting != NULL && strcmp(setting, "1") == 0) {
+    options_set("zygote", true);
+    zygote_start();
+  }
+}
+
+/* Words and strings of the command line being run */
+static argument_vector argument_list;
+static string_arena command_arena;
+
+/**
+ * Convert a waitpid() status to a shell exit status
+ */
+static int exit_status_of(int status) {
+  if (status == -1) {
+    return 1;
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return WEXITSTATUS(status);
+}
+
+/**
+ * Expand and run one command line: variable assignments, a builtin or
+ * a job in the foreground or background
+ * @param line Command line without its newline; a trailing "&" may be cut off
+ * @return Exit status of the command
+ */
+int run_command_line(char* line) {
+  char **command_arguments;
+  const builtin_command* builtin;
+  builtin_streams streams = { stdout };
   int argument_index;
-  int part_index;
-  int echo_index;
-  char* env_var_parts[2];
+  int assignment_count;
   char* final_argument;
   bool is_background_process;
-  int child_pid;
-  int timeout_process_id;
+  job* new_job;
+  char* background_marker;
   int exit_status;
-  char* env_value;
-  char* home_directory;
+  long long parse_start;
+
+  /* Strings and directory listings from the previous command */
+  string_arena_reset(&command_arena);
+  glob_cache_reset();
+  argument_vector_clear(&argument_list);
+
+  /* Split into words: quotes, command substitution and globbing */
+  parse_start = trace_update() ? trace_now() : 0;
+  if (!expand_words(line, &argument_list, &command_arena)) {
+    return 1;
+  }
+  if (parse_start != 0) {
+    trace_span("parse", getpid(), parse_start, line);
+  }
+  argument_index = argument_list.count;
+  command_arguments = argument_list.items;
+  
+  /* Skip processing if no command */
+  if (argument_index == 0) {
+    return 0;
+  }
+  
+  /* Assert we have a valid command */
+  assert(command_arguments[0] != NULL);
+  
+  /* Check for background process request */
+  final_argument = command_arguments[argument_index-1];
+  is_background_process = false;
+  if (strcmp(final_argument, "&") == 0) {
+     is_background_process = true;
+     command_arguments[argument_index-1] = NULL;
+  }
+  
+  /* A line made only of NAME=VALUE words sets shell variables */
+  for (assignment_count = 0; command_arguments[assignment_count] != NULL &&
+       variable_assignment_name_length(command_arguments[assignment_count]) > 0; assignment_count++) {
+  }
+  if (command_arguments[assignment_count] == NULL) {
+    for (assignment_count = 0; command_arguments[assignment_count] != NULL; assignment_count++) {
+      variable_assign_word(command_arguments[assignment_count], false);
+    }
+    return 0;
+  }
+
+  /*
+   * Handle built-in commands. Per-command assignments in front of a
+   * builtin are dropped rather than applied to the shell.
+   */
+  builtin = find_builtin(command_arguments[assignment_count]);
+  if (builtin != NULL) {
+    return builtin->function(command_arguments + assignment_count, &streams);
+  }
+
+  /* External command execution */
+  /* Build envp before forking so later commands reuse the cached copy */
+  variables_environment();
+  /* Ctrl+C typed at the prompt must not interrupt this command */
+  signals_discard_pending();
+  /* The job keeps the command text, without a trailing "&" */
+  background_marker = is_background_process ? strrchr(line, '&') : NULL;
+  if (background_marker != NULL) {
+    *background_marker = '\0';
+  }
+  new_job = jobs_launch(command_arguments, line, is_background_process);
+  if (new_job == NULL) {
+    return 1;
+  }
+  if (is_background_process) {
+    printf("[%d] Background process started\n", new_job->processes[0].pid);
+    return 0;
+  }
+  exit_status = jobs_wait_foreground(new_job, TIMEOUT_SECONDS);
+  /* Report if process terminated with error */
+  if (exit_status != -1 && WIFEXITED(exit_status) && WEXITSTATUS(exit_status) != 0) {
+    fprintf(stderr, "Process exited with status %d\n", WEXITSTATUS(exit_status));
+  }
+  return exit_status_of(exit_status);
+}
+
+/**
+ * Main function - Shell entry point
+ * Processes user input and executes commands. "shell2 -c COMMAND" runs
+ * one command line and exits with its status; "--server SOCKET" and
+ * "--client SOCKET COMMAND" are described in server.c.
+ */
+int main(int argc, char* argv[]) {
+  char user_input_buffer[MAX_INPUT_LENGTH];
+  char prompt[WORKING_DIR_BUFFER_SIZE + sizeof(SHELL_PROMPT) + 1];
   size_t input_length;
+  int read_status;
 
-  while (true) {
-    /* Print the shell prompt with current working directory */
-    fflush(stdout);
-    working_directory_path = getcwd(working_directory_buffer, WORKING_DIR_BUFFER_SIZE);
-    if (working_directory_path == NULL) {
-        perror("getcwd");
-        exit(1);
+  /* A client only forwards its stdio, so it needs none of the setup */
+  if (argc == 4 && strcmp(argv[1], "--client") == 0) {
+    return server_client(argv[2], argv[3]);
+  }
+  
+  /* Ctrl+C, child exits and timeouts all arrive through one epoll set */
+  stats_initialize();
+  signals_initialize();
+  events_initialize();
+
+  /* Shell variables start as a copy of the inherited environment */
+  variables_initialize(environ);
+
+  if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+    /*
+     * One-shot mode for job runners: no prompt, job control or line
+     * editor. History, completion and the PATH cache are only set up
+     * on first use, so they cost nothing here.
+     */
+    if (strlen(argv[2]) >= MAX_INPUT_LENGTH) {
+      fprintf(stderr, "shell2: -c: command too long\n");
+      return 2;
     }
-    printf("%s %s", working_directory_path, SHELL_PROMPT);
+    strcpy(user_input_buffer, argv[2]);
+    jobs_initialize(false);
+    exit(run_command_line(user_input_buffer));
+  }
+  if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+    jobs_initialize(false);
+    start_requested_zygote();
+    return server_run(argv[2]);
+  }
+  if (argc != 1) {
+    fprintf(stderr, "Usage: %s [-c COMMAND | --server SOCKET | --client SOCKET COMMAND]\n", argv[0]);
+    return 2;
+  }
+  jobs_initialize(true);
+  start_requested_zygote();
+
+  while (true) {
+    /* Report background jobs that finished or stopped since the last prompt */
+    jobs_notify();
+
+    /* Prompt with the current working directory */
     fflush(stdout);
+    build_prompt(prompt, sizeof(prompt));
 
-    /* Read one line of input from stdin */
-    if ((fgets(user_input_buffer, MAX_INPUT_LENGTH, stdin) == NULL)) {
-        if (ferror(stdin)) {
-            fprintf(stderr, "Error reading input\n");
-            exit(1);
-        }
-        if (feof(stdin)) {
-            printf("exit\n");
-            exit(0);
-        }
+    if (jobs_interactive()) {
+      /* Line editing and history; job reports still appear while typing */
+      if (!line_editor_read(prompt, user_input_buffer, MAX_INPUT_LENGTH, jobs_notify)) {
+        printf("exit\n");
+        exit(0);
+      }
+    }
+    else {
+      /* Read one line of input from stdin */
+      fputs(prompt, stdout);
+      read_status = io_core_read_line(user_input_buffer, MAX_INPUT_LENGTH);
+      if (read_status < 0) {
+        fprintf(stderr, "Error reading input\n");
+        exit(1);
+      }
+      if (read_status == 0) {
+        printf("exit\n");
+        exit(0);
+      }
     }
 
     /* Remove trailing newline character */
     input_length = strlen(user_input_buffer);
+    if (!jobs_interactive()) {
+      stats_add(COUNTER_STDIN_BYTES, input_length);
+    }
     if (input_length > 0 && user_input_buffer[input_length-1] == '\n') {
         user_input_buffer[input_length-1] = '\0';
     }
@@ -108,234 +286,43 @@ int main() {
         continue;
     }
 
-    /* Tokenize the input */
-    command_arguments[0] = strtok(user_input_buffer, TOKEN_DELIMITERS);
-    argument_index = 0;
-    while(command_arguments[argument_index] != NULL) {
-      process_token_quotes(command_arguments[argument_index]);
-      argument_index++;
-      command_arguments[argument_index] = strtok(NULL, TOKEN_DELIMITERS);
-    }
-    
-    /* Skip processing if no command */
-    if (command_arguments[0] == NULL) {
-      continue;
-    }
-    
-    /* Assert we have a valid command */
-    assert(command_arguments[0] != NULL);
-    
-    /* Check for background process request */
-    final_argument = command_arguments[argument_index-1];
-    is_background_process = false;
-    if (strcmp(final_argument, "&") == 0) {
-       is_background_process = true;
-       command_arguments[argument_index-1] = NULL;
-    }
-    
-    /* Handle built-in commands */
-    if (strcmp(command_arguments[0], "cd") == 0) {
-      if (command_arguments[1] == NULL) {
-        /* Change to HOME directory if no argument */
-        home_directory = getenv("HOME");
-        if (home_directory != NULL) {
-          if (chdir(home_directory) != 0) {
-            perror("cd");
-          }
-        } else {
-          fprintf(stderr, "cd: HOME not set\n");
-        }
-      } else if (chdir(command_arguments[1]) != 0) {
-        perror("cd");
-      }
-    }
-    else if (strcmp(command_arguments[0], "pwd") == 0) {
-      working_directory_path = getcwd(working_directory_buffer, WORKING_DIR_BUFFER_SIZE);
-      if (working_directory_path == NULL) {
-        perror("pwd");
-      } else {
-        printf("%s\n", working_directory_path);
-      }
-    }
-    else if (strcmp(command_arguments[0], "echo") == 0) {
-      echo_index = 1;
-      while (command_arguments[echo_index] != NULL) {
-        if (command_arguments[echo_index][0] == '$') {
-          env_value = getenv(command_arguments[echo_index] + 1);
-          if (env_value != NULL) {
-            printf("%s ", env_value);
-          } else {
-            printf(" "); /* Empty string if variable not found */
-          }
-        }
-        else {
-          printf("%s ", command_arguments[echo_index]);
-        }
-        echo_index++;
-      }
-      printf("\n");
-    }
-    else if (strcmp(command_arguments[0], "exit") == 0) {
-      exit(0);
-    }
-    else if (strcmp(command_arguments[0], "env") == 0) {
-      if (command_arguments[1] != NULL) {
-        env_value = getenv(command_arguments[1]);
-        if (env_value != NULL) {
-          printf("%s\n", env_value);
-        } else {
-          printf("\n"); /* Print empty line if variable not found */
-        }
-      }
-      else {
-        char** environment_variables = environ;
-        for (; *environment_variables; environment_variables++)
-          printf("%s\n", *environment_variables);
-      }
-    }
-    else if (strcmp(command_arguments[0], "setenv") == 0) {
-      if (command_arguments[1] == NULL) {
-        fprintf(stderr, "setenv: missing argument\n");
-        continue;
-      }
-      env_var_parts[0] = strtok(command_arguments[1], "=");
-      part_index = 0;
-      while (env_var_parts[part_index] != NULL && part_index < 2) {
-        part_index++;
-        env_var_parts[part_index] = strtok(NULL, "=");
-      }
-      if (env_var_parts[0] == NULL || env_var_parts[1] == NULL) {
-        fprintf(stderr, "setenv: invalid format. Use NAME=VALUE\n");
-        continue;
-      }
-      if (setenv(env_var_parts[0], env_var_parts[1], 1) != 0) {
-        perror("setenv");
-      }
-    }
-    else {
-      /* External command execution */
-      child_pid = fork();
-      if (child_pid < 0) {
-        perror("fork");
-        continue;
-      }
-      
-      if (child_pid == 0) {
-        /* Child process */
-        signal(SIGINT, SIG_DFL);
-        execute_command_with_pipes_and_redirection(command_arguments);
-        /* If execute_command returns, an error occurred */
-        exit(1);
-      }
-      else {
-        /* Parent process */
-        if (is_background_process) {
-          foreground_process_id = -1;
-          printf("[%d] Background process started\n", child_pid);
-        }
-        else {
-          foreground_process_id = child_pid;
-          
-          /* Create timeout process */
-          timeout_process_id = fork();
-          if (timeout_process_id < 0) {
-            perror("fork for timeout process");
-            /* Continue with main process even if timeout fork fails */
-          } else if (timeout_process_id == 0) {
-            /* Timeout process */
-            signal(SIGINT, SIG_DFL);
-            terminate_after_timeout(TIMEOUT_SECONDS, child_pid);
-            exit(0);
-          }
-          else {
-            /* Wait for child to complete */
-            waitpid(child_pid, &exit_status, 0);
-            
-            /* Kill the timeout process */
-            kill(timeout_process_id, SIGINT);
-            waitpid(timeout_process_id, NULL, 0);
-            
-            /* Report if process terminated with error */
-            if (WIFEXITED(exit_status) && WEXITSTATUS(exit_status) != 0) {
-              fprintf(stderr, "Process exited with status %d\n", WEXITSTATUS(exit_status));
-            }
-          }
-        }
-      }
-    }
+    run_command_line(user_input_buffer);
   }
   /* This should never be reached */
   return -1;
 }
 
-/**
- * Wait for specified time, then kill the process if still running
- * @param seconds Time in seconds to wait
- * @param process_id Process ID to kill
- */
-void terminate_after_timeout(int seconds, int process_id) {
-  sleep(seconds);
-  printf("Foreground process timed out after %d seconds.\n", seconds);
-  kill(process_id, SIGINT);
-}
-
-/**
- * Process command tokens, handling quoted strings
- * Removes surrounding quotes from tokens
- * @param token Token to process
- */
-void process_token_quotes(char* token) {
-  bool has_quotes = false;
-  char opening_quote;
-  char closing_quote;
-  int char_index;
-  
-  if (token[0] == '\"' || token[0] == '\'') {
-    opening_quote = token[0];
-    has_quotes = true;
-  }
-  
-  if (has_quotes) {
-    char_index = 0;
-    while (token[char_index] != '\0') {
-      closing_quote = token[char_index];
-      char_index++;
-    }
-    
-    if (opening_quote == closing_quote) { 
-      /* Remove the quotes */
-      char_index = 1;
-      while (token[char_index] != '\0') {
-        token[char_index-1] = token[char_index];
-        char_index++;
-      }
-      token[char_index-1] = '\0';
-      token[char_index-2] = '\0';
-    }
-  }
-}
-
 /**
  * Execute a single command with I/O redirection
  * @param args Command and arguments array
+ * @param resolved_path Full path of the command from the PATH cache, or
+ *   NULL to let execvp search PATH
  */
-void execute_single_command(char* args[]) {
+void execute_single_command(char* args[], const char* resolved_path) {
   int i;
   int input_fd, output_fd;
+  int assignment_count;
+  utility_function utility;
+  int utility_status;
+  
+  /* Leading NAME=VALUE words only go into this command's environment */
+  for (assignment_count = 0; args[assignment_count] != NULL &&
+       variable_assignment_name_length(args[assignment_count]) > 0; assignment_count++) {
+  }
   
   /* Process I/O redirection for this command */
-  for (i = 0; args[i] != NULL; i++) {
+  for (i = assignment_count; args[i] != NULL; i++) {
     /* Output redirection */
     if (strcmp(args[i], ">") == 0 && args[i+1] != NULL) {
       output_fd = open(args[i+1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
       if (output_fd < 0) {
         perror("open");
-        exit(1);
+        _exit(1);
       }
       if (dup2(output_fd, STDOUT_FILENO) < 0) {
         perror("dup2");
         close(output_fd);
-        exit(1);
+        _exit(1);
       }
       close(output_fd);
       args[i] = NULL; /* Terminate args at redirection symbol */
@@ -347,12 +334,12 @@ void execute_single_command(char* args[]) {
       input_fd = open(args[i+1], O_RDONLY);
       if (input_fd < 0) {
         perror("open");
-        exit(1);
+        _exit(1);
       }
       if (dup2(input_fd, STDIN_FILENO) < 0) {
         perror("dup2");
         close(input_fd);
-        exit(1);
+        _exit(1);
       }
       close(input_fd);
       args[i] = NULL; /* Terminate args at redirection symbol */
@@ -361,150 +348,311 @@ void execute_single_command(char* args[]) {
   }
   
   /* Execute the command */
-  if (args[0] != NULL) {
-    execvp(args[0], args);
+  if (args[assignment_count] != NULL) {
+    limits_apply_in_child();
+    /* Affinity and priority; drops a "sched ..." prefix from the words */
+    sched_apply_in_child(args + assignment_count);
+    /* With "set -o utilities", cat, head, tail and wc run here instead */
+    utility = find_utility(args[assignment_count]);
+    if (utility != NULL) {
+      stats_check_descriptors(args[assignment_count], false);
+      utility_status = utility(args + assignment_count, false);
+      if (utility_status != UTILITY_UNSUPPORTED) {
+        stats_add(COUNTER_UTILITY_RUNS, 1);
+        _exit(utility_status);
+      }
+    }
+    stats_check_descriptors(args[assignment_count], true);
+    if (trace_enabled()) {
+      trace_instant("exec", getpid(), args[assignment_count]);
+    }
+    /* execvp searches PATH in environ, so point it at the shell's variables */
+    if (assignment_count > 0) {
+      environ = variables_environment_with(args, assignment_count);
+    } else {
+      environ = variables_environment();
+    }
+    stats_add(COUNTER_EXECS, 1);
+    if (resolved_path != NULL) {
+      execv(resolved_path, args + assignment_count);
+      /* The cached file may be gone; a PATH search decides */
+    }
+    execvp(args[assignment_count], args + assignment_count);
+    stats_add(COUNTER_EXEC_FAILURES, 1);
     perror("execvp");
-    exit(1);
+    _exit(1);
   }
 }
 
 /**
- * Execute command with arguments
- * Handles piping and I/O redirection
- * @param command_arguments Command and arguments array
+ * With "set -o pathcache", look up a stage's command in the PATH cache
+ * before forking, so the lookup is remembered in the shell rather than
+ * lost with the child
+ * @param args Arguments of one pipeline stage
+ * @return Path to exec, or NULL to leave the search to execvp: the cache
+ *   is off, the name has a '/', the stage sets variables (which may
+ *   change PATH), or the command follows a "sched" prefix
  */
-void execute_command_with_pipes_and_redirection(char* command_arguments[]) {
-  char* commands_by_pipe[MAX_ARGUMENTS][MAX_ARGUMENTS];
-  int pipe_file_descriptors[MAX_ARGUMENTS][2];
-  int process_ids[MAX_ARGUMENTS];
-  int arg_index, pipe_index, cmd_index, j, proc_index;
+static const char* resolve_stage_command(char* args[]) {
+  if (!option_enabled(OPTION_PATH_CACHE) || args[0] == NULL || variable_assignment_name_length(args[0]) > 0 ||
+      strchr(args[0], '/') != NULL || strcmp(args[0], "<") == 0 || strcmp(args[0], ">") == 0 ||
+      strcmp(args[0], "sched") == 0) {
+    return NULL;
+  }
+  return path_cache_lookup(args[0]);
+}
+
+/**
+ * Start one process per pipeline stage, connected by pipes (or per
+ * run of fused stages). Each stage handles its own I/O redirection.
+ * The caller waits.
+ * @param command_arguments Command and arguments array ("|" separates stages)
+ * @param options Process group, terminal and stdin handling
+ * @param stage_pids Receives a malloc'd array of the started pids
+ * @return Number of processes started, or -1 on error
+ */
+int spawn_pipeline(char* command_arguments[], spawn_options* options, pid_t** stage_pids) {
+  char*** commands_by_pipe;
+  char** stage_commands;
+  int (*process_stages)[2];
+  int (*pipe_file_descriptors)[2];
+  pid_t* process_ids;
+  int arg_index, pipe_index, cmd_index, stage_index;
   int pipe_command_count, command_token_count, num_pipes;
+  int null_fd;
+  long long fork_start = 0;
+  const char* resolved_path;
+  bool use_zygote;
+  int cwd_fd = -1;
+  int highest_fd;
   
-  /* Split commands by pipe symbol */
+  /* Output the shell printed so far must come before the commands' */
+  io_core_flush();
+
+  /* Count the pipeline stages so the tables can be sized */
+  pipe_command_count = 1;
+  for (arg_index = 0; command_arguments[arg_index] != NULL; arg_index++) {
+    if (strcmp(command_arguments[arg_index], "|") == 0) {
+      pipe_command_count++;
+    }
+  }
+  commands_by_pipe = malloc(pipe_command_count * sizeof(char**));
+  pipe_file_descriptors = malloc(pipe_command_count * sizeof(*pipe_file_descriptors));
+  process_stages = malloc(pipe_command_count * sizeof(*process_stages));
+  process_ids = malloc(pipe_command_count * sizeof(pid_t));
+  if (commands_by_pipe == NULL || process_stages == NULL || pipe_file_descriptors == NULL || process_ids == NULL) {
+    perror("malloc");
+    return -1;
+  }
+
+  /* Split commands by pipe symbol, in place: each "|" becomes NULL */
   arg_index = 0;
   pipe_command_count = 0;
   command_token_count = 0;
+  commands_by_pipe[0] = command_arguments;
   
   while (command_arguments[arg_index] != NULL) {
     if (strcmp(command_arguments[arg_index], "|") == 0) {
       if (command_token_count == 0) {
         printf("Invalid pipe command\n");
-        return;
+        free(commands_by_pipe);
+        free(process_stages);
+        free(pipe_file_descriptors);
+        free(process_ids);
+        return -1;
       }
-      commands_by_pipe[pipe_command_count][command_token_count] = NULL;
+      command_arguments[arg_index] = NULL;
       
       pipe_command_count++;
       command_token_count = 0;
+      commands_by_pipe[pipe_command_count] = &command_arguments[arg_index + 1];
     }
     else {
-      commands_by_pipe[pipe_command_count][command_token_count] = command_arguments[arg_index];
       command_token_count++;
     }
     arg_index++;
   }
   
-  /* Ensure the last command is properly terminated */
-  commands_by_pipe[pipe_command_count][command_token_count] = NULL;
-  
   num_pipes = pipe_command_count;
   pipe_command_count++; /* Total commands = number of pipes + 1 */
-  
-  if (num_pipes == 0) {
-    /* Simple command with no pipes - handle redirection and execute */
-    execute_single_command(commands_by_pipe[0]);
-    /* If we get here, execution failed */
-    return;
+
+  /*
+   * Each stage gets a process, except that with "set -o fusion" a run
+   * of adjacent utility stages shares one (fusion.c). process_stages
+   * holds each process's first stage and stage count; from here on,
+   * pipes and pids are per process.
+   */
+  cmd_index = 0;
+  for (stage_index = 0; stage_index < pipe_command_count; stage_index += process_stages[cmd_index++][1]) {
+    process_stages[cmd_index][0] = stage_index;
+    process_stages[cmd_index][1] = 1;
+    if (fusion_stage_fusable(commands_by_pipe[stage_index])) {
+      while (stage_index + process_stages[cmd_index][1] < pipe_command_count &&
+             fusion_stage_fusable(commands_by_pipe[stage_index + process_stages[cmd_index][1]])) {
+        process_stages[cmd_index][1]++;
+      }
+    }
+  }
+  pipe_command_count = cmd_index;
+  num_pipes = pipe_command_count - 1;
+
+  /* Checked before any pipe exists: a zygote started now must not inherit one */
+  use_zygote = zygote_usable();
+  if (use_zygote) {
+    cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    use_zygote = cwd_fd >= 0;
   }
   
-  /* Create pipes */
+  /* Create pipes; close-on-exec, as each child keeps only its dup2 copies */
   for (pipe_index = 0; pipe_index < num_pipes; pipe_index++) {
-    if (pipe(pipe_file_descriptors[pipe_index]) < 0) {
+    if (pipe2(pipe_file_descriptors[pipe_index], O_CLOEXEC) < 0) {
       perror("pipe");
-      return;
+      while (--pipe_index >= 0) {
+        close(pipe_file_descriptors[pipe_index][0]);
+        close(pipe_file_descriptors[pipe_index][1]);
+      }
+      num_pipes = 0;
+      pipe_command_count = 0;
+      break;
+    }
+  }
+  highest_fd = cwd_fd;
+  for (pipe_index = 0; pipe_index < num_pipes; pipe_index++) {
+    if (pipe_file_descriptors[pipe_index][0] > highest_fd) {
+      highest_fd = pipe_file_descriptors[pipe_index][0];
+    }
+    if (pipe_file_descriptors[pipe_index][1] > highest_fd) {
+      highest_fd = pipe_file_descriptors[pipe_index][1];
     }
   }
+  stats_note_descriptor(highest_fd);
   
   /* Create processes for each command in the pipeline */
   for (cmd_index = 0; cmd_index < pipe_command_count; cmd_index++) {
-    process_ids[cmd_index] = fork();
+    stage_commands = commands_by_pipe[process_stages[cmd_index][0]];
+    resolved_path = process_stages[cmd_index][1] == 1 ? resolve_stage_command(stage_commands) : NULL;
+    if (trace_enabled()) {
+      fork_start = trace_now();
+    }
+    process_ids[cmd_index] = -1;
+    /* A utility stage skips exec, so a plain fork is all it needs */
+    if (use_zygote && find_utility(stage_commands[0]) == NULL) {
+      process_ids[cmd_index] = zygote_spawn(stage_commands, resolved_path,
+                                            cmd_index > 0 ? pipe_file_descriptors[cmd_index - 1][0] : STDIN_FILENO,
+                                            cmd_index < num_pipes ? pipe_file_descriptors[cmd_index][1] : STDOUT_FILENO,
+                                            cwd_fd, options);
+    }
+    if (process_ids[cmd_index] < 0) {
+      process_ids[cmd_index] = fork();
+    }
     
     if (process_ids[cmd_index] == 0) {
-      /* Child process */
-      if (cmd_index == 0) {
-        /* First command: output to pipe */
-        if (dup2(pipe_file_descriptors[0][1], STDOUT_FILENO) < 0) {
-          perror("dup2");
-          exit(1);
-        }
-        close(pipe_file_descriptors[0][0]);
-        for (j = 1; j < num_pipes; j++) {
-          close(pipe_file_descriptors[j][0]);
-          close(pipe_file_descriptors[j][1]);
+      /* Child process: join the job's group (the first stage leads it) */
+      if (options->process_group >= 0) {
+        setpgid(0, options->process_group);
+        if (options->take_terminal) {
+          tcsetpgrp(STDIN_FILENO, options->process_group ? options->process_group : getpid());
         }
       }
-      else if (cmd_index == num_pipes) {
-        /* Last command: input from pipe */
-        if (dup2(pipe_file_descriptors[num_pipes-1][0], STDIN_FILENO) < 0) {
-          perror("dup2");
-          exit(1);
-        }
-        close(pipe_file_descriptors[num_pipes-1][1]);
-        for (j = 0; j < num_pipes-1; j++) {
-          close(pipe_file_descriptors[j][0]);
-          close(pipe_file_descriptors[j][1]);
-        }
+      signals_reset_in_child();
+      if (options->cgroup_procs_fd >= 0 && write(options->cgroup_procs_fd, "0", 1) != 1) {
+        perror("cgroup.procs");
       }
-      else {
-        /* Middle command: input from previous pipe, output to next pipe */
-        if (dup2(pipe_file_descriptors[cmd_index-1][0], STDIN_FILENO) < 0 || 
-            dup2(pipe_file_descriptors[cmd_index][1], STDOUT_FILENO) < 0) {
-          perror("dup2");
-          exit(1);
-        }
-        for (j = 0; j < num_pipes; j++) {
-          if (j == cmd_index-1) {
-            close(pipe_file_descriptors[j][1]);
-          }
-          else if (j == cmd_index) {
-            close(pipe_file_descriptors[j][0]);
-          }
-          else {
-            close(pipe_file_descriptors[j][0]);
-            close(pipe_file_descriptors[j][1]);
-          }
+      if (options->stdin_from_null && cmd_index == 0) {
+        null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd >= 0) {
+          dup2(null_fd, STDIN_FILENO);
+          close(null_fd);
         }
       }
+      /* Input from the previous pipe, output to the next one */
+      if ((cmd_index > 0 && dup2(pipe_file_descriptors[cmd_index-1][0], STDIN_FILENO) < 0) ||
+          (cmd_index < num_pipes && dup2(pipe_file_descriptors[cmd_index][1], STDOUT_FILENO) < 0)) {
+        perror("dup2");
+        _exit(1);
+      }
+      /*
+       * Every other pipe end and the shell's own descriptors go at
+       * once; the close-on-exec flag alone would not do, as utility
+       * stages never exec
+       */
+      close_descriptors_in_child();
       
+      sched_set_process_index(cmd_index);
+      if (process_stages[cmd_index][1] > 1) {
+        fusion_run(&commands_by_pipe[process_stages[cmd_index][0]], process_stages[cmd_index][1]);
+      }
       /* Execute the command with its own I/O redirection */
-      execute_single_command(commands_by_pipe[cmd_index]);
+      execute_single_command(stage_commands, resolved_path);
       /* If we get here, execution failed */
-      exit(1);
+      _exit(1);
     }
     else if (process_ids[cmd_index] < 0) {
       perror("fork");
-      return;
+      pipe_command_count = cmd_index;
+      break;
+    }
+    stats_add(COUNTER_FORKS, 1);
+    if (fork_start != 0) {
+      trace_span("fork", process_ids[cmd_index], fork_start, stage_commands[0]);
+    }
+    /* Parent: set the group too, so it exists before any stage runs */
+    if (options->process_group >= 0) {
+      if (options->process_group == 0) {
+        options->process_group = process_ids[0];
+      }
+      setpgid(process_ids[cmd_index], options->process_group);
     }
   }
   
   /* Parent process: close all pipe ends */
   for (pipe_index = 0; pipe_index < num_pipes; pipe_index++) {
+    if (pipe_index < pipe_command_count) {
+      trace_watch_first_output(pipe_file_descriptors[pipe_index][0], process_ids[pipe_index]);
+    }
     close(pipe_file_descriptors[pipe_index][0]);
     close(pipe_file_descriptors[pipe_index][1]);
   }
+  if (cwd_fd >= 0) {
+    close(cwd_fd);
+  }
+  free(commands_by_pipe);
+  free(process_stages);
+  free(pipe_file_descriptors);
   
-  /* Wait for all child processes */
-  for (proc_index = 0; proc_index < pipe_command_count; proc_index++) {
-    waitpid(process_ids[proc_index], NULL, 0);
+  if (pipe_command_count == 0) {
+    free(process_ids);
+    return -1;
   }
+  *stage_pids = process_ids;
+  return pipe_command_count;
 }
 
 /**
- * Signal handler for SIGINT (Ctrl+C)
- * Kills the foreground process but keeps the shell running
- * @param signal_number Signal number (SIGINT)
+ * Execute command with arguments and wait for it, in the caller's
+ * process group. Used where no job control applies, such as inside a
+ * command substitution subshell.
+ * @param command_arguments Command and arguments array
+ * @return waitpid() status of the last stage, or -1 on error
  */
-void handle_interrupt_signal(int signal_number) { 
-  if (foreground_process_id != -1) {
-    kill(foreground_process_id, SIGINT);
+int execute_command_with_pipes_and_redirection(char* command_arguments[]) {
+  spawn_options options = { -1, false, false, -1 };
+  pid_t* process_ids;
+  int stage_count, proc_index;
+  int status = -1;
+
+  stage_count = spawn_pipeline(command_arguments, &options, &process_ids);
+  
+  /* Wait for all child processes */
+  for (proc_index = 0; proc_index < stage_count; proc_index++) {
+    while (waitpid(process_ids[proc_index], &status, 0) < 0 && errno == EINTR) {
+    }
+    if (trace_enabled()) {
+      trace_instant("reap", process_ids[proc_index], NULL);
+    }
+  }
+  if (stage_count > 0) {
+    free(process_ids);
   }
-}
\ No newline at end of file
+  return status;
+}
@@ -0,0 +1,297 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Shared declarations for the shell2 modules.
+ */
+
+#ifndef SHELL2_H
+#define SHELL2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <termios.h>
+
+#define MAX_INPUT_LENGTH 1024
+#define WORKING_DIR_BUFFER_SIZE 400
+#define TIMEOUT_SECONDS 10
+
+/**
+ * Bump allocator for strings that live as long as one command line.
+ * Everything is released at once by string_arena_reset().
+ */
+typedef struct string_arena_block {
+  struct string_arena_block* next;
+  size_t used;
+  size_t size;
+  char data[];
+} string_arena_block;
+
+typedef struct {
+  string_arena_block* head;
+} string_arena;
+
+void* string_arena_alloc(string_arena* arena, size_t length);
+char* string_arena_strndup(string_arena* arena, const char* text, size_t length);
+char* string_arena_strdup(string_arena* arena, const char* text);
+void string_arena_reset(string_arena* arena);
+
+/**
+ * Growable, always NULL-terminated argument list.
+ * items can be handed directly to execvp().
+ */
+typedef struct {
+  char** items;
+  size_t count;
+  size_t capacity;
+} argument_vector;
+
+void argument_vector_push(argument_vector* vector, char* argument);
+void argument_vector_clear(argument_vector* vector);
+
+/* Built-in commands (builtins.c) */
+typedef struct {
+  FILE* output;
+} builtin_streams;
+
+typedef int (*builtin_function)(char* args[], builtin_streams* streams);
+
+typedef struct {
+  const char* name;
+  builtin_function function;
+  bool in_process; /* safe to run unforked inside $(...) */
+} builtin_command;
+
+const builtin_command* find_builtin(const char* name);
+const builtin_command* builtins_all(void);
+
+/* Word splitting, quoting and command substitution (expansion.c) */
+bool expand_words(const char* line, argument_vector* output, string_arena* arena);
+char* capture_command_output(const char* command_text, string_arena* arena);
+
+/* Shell variables and the exec environment (variables.c) */
+void variables_initialize(char** environment);
+bool variable_name_is_valid(const char* name, size_t length);
+const char* variable_get(const char* name);
+bool variable_set(const char* name, const char* value, bool export);
+bool variable_set_exported(const char* name, bool export);
+bool variable_unset(const char* name);
+size_t variable_assignment_name_length(const char* word);
+void variable_assign_word(const char* word, bool export);
+void variables_for_each(void (*visit)(const char* text, bool exported, void* context), void* context);
+char** variables_environment(void);
+char** variables_environment_with(char** assignments, size_t count);
+unsigned long variables_path_generation(void);
+void variables_replace_environment(char** environment);
+
+/* Arithmetic expansion (arithmetic.c) */
+bool arithmetic_evaluate(const char* expression, long long* result);
+
+/* Signal handling (signals.c) */
+void signals_initialize(void);
+void signals_reset_in_child(void);
+void signals_discard_pending(void);
+void signals_ignore_job_control(void);
+int signals_get_fd(void);
+
+/* Event loop over epoll (events.c) */
+typedef struct event_source {
+  int fd;
+  void (*handle)(struct event_source* source, unsigned int events);
+  void* context;
+} event_source;
+
+void events_initialize(void);
+bool events_add(event_source* source);
+void events_remove(event_source* source);
+void events_dispatch(int timeout_ms);
+void events_wait_for_input(int fd, void (*idle)(void));
+int events_open_pidfd(pid_t pid);
+
+/* Script input and deferred stdout, optionally over io_uring (io_core.c) */
+int io_core_read_line(char* buffer, size_t size);
+void io_core_flush(void);
+
+/* Interactive input (line_editor.c, history.c) */
+bool line_editor_read(const char* prompt, char* buffer, size_t size, bool (*report)(void));
+bool history_get(size_t age, const char** text, size_t* length);
+size_t history_search(const char* query, size_t age);
+void history_add(const char* line);
+size_t completion_candidates(const char* line, size_t cursor, size_t* word_start,
+                             argument_vector* output, string_arena* arena);
+
+/* Shell options set with "set -o" (options.c) */
+typedef enum {
+  OPTION_CGROUP,
+  OPTION_CGROUP_MEMORY_MAX,
+  OPTION_CGROUP_CPU_MAX,
+  OPTION_TRACE,
+  OPTION_STATS,
+  OPTION_ZYGOTE,
+  OPTION_URING,
+  OPTION_UTILITIES,
+  OPTION_FUSION,
+  OPTION_CPUS,
+  OPTION_NICE,
+  OPTION_IONICE,
+  OPTION_SCHED_BATCH,
+  OPTION_FDCHECK,
+  OPTION_PATH_CACHE,
+  OPTION_COUNT
+} shell_option;
+
+bool option_enabled(shell_option option);
+const char* option_value(shell_option option);
+bool options_set(const char* spec, bool enable);
+void options_print(FILE* output);
+
+/* ulimit settings and per-job cgroups (limits.c) */
+rlim_t limits_get(int resource, bool hard);
+bool limits_set(int resource, rlim_t value, bool soft, bool hard);
+bool limits_pending(void);
+void limits_apply_in_child(void);
+char* cgroup_create_job(int job_id, int* procs_fd);
+void cgroup_finish_job(const char* leaf, int job_id);
+
+/* CPU affinity, nice, ionice and SCHED_BATCH for commands (sched.c) */
+bool sched_pending(void);
+void sched_set_process_index(int index);
+void sched_apply_in_child(char* args[]);
+
+/* Chrome trace-event timeline (trace.c) */
+long long trace_now(void);
+bool trace_update(void);
+bool trace_enabled(void);
+int trace_descriptor(void);
+void trace_span(const char* name, pid_t tid, long long start, const char* detail);
+void trace_instant(const char* name, pid_t tid, const char* detail);
+void trace_watch_first_output(int pipe_read_fd, pid_t writer);
+
+/* Internal counters shown by shstats (stats.c) */
+typedef enum {
+  COUNTER_FORKS,
+  COUNTER_EXECS,
+  COUNTER_EXEC_FAILURES,
+  COUNTER_PATH_CACHE_HITS,
+  COUNTER_PATH_CACHE_MISSES,
+  COUNTER_STDIN_BYTES,
+  COUNTER_TIMEOUTS,
+  COUNTER_SIGNALS,
+  COUNTER_PEAK_OPEN_FDS,
+  COUNTER_ZYGOTE_SPAWNS,
+  COUNTER_URING_SUBMISSIONS,
+  COUNTER_UTILITY_RUNS,
+  COUNTER_FUSED_STAGES,
+  COUNTER_LEAKED_FDS,
+  COUNTER_COUNT
+} shell_counter;
+
+void stats_initialize(void);
+void stats_add(shell_counter counter, unsigned long amount);
+void stats_sample_descriptors(void);
+void stats_note_descriptor(int highest_fd);
+void stats_check_descriptors(const char* command, bool exec_follows);
+void stats_reset(void);
+void stats_print(FILE* output);
+
+/* cat, grep, head, sort, tail and wc without an exec, for "set -o utilities"
+   (utilities.c, grep.c, sort.c) */
+#define UTILITY_UNSUPPORTED -1 /* returned before any I/O: exec the real program */
+
+/* With check_only, a utility only parses args: 0 if it handles them */
+typedef int (*utility_function)(char* args[], bool check_only);
+
+utility_function find_utility(const char* name);
+bool utility_write_all(int fd, const char* buffer, size_t length);
+ssize_t utility_read(int fd, char* buffer, size_t size);
+int utility_open_operand(const char* utility, const char* path);
+void utility_close_operand(int fd);
+bool utility_regular_file(int fd, struct stat* file_status);
+int utility_grep(char* args[], bool check_only);
+int utility_sort(char* args[], bool check_only);
+
+/* Adjacent utility stages as threads joined by ring buffers (fusion.c) */
+typedef struct fusion_ring fusion_ring;
+
+bool fusion_stage_fusable(char* args[]);
+void fusion_run(char** stages[], int stage_count);
+fusion_ring* fusion_ring_for(int fd);
+ssize_t fusion_ring_read(fusion_ring* ring, char* buffer, size_t size);
+bool fusion_ring_write(fusion_ring* ring, const char* data, size_t length);
+
+/* Command name to full path, cached until PATH changes; "set -o pathcache" (path_cache.c) */
+const char* path_cache_lookup(const char* name);
+
+/* Job control (jobs.c) */
+typedef enum {
+  PROCESS_RUNNING,
+  PROCESS_STOPPED,
+  PROCESS_DONE
+} process_state;
+
+typedef struct {
+  pid_t pid;
+  process_state state;
+  int status;           /* waitpid() status once done */
+  event_source exit_event; /* pidfd, -1 once reaped or if unavailable */
+} job_process;
+
+typedef struct {
+  int id;
+  pid_t pgid;
+  job_process* processes;
+  int process_count;
+  char* command_text;
+  bool notified;        /* "Stopped" already reported */
+  bool has_terminal_modes;
+  struct termios terminal_modes;
+  char* cgroup_path;    /* cgroup v2 leaf, NULL unless "set -o cgroup" */
+  long long trace_start; /* launch time, when tracing */
+} job;
+
+void jobs_initialize(bool job_control);
+bool jobs_interactive(void);
+job* jobs_launch(char* command_arguments[], const char* command_text, bool background);
+int jobs_wait_foreground(job* j, int timeout_seconds);
+int jobs_continue(job* j, bool foreground);
+job* jobs_find(const char* spec);
+bool jobs_notify(void);
+void jobs_print(FILE* output);
+
+/* Command execution (shell2.c) */
+typedef struct {
+  pid_t process_group;  /* -1: caller's group; 0: new group led by the first stage */
+  bool take_terminal;   /* make the new group the terminal's foreground group */
+  bool stdin_from_null; /* background job without job control */
+  int cgroup_procs_fd;  /* each stage joins this cgroup.procs, -1 for none */
+} spawn_options;
+
+int run_command_line(char* line);
+void execute_single_command(char* args[], const char* resolved_path);
+int spawn_pipeline(char* command_arguments[], spawn_options* options, pid_t** stage_pids);
+int execute_command_with_pipes_and_redirection(char* command_arguments[]);
+
+/* Command server on a Unix socket (server.c) */
+int server_run(const char* socket_path);
+int server_client(const char* socket_path, const char* command);
+bool server_serving(void);
+
+/* Pre-forked helper that starts pipeline stages (zygote.c) */
+void close_descriptor_range(unsigned int first, unsigned int last);
+void close_descriptors_in_child(void);
+bool zygote_start(void);
+bool zygote_usable(void);
+pid_t zygote_spawn(char* arguments[], const char* resolved_path, int stdin_fd, int stdout_fd,
+                   int cwd_fd, spawn_options* options);
+
+/* Pathname expansion (glob_expand.c) */
+bool glob_has_magic(const char* pattern);
+size_t glob_expand_pattern(const char* pattern, argument_vector* output, string_arena* arena);
+void glob_cache_reset(void);
+void sort_strings(char** strings, size_t count);
+
+#endif
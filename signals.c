@@ -0,0 +1,102 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Signal handling.
+ *
+ * The shell blocks SIGINT and SIGCHLD and reads them from a signalfd
+ * instead of running asynchronous handlers, so there is no shared
+ * state to race on. The descriptor is part of the event loop (events.c)
+ * and read by the job code (jobs.c).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/signalfd.h>
+#include "shell2.h"
+
+static sigset_t original_signal_mask;
+static int signal_fd = -1;
+
+/**
+ * Block the signals the shell handles and open the signalfd for them.
+ * Must run before the first fork.
+ */
+void signals_initialize(void) {
+  sigset_t handled;
+
+  sigemptyset(&handled);
+  sigaddset(&handled, SIGINT);
+  sigaddset(&handled, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &handled, &original_signal_mask) < 0) {
+    perror("sigprocmask");
+    exit(1);
+  }
+  signal_fd = signalfd(-1, &handled, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd < 0) {
+    perror("signalfd");
+    exit(1);
+  }
+}
+
+/**
+ * Undo the shell's signal setup in a freshly forked child, so the
+ * command it execs sees default dispositions and an unblocked mask
+ */
+void signals_reset_in_child(void) {
+  struct sigaction default_action;
+
+  memset(&default_action, 0, sizeof(default_action));
+  default_action.sa_handler = SIG_DFL;
+  sigaction(SIGINT, &default_action, NULL);
+  sigaction(SIGCHLD, &default_action, NULL);
+  sigaction(SIGTSTP, &default_action, NULL);
+  sigaction(SIGTTIN, &default_action, NULL);
+  sigaction(SIGTTOU, &default_action, NULL);
+  sigaction(SIGPIPE, &default_action, NULL);
+  sigprocmask(SIG_SETMASK, &original_signal_mask, NULL);
+  if (signal_fd >= 0) {
+    close(signal_fd);
+    signal_fd = -1;
+  }
+}
+
+/**
+ * Discard a Ctrl+C typed while no command was running, so it does not
+ * hit the next command. SIGCHLD stays queued for the job table.
+ */
+void signals_discard_pending(void) {
+  struct timespec no_wait = { 0, 0 };
+  sigset_t interrupt;
+
+  sigemptyset(&interrupt);
+  sigaddset(&interrupt, SIGINT);
+  while (sigtimedwait(&interrupt, NULL, &no_wait) == SIGINT) {
+  }
+}
+
+/**
+ * File descriptor that becomes readable when SIGINT or SIGCHLD arrives
+ */
+int signals_get_fd(void) {
+  return signal_fd;
+}
+
+/**
+ * Ignore the job control signals in an interactive shell, so Ctrl+Z
+ * and terminal access checks only affect the jobs it runs
+ */
+void signals_ignore_job_control(void) {
+  struct sigaction ignore_action;
+
+  memset(&ignore_action, 0, sizeof(ignore_action));
+  ignore_action.sa_handler = SIG_IGN;
+  sigaction(SIGTSTP, &ignore_action, NULL);
+  sigaction(SIGTTIN, &ignore_action, NULL);
+  sigaction(SIGTTOU, &ignore_action, NULL);
+}
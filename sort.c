@@ -0,0 +1,849 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * In-process sort for "set -o utilities", for inputs of any size.
+ *
+ * Lines are never copied into records: a record is the line's address
+ * and length plus its first 8 bytes as a big-endian number. Records are
+ * radix sorted on those 8 bytes, most significant first, and only lines
+ * that share all 8 are compared in full. Regular files are mapped, so
+ * their records point straight into the page cache; streams are read
+ * into chunks of 1 MiB or more.
+ *
+ * The records are cut into one slice per thread (--parallel=N, by
+ * default one per CPU this process may run on), the slices are sorted
+ * at the same time and then merged while writing. When the stream
+ * chunks and the record table outgrow the memory budget (-S SIZE,
+ * 256 MiB by default) they are sorted the same way into a run: an
+ * unlinked file in TMPDIR (or -T DIR). The runs are merged at the end,
+ * at most SORT_MAX_FAN_IN at a time.
+ *
+ * Lines compare byte by byte, as in the C locale, so under any other
+ * LC_ALL, LC_COLLATE or LANG the real sort is used. Options: -r, -u,
+ * -S, -T and --parallel; anything else also goes to the real sort.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell2.h"
+
+#define SORT_CHUNK_SIZE (1024 * 1024)
+#define SORT_DEFAULT_BUDGET (256ULL * 1024 * 1024)
+#define SORT_OUTPUT_SIZE (128 * 1024)
+#define SORT_RUN_BUFFER_SIZE (64 * 1024)
+#define SORT_MAX_FAN_IN 64
+#define SORT_MAX_THREADS 64
+#define SORT_RECORDS_PER_THREAD 16384 /* fewer records than this sort on one thread */
+#define SORT_INSERTION_LIMIT 32       /* radix buckets smaller than this use insertion sort */
+
+typedef struct {
+  uint64_t prefix;      /* first 8 bytes, big-endian, zero-padded */
+  const char* text;     /* not NUL-terminated, no newline */
+  size_t length;
+} sort_record;
+
+typedef struct sort_chunk {
+  struct sort_chunk* next;
+  char data[];
+} sort_chunk;
+
+/* A sorted run on disk, read back one line at a time */
+typedef struct {
+  int fd;
+  char* buffer;
+  size_t capacity;
+  size_t start;
+  size_t end;
+  bool at_end_of_file;
+} run_reader;
+
+/* One input of a merge: a sorted slice in memory or a run */
+typedef struct {
+  sort_record current;
+  sort_record* next;
+  sort_record* end;
+  run_reader* reader;
+} merge_source;
+
+typedef struct {
+  int fd;
+  char buffer[SORT_OUTPUT_SIZE];
+  size_t used;
+  bool failed;
+  char* last;           /* previous line, kept for -u */
+  size_t last_length;
+  size_t last_capacity;
+  bool has_last;
+} sort_writer;
+
+typedef struct sort_job sort_job;
+
+typedef struct {
+  sort_job* job;
+  sort_record* records;
+  size_t count;
+} sort_slice;
+
+struct sort_job {
+  bool reverse;
+  bool unique;
+  unsigned long long budget;
+  long threads;
+  const char* temp_directory;
+
+  /* Records gathered for the next run, and the stream chunks they point into */
+  sort_record* records;
+  size_t record_count;
+  size_t record_capacity;
+  sort_chunk* chunks;
+  unsigned long long chunk_bytes;
+
+  int* runs;
+  size_t run_count;
+  size_t run_capacity;
+
+  sort_writer writer;   /* standard output, and each run while it is written */
+};
+
+static uint64_t record_prefix(const char* text, size_t length) {
+  unsigned char bytes[8] = { 0 };
+
+  memcpy(bytes, text, length < 8 ? length : 8);
+  return ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) | ((uint64_t)bytes[2] << 40) |
+         ((uint64_t)bytes[3] << 32) | ((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+         ((uint64_t)bytes[6] << 8) | (uint64_t)bytes[7];
+}
+
+static int compare_records(const sort_record* left, const sort_record* right, bool reverse) {
+  size_t shorter = left->length < right->length ? left->length : right->length;
+  int result;
+
+  if (left->prefix != right->prefix) {
+    result = left->prefix < right->prefix ? -1 : 1;
+  } else if (shorter > 8 && (result = memcmp(left->text + 8, right->text + 8, shorter - 8)) != 0) {
+    result = result < 0 ? -1 : 1;
+  } else {
+    result = (left->length > right->length) - (left->length < right->length);
+  }
+  return reverse ? -result : result;
+}
+
+static int qsort_records(const void* left, const void* right) {
+  return compare_records(left, right, false);
+}
+
+static void insertion_sort(sort_record* records, size_t count) {
+  sort_record moving;
+  size_t i, j;
+
+  for (i = 1; i < count; i++) {
+    moving = records[i];
+    for (j = i; j > 0 && compare_records(&moving, &records[j - 1], false) < 0; j--) {
+      records[j] = records[j - 1];
+    }
+    records[j] = moving;
+  }
+}
+
+/**
+ * Sort records in place by their prefix, one byte per level (most
+ * significant first), then by their whole text where prefixes tie
+ * @param level Prefix byte to bucket by, 0 to 7
+ */
+static void radix_sort(sort_record* records, size_t count, int level) {
+  size_t bucket_start[256], bucket_end[256];
+  size_t counts[256] = { 0 };
+  int shift = 56 - 8 * level;
+  sort_record moving, displaced;
+  size_t i, offset = 0;
+  unsigned int bucket;
+
+  if (count < SORT_INSERTION_LIMIT) {
+    insertion_sort(records, count);
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    counts[(records[i].prefix >> shift) & 0xff]++;
+  }
+  for (bucket = 0; bucket < 256; bucket++) {
+    bucket_start[bucket] = offset;
+    offset += counts[bucket];
+    bucket_end[bucket] = offset;
+  }
+  /* Move each record straight to its bucket, one cycle at a time */
+  for (bucket = 0; bucket < 256; bucket++) {
+    while (bucket_start[bucket] < bucket_end[bucket]) {
+      moving = records[bucket_start[bucket]];
+      while ((unsigned int)((moving.prefix >> shift) & 0xff) != bucket) {
+        i = bucket_start[(moving.prefix >> shift) & 0xff]++;
+        displaced = records[i];
+        records[i] = moving;
+        moving = displaced;
+      }
+      records[bucket_start[bucket]++] = moving;
+    }
+  }
+  for (offset = 0, bucket = 0; bucket < 256; offset += counts[bucket], bucket++) {
+    if (counts[bucket] < 2) {
+      continue;
+    }
+    if (level < 7) {
+      radix_sort(records + offset, counts[bucket], level + 1);
+    } else {
+      /* The whole prefix ties: the rest of the text decides */
+      qsort(records + offset, counts[bucket], sizeof(sort_record), qsort_records);
+    }
+  }
+}
+
+static void* sort_slice_thread(void* argument) {
+  sort_slice* slice = argument;
+  sort_record swap;
+  size_t i;
+
+  radix_sort(slice->records, slice->count, 0);
+  if (slice->job->reverse) {
+    for (i = 0; i < slice->count / 2; i++) {
+      swap = slice->records[i];
+      slice->records[i] = slice->records[slice->count - 1 - i];
+      slice->records[slice->count - 1 - i] = swap;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Sort the records in up to job->threads slices at once
+ * @param slices Receives the sorted slices
+ * @return Number of slices
+ */
+static size_t sort_in_slices(sort_job* job, sort_slice* slices) {
+  pthread_t threads[SORT_MAX_THREADS];
+  bool started[SORT_MAX_THREADS];
+  size_t slice_count, i, offset = 0;
+
+  slice_count = job->record_count / SORT_RECORDS_PER_THREAD;
+  if (slice_count > (size_t)job->threads) {
+    slice_count = job->threads;
+  }
+  if (slice_count == 0) {
+    slice_count = 1;
+  }
+  for (i = 0; i < slice_count; i++) {
+    slices[i].job = job;
+    slices[i].records = job->records + offset;
+    slices[i].count = job->record_count / slice_count + (i < job->record_count % slice_count ? 1 : 0);
+    offset += slices[i].count;
+  }
+  /* Slice 0 is sorted on this thread, as is any slice whose thread did not start */
+  for (i = 1; i < slice_count; i++) {
+    started[i] = pthread_create(&threads[i], NULL, sort_slice_thread, &slices[i]) == 0;
+  }
+  sort_slice_thread(&slices[0]);
+  for (i = 1; i < slice_count; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      sort_slice_thread(&slices[i]);
+    }
+  }
+  return slice_count;
+}
+
+static void writer_start(sort_writer* writer, int fd) {
+  writer->fd = fd;
+  writer->used = 0;
+  writer->failed = false;
+  writer->has_last = false;
+}
+
+static bool writer_flush(sort_writer* writer) {
+  if (!writer->failed && writer->used > 0 && !utility_write_all(writer->fd, writer->buffer, writer->used)) {
+    writer->failed = true;
+  }
+  writer->used = 0;
+  return !writer->failed;
+}
+
+static void writer_put(sort_writer* writer, const char* data, size_t length) {
+  if (writer->used + length > sizeof(writer->buffer)) {
+    writer_flush(writer);
+  }
+  if (length >= sizeof(writer->buffer)) {
+    if (!writer->failed && !utility_write_all(writer->fd, data, length)) {
+      writer->failed = true;
+    }
+    return;
+  }
+  memcpy(writer->buffer + writer->used, data, length);
+  writer->used += length;
+}
+
+/**
+ * Write one line and its newline; with -u, skip it if it repeats the last
+ */
+static void writer_line(sort_job* job, sort_writer* writer, const sort_record* record) {
+  char* grown;
+
+  if (job->unique) {
+    if (writer->has_last && writer->last_length == record->length &&
+        memcmp(writer->last, record->text, record->length) == 0) {
+      return;
+    }
+    if (record->length > writer->last_capacity) {
+      grown = realloc(writer->last, record->length);
+      if (grown == NULL) {
+        perror("realloc");
+        writer->failed = true;
+        return;
+      }
+      writer->last = grown;
+      writer->last_capacity = record->length;
+    }
+    memcpy(writer->last, record->text, record->length);
+    writer->last_length = record->length;
+    writer->has_last = true;
+  }
+  writer_put(writer, record->text, record->length);
+  writer_put(writer, "\n", 1);
+}
+
+/**
+ * Next line of a run
+ * @return false at the end of the run or on a read error
+ */
+static bool run_read_line(run_reader* reader, sort_record* record) {
+  char* newline;
+  char* grown;
+  ssize_t count;
+
+  while ((newline = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start)) == NULL) {
+    /* Runs end in a newline, so nothing is left at the end of the file */
+    if (reader->at_end_of_file) {
+      return false;
+    }
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    if (reader->end == reader->capacity) {
+      grown = realloc(reader->buffer, reader->capacity * 2);
+      if (grown == NULL) {
+        perror("realloc");
+        return false;
+      }
+      reader->buffer = grown;
+      reader->capacity *= 2;
+    }
+    count = utility_read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end);
+    if (count < 0) {
+      perror("sort: read");
+      return false;
+    }
+    reader->at_end_of_file = count == 0;
+    reader->end += count;
+  }
+  record->text = reader->buffer + reader->start;
+  record->length = newline - record->text;
+  record->prefix = record_prefix(record->text, record->length);
+  reader->start = newline + 1 - reader->buffer;
+  return true;
+}
+
+static bool source_advance(merge_source* source) {
+  if (source->reader != NULL) {
+    return run_read_line(source->reader, &source->current);
+  }
+  if (source->next == source->end) {
+    return false;
+  }
+  source->current = *source->next++;
+  return true;
+}
+
+/**
+ * Restore the heap order below position; the smallest line is on top
+ */
+static void heap_sift_down(sort_job* job, merge_source** heap, size_t count, size_t position) {
+  merge_source* moving = heap[position];
+  size_t child;
+
+  while ((child = position * 2 + 1) < count) {
+    if (child + 1 < count && compare_records(&heap[child + 1]->current, &heap[child]->current, job->reverse) < 0) {
+      child++;
+    }
+    if (compare_records(&heap[child]->current, &moving->current, job->reverse) >= 0) {
+      break;
+    }
+    heap[position] = heap[child];
+    position = child;
+  }
+  heap[position] = moving;
+}
+
+/**
+ * Merge sorted sources (at most SORT_MAX_FAN_IN) into a writer
+ */
+static void merge_sources(sort_job* job, merge_source* sources, size_t source_count, sort_writer* writer) {
+  merge_source* heap[SORT_MAX_FAN_IN];
+  size_t count = 0, i;
+
+  for (i = 0; i < source_count; i++) {
+    if (source_advance(&sources[i])) {
+      heap[count++] = &sources[i];
+    }
+  }
+  for (i = count; i-- > 0; ) {
+    heap_sift_down(job, heap, count, i);
+  }
+  while (count > 0 && !writer->failed) {
+    writer_line(job, writer, &heap[0]->current);
+    if (!source_advance(heap[0])) {
+      heap[0] = heap[--count];
+    }
+    if (count > 0) {
+      heap_sift_down(job, heap, count, 0);
+    }
+  }
+}
+
+/**
+ * Sort the gathered records and write them out
+ */
+static void write_sorted_records(sort_job* job) {
+  sort_slice slices[SORT_MAX_THREADS];
+  merge_source sources[SORT_MAX_THREADS];
+  size_t slice_count, i;
+
+  slice_count = sort_in_slices(job, slices);
+  for (i = 0; i < slice_count; i++) {
+    sources[i].next = slices[i].records;
+    sources[i].end = slices[i].records + slices[i].count;
+    sources[i].reader = NULL;
+  }
+  merge_sources(job, sources, slice_count, &job->writer);
+}
+
+/**
+ * Open an unlinked temporary file for a run
+ * @return Descriptor, or -1 after reporting the error
+ */
+static int open_run_file(sort_job* job) {
+  char path[PATH_MAX];
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/shell2-sortXXXXXX", job->temp_directory);
+  fd = mkostemp(path, O_CLOEXEC);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  unlink(path);
+  return fd;
+}
+
+/**
+ * Rewind a finished run and add it to the list
+ */
+static bool add_run(sort_job* job, int fd) {
+  int* grown;
+
+  if (!writer_flush(&job->writer) || lseek(fd, 0, SEEK_SET) < 0) {
+    perror("sort: temporary file");
+    close(fd);
+    return false;
+  }
+  if (job->run_count == job->run_capacity) {
+    job->run_capacity = job->run_capacity > 0 ? job->run_capacity * 2 : 16;
+    grown = realloc(job->runs, job->run_capacity * sizeof(int));
+    if (grown == NULL) {
+      perror("realloc");
+      close(fd);
+      return false;
+    }
+    job->runs = grown;
+  }
+  job->runs[job->run_count++] = fd;
+  return true;
+}
+
+/**
+ * Sort what has been gathered into a run on disk and free the chunks
+ */
+static bool spill_run(sort_job* job) {
+  sort_chunk* chunk;
+  int fd;
+
+  fd = open_run_file(job);
+  if (fd < 0) {
+    return false;
+  }
+  writer_start(&job->writer, fd);
+  write_sorted_records(job);
+  if (!add_run(job, fd)) {
+    return false;
+  }
+  job->record_count = 0;
+  while (job->chunks != NULL) {
+    chunk = job->chunks;
+    job->chunks = chunk->next;
+    free(chunk);
+  }
+  job->chunk_bytes = 0;
+  return true;
+}
+
+static bool over_budget(sort_job* job) {
+  return job->record_count > 0 &&
+         job->chunk_bytes + job->record_capacity * sizeof(sort_record) > job->budget;
+}
+
+static bool add_record(sort_job* job, const char* text, size_t length) {
+  sort_record* grown;
+
+  if (job->record_count == job->record_capacity) {
+    if (over_budget(job) && !spill_run(job)) {
+      return false;
+    }
+    if (job->record_count == job->record_capacity) {
+      job->record_capacity = job->record_capacity > 0 ? job->record_capacity * 2 : 4096;
+      grown = realloc(job->records, job->record_capacity * sizeof(sort_record));
+      if (grown == NULL) {
+        perror("realloc");
+        return false;
+      }
+      job->records = grown;
+    }
+  }
+  job->records[job->record_count].prefix = record_prefix(text, length);
+  job->records[job->record_count].text = text;
+  job->records[job->record_count].length = length;
+  job->record_count++;
+  return true;
+}
+
+/**
+ * Add a record for each whole line of text
+ * @param at_end Also take a last line that has no newline
+ * @return Bytes used, or -1 on an error
+ */
+static ssize_t add_lines(sort_job* job, const char* text, size_t length, bool at_end) {
+  const char* start = text;
+  const char* end = text + length;
+  const char* newline;
+
+  while ((newline = memchr(start, '\n', end - start)) != NULL) {
+    if (!add_record(job, start, newline - start)) {
+      return -1;
+    }
+    start = newline + 1;
+  }
+  if (at_end && start < end) {
+    if (!add_record(job, start, end - start)) {
+      return -1;
+    }
+    start = end;
+  }
+  return start - text;
+}
+
+/**
+ * Gather the lines of one input. A regular file is mapped and stays
+ * mapped. A stream is read into a chunk; when the chunk is full it is
+ * put on job->chunks, for the next spill to free, and its unfinished
+ * last line moves to a new chunk.
+ * @param name Operand the input came from, for error messages
+ */
+static bool gather_input(sort_job* job, int fd, const char* name) {
+  struct stat file_status;
+  const char* mapping;
+  sort_chunk* chunk = NULL;
+  sort_chunk* fresh;
+  size_t capacity = 0, fresh_capacity, filled = 0, line_start = 0;
+  ssize_t count, used;
+
+  if (utility_regular_file(fd, &file_status) && file_status.st_size > 0) {
+    mapping = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      madvise((void*)mapping, file_status.st_size, MADV_WILLNEED);
+      return add_lines(job, mapping, file_status.st_size, true) >= 0;
+    }
+  }
+  while (true) {
+    if (filled == capacity) {
+      fresh_capacity = (filled - line_start) * 2 > SORT_CHUNK_SIZE ? (filled - line_start) * 2 : SORT_CHUNK_SIZE;
+      fresh = malloc(sizeof(sort_chunk) + fresh_capacity);
+      if (fresh == NULL) {
+        perror("malloc");
+        free(chunk);
+        return false;
+      }
+      if (chunk != NULL) {
+        memcpy(fresh->data, chunk->data + line_start, filled - line_start);
+        filled -= line_start;
+        if (line_start > 0) {
+          chunk->next = job->chunks;
+          job->chunks = chunk;
+          job->chunk_bytes += capacity;
+        } else {
+          /* Only part of one long line was in it, and that has moved */
+          free(chunk);
+        }
+      }
+      chunk = fresh;
+      capacity = fresh_capacity;
+      line_start = 0;
+      if (over_budget(job) && !spill_run(job)) {
+        free(chunk);
+        return false;
+      }
+    }
+    count = utility_read(fd, chunk->data + filled, capacity - filled);
+    if (count < 0) {
+      fprintf(stderr, "sort: read failed: %s: %s\n", name, strerror(errno));
+      free(chunk);
+      return false;
+    }
+    used = add_lines(job, chunk->data + line_start, filled + count - line_start, count == 0);
+    if (used < 0) {
+      free(chunk);
+      return false;
+    }
+    line_start += used;
+    filled += count;
+    if (count == 0) {
+      break;
+    }
+  }
+  /* The last chunk's records are still to be written */
+  chunk->next = job->chunks;
+  job->chunks = chunk;
+  job->chunk_bytes += capacity;
+  return true;
+}
+
+/**
+ * Merge runs into the writer and close them
+ */
+static void merge_runs(sort_job* job, int* fds, size_t count) {
+  merge_source sources[SORT_MAX_FAN_IN];
+  run_reader readers[SORT_MAX_FAN_IN];
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    readers[i].fd = fds[i];
+    readers[i].capacity = SORT_RUN_BUFFER_SIZE;
+    readers[i].buffer = malloc(SORT_RUN_BUFFER_SIZE);
+    readers[i].start = readers[i].end = 0;
+    readers[i].at_end_of_file = false;
+    sources[i].reader = &readers[i];
+    if (readers[i].buffer == NULL) {
+      perror("malloc");
+      job->writer.failed = true;
+      count = i;
+      break;
+    }
+  }
+  if (!job->writer.failed) {
+    merge_sources(job, sources, count, &job->writer);
+  }
+  for (i = 0; i < count; i++) {
+    free(readers[i].buffer);
+    close(fds[i]);
+  }
+}
+
+/**
+ * Write everything gathered, sorted, to standard output
+ */
+static bool write_result(sort_job* job) {
+  int fd;
+
+  if (job->run_count == 0) {
+    writer_start(&job->writer, STDOUT_FILENO);
+    write_sorted_records(job);
+    return writer_flush(&job->writer);
+  }
+  if (job->record_count > 0 && !spill_run(job)) {
+    return false;
+  }
+  /* Too many runs to open at once: merge the oldest into one more */
+  while (job->run_count > SORT_MAX_FAN_IN) {
+    fd = open_run_file(job);
+    if (fd < 0) {
+      return false;
+    }
+    writer_start(&job->writer, fd);
+    merge_runs(job, job->runs, SORT_MAX_FAN_IN);
+    memmove(job->runs, job->runs + SORT_MAX_FAN_IN, (job->run_count - SORT_MAX_FAN_IN) * sizeof(int));
+    job->run_count -= SORT_MAX_FAN_IN;
+    if (!add_run(job, fd)) {
+      return false;
+    }
+  }
+  writer_start(&job->writer, STDOUT_FILENO);
+  merge_runs(job, job->runs, job->run_count);
+  job->run_count = 0;
+  return writer_flush(&job->writer);
+}
+
+/**
+ * Parse -S SIZE: a number of KiB, or of bytes, KiB, MiB or GiB with b, K, M or G
+ * @return Bytes, or 0 if the size is not understood
+ */
+static unsigned long long parse_size(const char* text) {
+  unsigned long long size;
+  char* end;
+
+  if (text == NULL || *text < '0' || *text > '9') {
+    return 0;
+  }
+  size = strtoull(text, &end, 10);
+  switch (*end) {
+  case 'b': break;
+  case '\0':
+  case 'K': case 'k': size <<= 10; break;
+  case 'M': case 'm': size <<= 20; break;
+  case 'G': case 'g': size <<= 30; break;
+  default: return 0;
+  }
+  return *end == '\0' || end[1] == '\0' ? size : 0;
+}
+
+/**
+ * Check that lines are to be ordered by their bytes, as in the C locale
+ */
+static bool collation_is_bytewise(void) {
+  static const char* const names[] = { "LC_ALL", "LC_COLLATE", "LANG" };
+  const char* value;
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    value = variable_get(names[i]);
+    if (value != NULL && *value != '\0') {
+      return strcmp(value, "C") == 0 || strcmp(value, "POSIX") == 0 || strncmp(value, "C.", 2) == 0;
+    }
+  }
+  return true;
+}
+
+/**
+ * Parse the options
+ * @return Index of the first file operand, or -1 if the real sort is needed
+ */
+static int parse_sort_options(sort_job* job, char* args[]) {
+  const char* option;
+  cpu_set_t cpus;
+  int i;
+
+  job->budget = SORT_DEFAULT_BUDGET;
+  job->temp_directory = variable_get("TMPDIR");
+  if (job->temp_directory == NULL || *job->temp_directory == '\0') {
+    job->temp_directory = "/tmp";
+  }
+  job->threads = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : 1;
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      return i + 1;
+    }
+    if (strncmp(args[i], "--parallel=", 11) == 0) {
+      job->threads = atol(args[i] + 11);
+      if (job->threads <= 0) {
+        return -1;
+      }
+      continue;
+    }
+    for (option = args[i] + 1; *option != '\0'; option++) {
+      if (*option == 'r') {
+        job->reverse = true;
+      } else if (*option == 'u') {
+        job->unique = true;
+      } else if (*option == 'S') {
+        job->budget = parse_size(option[1] != '\0' ? option + 1 : args[++i]);
+        if (job->budget == 0) {
+          return -1;
+        }
+        break;
+      } else if (*option == 'T') {
+        job->temp_directory = option[1] != '\0' ? option + 1 : args[++i];
+        if (job->temp_directory == NULL) {
+          return -1;
+        }
+        break;
+      } else {
+        return -1;
+      }
+    }
+  }
+  if (job->threads > SORT_MAX_THREADS) {
+    job->threads = SORT_MAX_THREADS;
+  }
+  return i;
+}
+
+/**
+ * Free what the job allocated; mapped files stay mapped until exit
+ */
+static void free_sort_job(sort_job* job) {
+  sort_chunk* chunk;
+
+  while (job->chunks != NULL) {
+    chunk = job->chunks;
+    job->chunks = chunk->next;
+    free(chunk);
+  }
+  while (job->run_count > 0) {
+    close(job->runs[--job->run_count]);
+  }
+  free(job->records);
+  free(job->runs);
+  free(job->writer.last);
+}
+
+/**
+ * sort [-ru] [-S SIZE] [-T DIR] [--parallel=N] [FILE...]: sort lines
+ * @return 0, or 2 on an error
+ */
+int utility_sort(char* args[], bool check_only) {
+  char* standard_input[] = { "-", NULL };
+  sort_job job;
+  char** operands;
+  int first, fd;
+  bool ok = true;
+
+  memset(&job, 0, sizeof(job));
+  first = parse_sort_options(&job, args);
+  if (first < 0 || !collation_is_bytewise()) {
+    return UTILITY_UNSUPPORTED;
+  }
+  if (check_only) {
+    return 0;
+  }
+  /* Like the real sort, read everything before writing anything */
+  operands = args[first] != NULL ? args + first : standard_input;
+  for (; *operands != NULL && ok; operands++) {
+    /* Not utility_open_operand(): GNU sort words this message its own way */
+    fd = strcmp(*operands, "-") == 0 ? STDIN_FILENO : open(*operands, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "sort: cannot read: %s: %s\n", *operands, strerror(errno));
+      ok = false;
+      break;
+    }
+    ok = gather_input(&job, fd, *operands);
+    utility_close_operand(fd);
+  }
+  ok = ok && write_result(&job);
+  free_sort_job(&job);
+  return ok ? 0 : 2;
+}
@@ -0,0 +1,176 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Internal counters, printed by the shstats builtin and, with
+ * "set -o stats", when the shell exits.
+ *
+ * Counting is one relaxed atomic add on a MAP_SHARED page, so forked
+ * children can record their own exec attempts and failures and the
+ * shell still sees them. Peak open descriptors is a high-water mark on
+ * the descriptors the shell creates where it holds the most (a
+ * pipeline's pipes, a job's pidfds, a command substitution's pipe):
+ * one past the highest number, as the kernel hands out the lowest free
+ * one. That costs a comparison. With "set -o stats" or "set -o fdcheck",
+ * and when shstats runs, /proc/self/fd is also counted, so descriptors
+ * opened elsewhere show up too.
+ *
+ * "set -o fdcheck" makes every command check, before it runs, that it
+ * inherits no descriptor above stderr, and report any it does.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include "shell2.h"
+
+static const char* counter_names[COUNTER_COUNT] = {
+  [COUNTER_FORKS]             = "forks",
+  [COUNTER_EXECS]             = "execs",
+  [COUNTER_EXEC_FAILURES]     = "exec failures",
+  [COUNTER_PATH_CACHE_HITS]   = "PATH cache hits",
+  [COUNTER_PATH_CACHE_MISSES] = "PATH cache misses",
+  [COUNTER_STDIN_BYTES]       = "stdin bytes read",
+  [COUNTER_TIMEOUTS]          = "timeouts fired",
+  [COUNTER_SIGNALS]           = "signals delivered",
+  [COUNTER_PEAK_OPEN_FDS]     = "peak open fds",
+  [COUNTER_ZYGOTE_SPAWNS]     = "zygote spawns",
+  [COUNTER_URING_SUBMISSIONS] = "io_uring submits",
+  [COUNTER_UTILITY_RUNS]      = "utilities run",
+  [COUNTER_FUSED_STAGES]      = "fused stages",
+  [COUNTER_LEAKED_FDS]        = "fds leaked",
+};
+
+static unsigned long fallback_counters[COUNTER_COUNT];
+static unsigned long* counters = fallback_counters;
+static pid_t shell_pid;
+
+static void dump_at_exit(void) {
+  /* Subshells that leave through exit() must not print */
+  if (getpid() == shell_pid && option_enabled(OPTION_STATS)) {
+    stats_print(stderr);
+  }
+}
+
+/**
+ * Map the shared counter page and arrange the dump at exit. Without the
+ * mapping, counts made in children are lost but the shell's own still work.
+ */
+void stats_initialize(void) {
+  void* page = mmap(NULL, sizeof(fallback_counters), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (page == MAP_FAILED) {
+    perror("mmap");
+  } else {
+    counters = page;
+  }
+  shell_pid = getpid();
+  atexit(dump_at_exit);
+}
+
+void stats_add(shell_counter counter, unsigned long amount) {
+  __atomic_fetch_add(&counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count the shell's open descriptors in /proc/self/fd, for the peak
+ * open fds counter
+ */
+void stats_sample_descriptors(void) {
+  struct dirent* entry;
+  DIR* directory;
+  unsigned long open_count = 0;
+
+  directory = opendir("/proc/self/fd");
+  if (directory == NULL) {
+    return;
+  }
+  while ((entry = readdir(directory)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      open_count++;
+    }
+  }
+  closedir(directory);
+  /* Not the directory's own descriptor */
+  open_count--;
+  if (open_count > counters[COUNTER_PEAK_OPEN_FDS]) {
+    counters[COUNTER_PEAK_OPEN_FDS] = open_count;
+  }
+}
+
+/**
+ * Raise the peak open fds counter to cover a descriptor the shell
+ * created, and sample /proc/self/fd when stats or fdcheck is on
+ * @param highest_fd Highest descriptor just created, or -1 for none
+ */
+void stats_note_descriptor(int highest_fd) {
+  if (highest_fd >= 0 && (unsigned long)highest_fd + 1 > counters[COUNTER_PEAK_OPEN_FDS]) {
+    counters[COUNTER_PEAK_OPEN_FDS] = highest_fd + 1;
+  }
+  if (option_enabled(OPTION_STATS) || option_enabled(OPTION_FDCHECK)) {
+    stats_sample_descriptors();
+  }
+}
+
+/**
+ * With "set -o fdcheck", report the descriptors above stderr a command
+ * is about to inherit. If it execs, only those without close-on-exec
+ * are inherited; an in-process utility keeps all of them. The trace
+ * file is the shell's own and is not reported.
+ * @param command Command name, for the report
+ * @param exec_follows true if the process execs the command next
+ */
+void stats_check_descriptors(const char* command, bool exec_follows) {
+  char link_path[64];
+  char target[WORKING_DIR_BUFFER_SIZE];
+  struct dirent* entry;
+  DIR* directory;
+  ssize_t length;
+  int fd, flags;
+
+  if (!option_enabled(OPTION_FDCHECK)) {
+    return;
+  }
+  directory = opendir("/proc/self/fd");
+  if (directory == NULL) {
+    perror("fdcheck: /proc/self/fd");
+    return;
+  }
+  while ((entry = readdir(directory)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    fd = atoi(entry->d_name);
+    if (fd <= STDERR_FILENO || fd == dirfd(directory) || fd == trace_descriptor()) {
+      continue;
+    }
+    flags = fcntl(fd, F_GETFD);
+    if (flags < 0 || (exec_follows && (flags & FD_CLOEXEC))) {
+      continue;
+    }
+    snprintf(link_path, sizeof(link_path), "/proc/self/fd/%d", fd);
+    length = readlink(link_path, target, sizeof(target) - 1);
+    target[length > 0 ? length : 0] = '\0';
+    fprintf(stderr, "fdcheck: %s: descriptor %d (%s) leaked\n", command, fd, target);
+    stats_add(COUNTER_LEAKED_FDS, 1);
+  }
+  closedir(directory);
+}
+
+void stats_reset(void) {
+  memset(counters, 0, sizeof(fallback_counters));
+}
+
+void stats_print(FILE* output) {
+  int i;
+
+  for (i = 0; i < COUNTER_COUNT; i++) {
+    fprintf(output, "%-20s%lu\n", counter_names[i], counters[i]);
+  }
+}
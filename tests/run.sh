@@ -0,0 +1,241 @@
+#!/bin/sh
+# <Adel Alkhamisy>
+# <Adel.Alkhamisy@bison.howard.edu>
+#
+# Regression checks: runs each case through shell2 and compares what it
+# prints with the expected text. Run with "make check".
+
+cd "$(dirname "$0")/.." || exit 1
+
+SHELL2=./shell2
+failures=0
+
+# expect NAME EXPECTED COMMAND...: run a command line through "shell2 -c"
+expect() {
+  name=$1
+  expected=$2
+  shift 2
+  actual=$("$SHELL2" -c "$*" 2>&1)
+  if [ "$actual" = "$expected" ]; then
+    echo "ok    $name"
+  else
+    echo "FAIL  $name: expected '$expected', got '$actual'"
+    failures=$((failures + 1))
+  fi
+}
+
+# expect_session NAME EXPECTED LINE...: feed lines to shell2 on stdin
+# (so "set -o" can come first) and compare the last line it prints,
+# without its prompt
+expect_session() {
+  name=$1
+  expected=$2
+  shift 2
+  actual=$(printf '%s\n' "$@" exit | "$SHELL2" 2>&1 | sed 's/^.*> //' | grep -v '^$' | tail -n 1)
+  if [ "$actual" = "$expected" ]; then
+    echo "ok    $name"
+  else
+    echo "FAIL  $name: expected '$expected', got '$actual'"
+    failures=$((failures + 1))
+  fi
+}
+
+# expect_same NAME COUNTER REFERENCE LINE...: run REFERENCE with sh,
+# then LINE... through shell2 on stdin, the last of them writing to
+# $work/actual, and compare the two outputs byte for byte. Unless
+# COUNTER is "-", that shstats counter must end up non-zero, so the
+# in-process code ran and not the external program it stands in for
+expect_same() {
+  name=$1
+  counter=$2
+  reference=$3
+  shift 3
+  sh -c "$reference" > "$work/expected" 2>/dev/null
+  rm -f "$work/actual"
+  printf '%s\n' "shstats -r" "$@" shstats exit | "$SHELL2" > "$work/stats" 2>&1
+  if ! cmp -s "$work/expected" "$work/actual"; then
+    echo "FAIL  $name: output differs from '$reference'"
+    failures=$((failures + 1))
+  elif [ "$counter" != - ] && ! grep -q "^$counter  *[1-9]" "$work/stats"; then
+    echo "FAIL  $name: $counter is 0, the external program ran"
+    failures=$((failures + 1))
+  else
+    echo "ok    $name"
+  fi
+}
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# Arithmetic: a sign binds tighter than **, as in bash. The builtin
+# echo pads its output, so these use /bin/echo
+expect "-2**2"           4    '/bin/echo $((-2**2))'
+expect "2**3**2"         512  '/bin/echo $((2**3**2))'
+expect "2*-3**2"         18   '/bin/echo $((2*-3**2))'
+
+# In-process grep: repeated stars collapse as in GNU grep
+expect_session "grep -c 'a**'" 3 "set -o utilities" "grep -c 'a**' tests/star_lines"
+
+# In-process sort: the same message as GNU sort for a missing file
+LC_ALL=C expect_session "sort missing file" "sort: cannot read: tests/missing: No such file or directory" \
+  "set -o utilities" "sort tests/missing | cat"
+
+# In-process utilities against the programs they stand in for, in
+# byte order as the utilities only collate that way
+LC_ALL=C
+export LC_ALL
+awk 'BEGIN { for (i = 0; i < 300000; i++) print (i * 7919) % 100003, "row" }' > "$work/big"
+printf '%s\n' "Foo bar" "foo" "" "bar foo" "FOO" "barfoo bar" "x" > "$work/text"
+printf '%s\n' "one" "two" "three" > "$work/short"
+big=$work/big
+text=$work/text
+short=$work/short
+utilities="set -o utilities"
+out="> $work/actual"
+
+# sort with a 1 MiB budget spills the 300000 lines to runs and merges them
+expect_same "sort -S 1M"            "utilities run" "sort -S 1M $big" \
+  "$utilities" "sort -S 1M $big $out"
+expect_same "sort -S 1M -r"         "utilities run" "sort -S 1M -r $big" \
+  "$utilities" "sort -S 1M -r $big $out"
+expect_same "sort -S 1M -u"         "utilities run" "sort -S 1M -u $big" \
+  "$utilities" "sort -S 1M -u $big $out"
+expect_same "sort -ru files"        "utilities run" "sort -S 1M -ru $big $text $short" \
+  "$utilities" "sort -S 1M -ru $big $text $short $out"
+
+expect_same "grep"                  "utilities run" "grep foo $text" \
+  "$utilities" "grep foo $text $out"
+expect_same "grep -v"               "utilities run" "grep -v foo $text" \
+  "$utilities" "grep -v foo $text $out"
+expect_same "grep -c"               "utilities run" "grep -c foo $text" \
+  "$utilities" "grep -c foo $text $out"
+expect_same "grep -n"               "utilities run" "grep -n foo $text" \
+  "$utilities" "grep -n foo $text $out"
+expect_same "grep -i"               "utilities run" "grep -i foo $text" \
+  "$utilities" "grep -i foo $text $out"
+expect_same "grep -vin"             "utilities run" "grep -vin foo $text" \
+  "$utilities" "grep -vin foo $text $out"
+expect_same "grep -c files"         "utilities run" "grep -c o $text $short" \
+  "$utilities" "grep -c o $text $short $out"
+expect_same "grep ^foo"             "utilities run" "grep '^foo' $text" \
+  "$utilities" "grep '^foo' $text $out"
+expect_same "grep bar\$"            "utilities run" "grep 'bar\$' $text" \
+  "$utilities" "grep 'bar\$' $text $out"
+expect_same "grep ^\$"              "utilities run" "grep -n '^\$' $text" \
+  "$utilities" "grep -n '^\$' $text $out"
+expect_same "grep ^foo\$ -i"        "utilities run" "grep -i '^foo\$' $text" \
+  "$utilities" "grep -i '^foo\$' $text $out"
+
+expect_same "head files"            "utilities run" "head -n 2 $text $short" \
+  "$utilities" "head -n 2 $text $short $out"
+expect_same "tail files"            "utilities run" "tail -n 2 $big $short" \
+  "$utilities" "tail -n 2 $big $short $out"
+expect_same "head -3"               "utilities run" "head -3 $big" \
+  "$utilities" "head -3 $big $out"
+expect_same "wc files"              "utilities run" "wc $big $text" \
+  "$utilities" "wc $big $text $out"
+expect_same "wc -l"                 "utilities run" "wc -l $short" \
+  "$utilities" "wc -l $short $out"
+expect_same "wc -lc files"          "utilities run" "wc -lc $text $short" \
+  "$utilities" "wc -lc $text $short $out"
+expect_same "wc stdin"              "utilities run" "wc < $big" \
+  "$utilities" "/bin/cat $big | wc $out"
+
+# Fused stages pass data through rings instead of pipes
+expect_same "fused sort -u | head"  "fused stages" "sort -S 1M -u $big | head -n 1000" \
+  "$utilities" "set -o fusion" "cat $big | sort -S 1M -u | head -n 1000 | /bin/cat $out"
+expect_same "fused grep | wc"       "fused stages" "grep -v 7 $big | wc" \
+  "$utilities" "set -o fusion" "cat $big | grep -v 7 | wc | /bin/cat $out"
+expect_same "fused tail | grep -c"  "fused stages" "tail -n 5000 $big | grep -c 1" \
+  "$utilities" "set -o fusion" "cat $big | tail -n 5000 | grep -c 1 | /bin/cat $out"
+
+# Expansions against sh: globs, command substitution and variables
+mkdir -p "$work/tree/sub/deep"
+touch "$work/tree/a.c" "$work/tree/b.h" "$work/tree/sub/c.c" "$work/tree/sub/deep/d.c"
+expect "glob *"                 "$(sh -c "echo $work/tree/*")"     "/bin/echo $work/tree/*"
+expect "glob ? and []"          "$(sh -c "echo $work/tree/?.[ch]")" "/bin/echo $work/tree/?.[ch]"
+expect "glob no match"          "$work/tree/*.z"                    "/bin/echo $work/tree/*.z"
+if command -v bash >/dev/null 2>&1; then
+  expect "glob **"              "$(bash -O globstar -c "echo $work/tree/**/*.c")" \
+    "/bin/echo $work/tree/**/*.c"
+fi
+expect "\$(...) trailing lines" "$(sh -c 'echo "[$(printf "a\n\nb\n\n\n")]"')" \
+  '/bin/echo "[$(printf "a\n\nb\n\n\n")]"'
+expect "\$(...) split"          "$(sh -c 'echo [$(printf "  x  y \n")]')" \
+  '/bin/echo [$(printf "  x  y \n")]'
+expect_session "export"         "[seen]" \
+  "export CHECK_VALUE=seen" "/bin/sh -c 'echo [\$CHECK_VALUE]'"
+expect_session "unset"          "[]" \
+  "export CHECK_VALUE=seen" "unset CHECK_VALUE" "/bin/sh -c 'echo [\$CHECK_VALUE]'"
+expect_session "NAME=VALUE cmd" "[once]" \
+  "CHECK_VALUE=once /bin/sh -c 'echo [\$CHECK_VALUE]'"
+expect_session "NAME=VALUE cmd does not stay" "[]" \
+  "CHECK_VALUE=once /bin/sh -c 'echo [\$CHECK_VALUE]'" '/bin/echo [$CHECK_VALUE]'
+expect_session "NAME=VALUE cmd not exported" "[]" \
+  "CHECK_VALUE=once /bin/true" "/bin/sh -c 'echo [\$CHECK_VALUE]'"
+
+# "shell2 -c" on a terminal: without job control the command must stay
+# in the foreground process group, so a terminal read is not stopped
+if command -v script >/dev/null 2>&1; then
+  actual=$( (printf 'typed\n'; sleep 1; printf '\004') |
+            timeout 10 script -qec "$SHELL2 -c cat; echo status \$?" /dev/null | tr -d '\r')
+  case $actual in
+    *typed*typed*"status 0"*) echo "ok    -c cat on a terminal" ;;
+    *)
+      echo "FAIL  -c cat on a terminal: got '$actual'"
+      failures=$((failures + 1))
+      ;;
+  esac
+else
+  echo "skip  -c cat on a terminal (no script command)"
+fi
+
+# SIGINT sent with kill to "shell2 -c" reaches the command, which
+# shares the shell's process group and never saw it
+"$SHELL2" -c "sleep 5" &
+shell_pid=$!
+sleep 0.5
+start=$(date +%s)
+kill -INT "$shell_pid"
+wait "$shell_pid"
+if [ $(($(date +%s) - start)) -lt 3 ]; then
+  echo "ok    kill -INT interrupts -c"
+else
+  echo "FAIL  kill -INT interrupts -c: the command ran on"
+  failures=$((failures + 1))
+fi
+
+# Command server: "exit" ends the request, not the server, and a
+# connected client that sends nothing does not hold up the others
+socket_path=${TMPDIR:-/tmp}/shell2-check.$$
+"$SHELL2" --server "$socket_path" &
+server_pid=$!
+sleep 0.5
+idle_pid=
+if command -v python3 >/dev/null 2>&1; then
+  python3 -c "import socket, sys, time
+s = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+s.connect(sys.argv[1])
+time.sleep(10)" "$socket_path" &
+  idle_pid=$!
+  sleep 0.5
+fi
+timeout 5 "$SHELL2" --client "$socket_path" "exit 3"
+first=$?
+second=$(timeout 5 "$SHELL2" --client "$socket_path" "/bin/echo served")
+if [ "$first" -eq 3 ] && [ "$second" = "served" ]; then
+  echo "ok    server exit and idle client"
+else
+  echo "FAIL  server exit and idle client: got status $first, then '$second'"
+  failures=$((failures + 1))
+fi
+[ -n "$idle_pid" ] && kill "$idle_pid" 2>/dev/null
+kill "$server_pid"
+wait "$server_pid" 2>/dev/null
+rm -f "$socket_path"
+
+if [ "$failures" -ne 0 ]; then
+  echo "$failures failed"
+  exit 1
+fi
+echo "all passed"
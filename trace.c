@@ -0,0 +1,214 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Execution timeline in Chrome trace-event format.
+ *
+ * "set -o trace=FILE" records, for every command line, how long
+ * parsing took, and for every process the shell starts (each pipeline
+ * stage included) when it was forked, when it called exec, when it
+ * first wrote to its output pipe, when it exited and when the shell
+ * reaped it. Load FILE in chrome://tracing or ui.perfetto.dev; each
+ * process is one row.
+ *
+ * Events are appended one write() at a time to an O_APPEND file, so
+ * forked children can add their own "exec" event right before exec.
+ * The JSON array is never closed, which both viewers accept, so the
+ * file stays valid while the shell keeps appending.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "shell2.h"
+
+#define TRACE_EVENT_SIZE 1024
+
+static int trace_fd = -1;
+static char* trace_path;
+static pid_t shell_pid;
+
+/**
+ * Microseconds on the monotonic clock, shared by all processes
+ */
+long long trace_now(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/**
+ * Open or switch the trace file to follow the trace option. Called once
+ * per command line.
+ * @return true if tracing is on
+ */
+bool trace_update(void) {
+  const char* path;
+  char header[256];
+  int length;
+
+  if (!option_enabled(OPTION_TRACE)) {
+    if (trace_fd >= 0) {
+      close(trace_fd);
+      trace_fd = -1;
+    }
+    return false;
+  }
+  path = option_value(OPTION_TRACE);
+  if (trace_fd >= 0 && strcmp(path, trace_path) == 0) {
+    return true;
+  }
+  if (trace_fd >= 0) {
+    close(trace_fd);
+  }
+  free(trace_path);
+  trace_path = strdup(path);
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (trace_fd < 0 || trace_path == NULL) {
+    perror("trace");
+    options_set("trace", false);
+    return false;
+  }
+  shell_pid = getpid();
+  length = snprintf(header, sizeof(header),
+                    "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"shell2\"}},\n",
+                    (int)shell_pid);
+  if (write(trace_fd, header, length) < 0) {
+    perror("trace");
+  }
+  return true;
+}
+
+bool trace_enabled(void) {
+  return trace_fd >= 0;
+}
+
+/**
+ * Descriptor of the trace file, which children keep to record events
+ * @return The descriptor, or -1 when not tracing
+ */
+int trace_descriptor(void) {
+  return trace_fd;
+}
+
+/**
+ * Append text to buffer as a JSON string body, truncating if needed
+ */
+static int append_json_string(char* buffer, int used, int size, const char* text) {
+  for (; text != NULL && *text != '\0' && used < size - 8; text++) {
+    if (*text == '"' || *text == '\\') {
+      buffer[used++] = '\\';
+      buffer[used++] = *text;
+    }
+    else if ((unsigned char)*text < 0x20) {
+      used += snprintf(buffer + used, size - used, "\\u%04x", *text);
+    }
+    else {
+      buffer[used++] = *text;
+    }
+  }
+  return used;
+}
+
+/**
+ * Write one event. Each process the shell starts gets its own row
+ * (tid); the shell itself is the row named after its own pid.
+ * @param name Event name
+ * @param phase "X" for a span, "i" for an instant
+ * @param tid Process the event belongs to
+ * @param start Start time from trace_now()
+ * @param duration Length of a span, ignored for instants
+ * @param detail Shown as the "command" argument, may be NULL
+ */
+static void trace_event(const char* name, const char* phase, pid_t tid, long long start,
+                        long long duration, const char* detail) {
+  char event[TRACE_EVENT_SIZE];
+  int used;
+
+  if (trace_fd < 0) {
+    return;
+  }
+  used = snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%lld",
+                  name, phase, (int)shell_pid, (int)tid, start);
+  if (phase[0] == 'X') {
+    used += snprintf(event + used, sizeof(event) - used, ",\"dur\":%lld", duration);
+  }
+  else {
+    used += snprintf(event + used, sizeof(event) - used, ",\"s\":\"t\"");
+  }
+  if (detail != NULL) {
+    used += snprintf(event + used, sizeof(event) - used, ",\"args\":{\"command\":\"");
+    used = append_json_string(event, used, sizeof(event), detail);
+    used += snprintf(event + used, sizeof(event) - used, "\"}");
+  }
+  used += snprintf(event + used, sizeof(event) - used, "},\n");
+  /* One write per event keeps lines from different processes whole */
+  if (write(trace_fd, event, used) < 0) {
+    perror("trace");
+  }
+}
+
+/**
+ * Record a span that started at start and ends now
+ */
+void trace_span(const char* name, pid_t tid, long long start, const char* detail) {
+  trace_event(name, "X", tid, start, trace_now() - start, detail);
+}
+
+/**
+ * Record a point in time
+ */
+void trace_instant(const char* name, pid_t tid, const char* detail) {
+  trace_event(name, "i", tid, trace_now(), 0, detail);
+}
+
+/* Watches one pipe for the first byte its writer produces */
+typedef struct {
+  event_source source;
+  pid_t writer;
+} output_watch;
+
+static void handle_first_output(event_source* source, unsigned int events) {
+  output_watch* watch = source->context;
+
+  if (events & EPOLLIN) {
+    trace_instant("first-output", watch->writer, NULL);
+  }
+  events_remove(source);
+  close(source->fd);
+  free(watch);
+}
+
+/**
+ * Record when a pipeline stage first writes to its output pipe. The
+ * shell keeps its own copy of the read end and only polls it, never
+ * reads, and lets go as soon as data (or hangup) shows up.
+ * @param pipe_read_fd Read end of the stage's output pipe
+ * @param writer pid of the stage writing into it
+ */
+void trace_watch_first_output(int pipe_read_fd, pid_t writer) {
+  output_watch* watch;
+
+  if (trace_fd < 0) {
+    return;
+  }
+  watch = malloc(sizeof(output_watch));
+  if (watch == NULL) {
+    return;
+  }
+  watch->writer = writer;
+  watch->source.fd = fcntl(pipe_read_fd, F_DUPFD_CLOEXEC, 0);
+  watch->source.handle = handle_first_output;
+  watch->source.context = watch;
+  if (watch->source.fd < 0 || !events_add(&watch->source)) {
+    if (watch->source.fd >= 0) {
+      close(watch->source.fd);
+    }
+    free(watch);
+  }
+}
@@ -0,0 +1,612 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * In-process text utilities: cat, head, tail and wc here, grep in
+ * grep.c and sort in sort.c.
+ *
+ * With "set -o utilities", a pipeline stage (or a command on its own)
+ * naming one of these still gets its forked child, so job control,
+ * timeouts and redirection work as before, but the child runs the
+ * utility here instead of exec'ing the external program. That skips the
+ * exec, the dynamic loader and the program's own startup, which is most
+ * of the cost of "cat testData | head -3".
+ *
+ * Data moves between descriptors 0 and 1 in large blocks:
+ * copy_file_range() between regular files, splice() when one side is a
+ * pipe, and read()/write() with a 128 KiB buffer otherwise. Only the
+ * common options are understood; for anything else a utility returns
+ * UTILITY_UNSUPPORTED before touching its input and the real program
+ * is exec'd as usual.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell2.h"
+
+#define UTILITY_BUFFER_SIZE (128 * 1024)
+#define DEFAULT_LINE_COUNT 10
+#define WC_STDIN_WIDTH 7
+
+/* Per thread, as fused stages (fusion.c) run utilities side by side */
+static __thread char utility_buffer[UTILITY_BUFFER_SIZE];
+
+/**
+ * Write all of buffer, retrying short writes. In a fused stage,
+ * descriptor 1 may be a ring to the next stage.
+ * @return false on a write error (already reported)
+ */
+bool utility_write_all(int fd, const char* buffer, size_t length) {
+  fusion_ring* ring = fusion_ring_for(fd);
+  ssize_t written;
+
+  if (ring != NULL) {
+    /* The next stage is done: stop quietly, as SIGPIPE would */
+    return fusion_ring_write(ring, buffer, length);
+  }
+  while (length > 0) {
+    written = write(fd, buffer, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("write");
+      return false;
+    }
+    buffer += written;
+    length -= written;
+  }
+  return true;
+}
+
+/**
+ * read() that retries after a signal. In a fused stage, descriptor 0
+ * may be a ring from the previous stage.
+ */
+ssize_t utility_read(int fd, char* buffer, size_t size) {
+  fusion_ring* ring = fusion_ring_for(fd);
+  ssize_t count;
+
+  if (ring != NULL) {
+    return fusion_ring_read(ring, buffer, size);
+  }
+  while ((count = read(fd, buffer, size)) < 0 && errno == EINTR) {
+  }
+  return count;
+}
+
+/**
+ * Copy everything from input_fd to output_fd, letting the kernel move
+ * the data where it can
+ * @return false on an error (already reported)
+ */
+static bool copy_all(int input_fd, int output_fd) {
+  bool kernel_copy = fusion_ring_for(input_fd) == NULL && fusion_ring_for(output_fd) == NULL;
+  bool try_copy_range = kernel_copy;
+  bool try_splice = kernel_copy;
+  ssize_t count;
+
+  while (true) {
+    if (try_copy_range) {
+      count = copy_file_range(input_fd, NULL, output_fd, NULL, UTILITY_BUFFER_SIZE * 8, 0);
+      if (count >= 0) {
+        if (count == 0) {
+          return true;
+        }
+        continue;
+      }
+      /* Not two regular files on a filesystem that allows it */
+      try_copy_range = false;
+    }
+    if (try_splice) {
+      count = splice(input_fd, NULL, output_fd, NULL, UTILITY_BUFFER_SIZE * 8, SPLICE_F_MOVE);
+      if (count >= 0) {
+        if (count == 0) {
+          return true;
+        }
+        continue;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      /* Neither side is a pipe */
+      try_splice = false;
+    }
+    count = utility_read(input_fd, utility_buffer, sizeof(utility_buffer));
+    if (count < 0) {
+      perror("read");
+      return false;
+    }
+    if (count == 0) {
+      return true;
+    }
+    if (!utility_write_all(output_fd, utility_buffer, count)) {
+      return false;
+    }
+  }
+}
+
+/**
+ * Check for a regular file, which can be mapped or measured rather than read
+ * @param file_status Receives the file's status
+ * @return false for anything else, including a fused stage's ring
+ */
+bool utility_regular_file(int fd, struct stat* file_status) {
+  return fusion_ring_for(fd) == NULL && fstat(fd, file_status) == 0 && S_ISREG(file_status->st_mode);
+}
+
+/**
+ * Open one operand for reading; "-" is standard input
+ * @return Descriptor, or -1 after reporting the error
+ */
+int utility_open_operand(const char* utility, const char* path) {
+  int fd;
+
+  if (strcmp(path, "-") == 0) {
+    return STDIN_FILENO;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s: %s\n", utility, path, strerror(errno));
+  }
+  return fd;
+}
+
+/**
+ * Close a descriptor from utility_open_operand(), unless it is stdin
+ */
+void utility_close_operand(int fd) {
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+}
+
+/**
+ * Parse the line count options head and tail share: "-n N", "-nN" and "-N"
+ * @param first_operand Receives the index of the first file operand
+ * @return Line count, or -1 if the options need the real program
+ */
+static long parse_line_count(char* args[], int* first_operand) {
+  long lines = DEFAULT_LINE_COUNT;
+  const char* text;
+  char* end;
+  int i;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (args[i][1] == 'n') {
+      text = args[i][2] != '\0' ? args[i] + 2 : args[++i];
+    } else {
+      text = args[i] + 1;
+    }
+    if (text == NULL || *text < '0' || *text > '9') {
+      return -1;
+    }
+    lines = strtol(text, &end, 10);
+    if (*end != '\0') {
+      return -1;
+    }
+  }
+  *first_operand = i;
+  return lines;
+}
+
+/**
+ * Print the "==> FILE <==" header head and tail use for several files
+ */
+static bool write_header(const char* path, bool first) {
+  char header[WORKING_DIR_BUFFER_SIZE];
+  int length;
+
+  length = snprintf(header, sizeof(header), "%s==> %s <==\n", first ? "" : "\n",
+                    strcmp(path, "-") == 0 ? "standard input" : path);
+  return utility_write_all(STDOUT_FILENO, header, length < (int)sizeof(header) ? length : (int)sizeof(header) - 1);
+}
+
+/**
+ * cat [FILE...]: copy the files, or standard input, to standard output
+ */
+static int utility_cat(char* args[], bool check_only) {
+  char* standard_input[] = { "-", NULL };
+  char** operands = args + 1;
+  int status = 0;
+  int fd, i;
+
+  for (i = 1; args[i] != NULL; i++) {
+    if (args[i][0] == '-' && args[i][1] != '\0') {
+      return UTILITY_UNSUPPORTED;
+    }
+  }
+  if (check_only) {
+    return 0;
+  }
+  if (*operands == NULL) {
+    operands = standard_input;
+  }
+  for (; *operands != NULL; operands++) {
+    fd = utility_open_operand(args[0], *operands);
+    if (fd < 0) {
+      status = 1;
+      continue;
+    }
+    if (!copy_all(fd, STDOUT_FILENO)) {
+      status = 1;
+    }
+    utility_close_operand(fd);
+  }
+  return status;
+}
+
+/**
+ * Copy the first lines of fd to standard output, then stop reading
+ */
+static bool head_lines(int fd, long lines) {
+  ssize_t count;
+  char* newline;
+  char* scan;
+
+  while (lines > 0) {
+    count = utility_read(fd, utility_buffer, sizeof(utility_buffer));
+    if (count < 0) {
+      perror("read");
+      return false;
+    }
+    if (count == 0) {
+      return true;
+    }
+    for (scan = utility_buffer; lines > 0; scan = newline + 1) {
+      newline = memchr(scan, '\n', utility_buffer + count - scan);
+      if (newline == NULL) {
+        break;
+      }
+      lines--;
+    }
+    if (!utility_write_all(STDOUT_FILENO, utility_buffer, (lines > 0 ? utility_buffer + count : scan) - utility_buffer)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * head [-n N | -N] [FILE...]: print the first N lines (10 by default)
+ */
+static int utility_head(char* args[], bool check_only) {
+  char* standard_input[] = { "-", NULL };
+  char** operands;
+  long lines;
+  int status = 0;
+  int first, fd;
+
+  lines = parse_line_count(args, &first);
+  if (lines < 0) {
+    return UTILITY_UNSUPPORTED;
+  }
+  if (check_only) {
+    return 0;
+  }
+  operands = args[first] != NULL ? args + first : standard_input;
+  for (; *operands != NULL; operands++) {
+    fd = utility_open_operand(args[0], *operands);
+    if (fd < 0) {
+      status = 1;
+      continue;
+    }
+    if ((args[first] != NULL && args[first + 1] != NULL && !write_header(*operands, operands == args + first)) ||
+        !head_lines(fd, lines)) {
+      status = 1;
+    }
+    utility_close_operand(fd);
+  }
+  return status;
+}
+
+/**
+ * Offset where the last lines of text start. A final newline ends the
+ * last line rather than starting an empty one.
+ */
+static size_t tail_start(const char* text, size_t length, long lines) {
+  size_t end = length;
+  const char* newline;
+
+  if (lines == 0) {
+    return length;
+  }
+  if (end > 0 && text[end - 1] == '\n') {
+    end--;
+  }
+  while (lines-- > 0) {
+    newline = memrchr(text, '\n', end);
+    if (newline == NULL) {
+      return 0;
+    }
+    end = newline - text;
+  }
+  return end + 1;
+}
+
+/**
+ * Print the last lines of fd. A regular file is mapped and scanned
+ * from the end; anything else is read through, keeping only a window
+ * that holds the wanted lines.
+ */
+static bool tail_lines(int fd, long lines) {
+  struct stat file_status;
+  char* text;
+  char* grown;
+  size_t length = 0, capacity = 0, start;
+  ssize_t count;
+  bool ok;
+
+  if (utility_regular_file(fd, &file_status) && file_status.st_size > 0) {
+    text = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text != MAP_FAILED) {
+      start = tail_start(text, file_status.st_size, lines);
+      ok = utility_write_all(STDOUT_FILENO, text + start, file_status.st_size - start);
+      munmap(text, file_status.st_size);
+      return ok;
+    }
+  }
+  text = NULL;
+  while (true) {
+    if (length == capacity) {
+      /* Drop what is before the wanted lines; grow only if they fill the window */
+      if (length > 0) {
+        start = tail_start(text, length, lines);
+        memmove(text, text + start, length - start);
+        length -= start;
+      }
+      if (length * 2 >= capacity) {
+        capacity = capacity > 0 ? capacity * 2 : UTILITY_BUFFER_SIZE;
+        grown = realloc(text, capacity);
+        if (grown == NULL) {
+          perror("realloc");
+          free(text);
+          return false;
+        }
+        text = grown;
+      }
+    }
+    count = utility_read(fd, text + length, capacity - length);
+    if (count < 0) {
+      perror("read");
+      free(text);
+      return false;
+    }
+    if (count == 0) {
+      break;
+    }
+    length += count;
+  }
+  start = tail_start(text, length, lines);
+  ok = utility_write_all(STDOUT_FILENO, text + start, length - start);
+  free(text);
+  return ok;
+}
+
+/**
+ * tail [-n N | -N] [FILE...]: print the last N lines (10 by default)
+ */
+static int utility_tail(char* args[], bool check_only) {
+  char* standard_input[] = { "-", NULL };
+  char** operands;
+  long lines;
+  int status = 0;
+  int first, fd;
+
+  lines = parse_line_count(args, &first);
+  if (lines < 0) {
+    return UTILITY_UNSUPPORTED;
+  }
+  if (check_only) {
+    return 0;
+  }
+  operands = args[first] != NULL ? args + first : standard_input;
+  for (; *operands != NULL; operands++) {
+    fd = utility_open_operand(args[0], *operands);
+    if (fd < 0) {
+      status = 1;
+      continue;
+    }
+    if ((args[first] != NULL && args[first + 1] != NULL && !write_header(*operands, operands == args + first)) ||
+        !tail_lines(fd, lines)) {
+      status = 1;
+    }
+    utility_close_operand(fd);
+  }
+  return status;
+}
+
+typedef struct {
+  unsigned long long lines;
+  unsigned long long words;
+  unsigned long long bytes;
+} wc_counts;
+
+/* Bytes that separate words, as in the C locale */
+static const bool wc_space[256] = {
+  [' '] = true, ['\t'] = true, ['\n'] = true, ['\v'] = true, ['\f'] = true, ['\r'] = true
+};
+
+/**
+ * Count lines, words and bytes of fd. Byte counts alone come from
+ * fstat() for regular files, without reading them.
+ */
+static bool wc_count(int fd, bool need_text, wc_counts* counts) {
+  struct stat file_status;
+  bool in_word = false;
+  ssize_t count, i;
+  const char* scan;
+  const char* end;
+
+  memset(counts, 0, sizeof(*counts));
+  if (!need_text && fd != STDIN_FILENO && utility_regular_file(fd, &file_status)) {
+    counts->bytes = file_status.st_size;
+    return true;
+  }
+  while ((count = utility_read(fd, utility_buffer, sizeof(utility_buffer))) > 0) {
+    counts->bytes += count;
+    end = utility_buffer + count;
+    for (scan = utility_buffer; (scan = memchr(scan, '\n', end - scan)) != NULL; scan++) {
+      counts->lines++;
+    }
+    for (i = 0; i < count; i++) {
+      if (wc_space[(unsigned char)utility_buffer[i]]) {
+        in_word = false;
+      } else if (!in_word) {
+        in_word = true;
+        counts->words++;
+      }
+    }
+  }
+  if (count < 0) {
+    perror("read");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Print one wc result line in the selected columns
+ */
+static bool wc_print(const wc_counts* counts, bool show[3], int width, const char* name) {
+  char line[WORKING_DIR_BUFFER_SIZE];
+  unsigned long long values[3] = { counts->lines, counts->words, counts->bytes };
+  int length = 0;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if (show[i]) {
+      length += snprintf(line + length, sizeof(line) - length, "%s%*llu", length > 0 ? " " : "", width, values[i]);
+    }
+  }
+  if (name != NULL) {
+    length += snprintf(line + length, sizeof(line) - length, " %s", name);
+  }
+  if (length >= (int)sizeof(line) - 1) {
+    length = sizeof(line) - 2;
+  }
+  line[length++] = '\n';
+  return utility_write_all(STDOUT_FILENO, line, length);
+}
+
+/**
+ * wc [-lwc] [FILE...]: count lines, words and bytes. Columns are as
+ * wide as the total size of the files needs, or 7 when reading a
+ * stream, and unpadded when only one number is printed.
+ */
+static int utility_wc(char* args[], bool check_only) {
+  bool show[3] = { false, false, false };
+  char* standard_input[] = { "-", NULL };
+  char** operands;
+  wc_counts counts, total = { 0, 0, 0 };
+  struct stat file_status;
+  unsigned long long total_size = 0;
+  int status = 0;
+  int first, fd, i, width, selected, operand_count;
+  const char* option;
+
+  for (first = 1; args[first] != NULL && args[first][0] == '-' && args[first][1] != '\0'; first++) {
+    for (option = args[first] + 1; *option != '\0'; option++) {
+      switch (*option) {
+      case 'l': show[0] = true; break;
+      case 'w': show[1] = true; break;
+      case 'c': show[2] = true; break;
+      default: return UTILITY_UNSUPPORTED;
+      }
+    }
+  }
+  if (check_only) {
+    return 0;
+  }
+  if (!show[0] && !show[1] && !show[2]) {
+    show[0] = show[1] = show[2] = true;
+  }
+  selected = show[0] + show[1] + show[2];
+  operands = args[first] != NULL ? args + first : standard_input;
+  for (operand_count = 0; operands[operand_count] != NULL; operand_count++) {
+  }
+
+  /* Size the columns before printing anything, as the totals line must line up */
+  width = 1;
+  if (selected > 1 || operand_count > 1) {
+    for (i = 0; i < operand_count; i++) {
+      if (strcmp(operands[i], "-") == 0 ? !utility_regular_file(STDIN_FILENO, &file_status) :
+          stat(operands[i], &file_status) != 0 || !S_ISREG(file_status.st_mode)) {
+        total_size = 0;
+        width = WC_STDIN_WIDTH;
+        break;
+      }
+      total_size += file_status.st_size;
+    }
+    for (; total_size >= 10; total_size /= 10) {
+      width++;
+    }
+  }
+
+  for (; *operands != NULL; operands++) {
+    fd = utility_open_operand(args[0], *operands);
+    if (fd < 0) {
+      status = 1;
+      continue;
+    }
+    if (!wc_count(fd, show[0] || show[1], &counts)) {
+      status = 1;
+    }
+    utility_close_operand(fd);
+    total.lines += counts.lines;
+    total.words += counts.words;
+    total.bytes += counts.bytes;
+    if (!wc_print(&counts, show, width, args[first] != NULL ? *operands : NULL)) {
+      return 1;
+    }
+  }
+  if (operand_count > 1 && !wc_print(&total, show, width, "total")) {
+    return 1;
+  }
+  return status;
+}
+
+typedef struct {
+  const char* name;
+  utility_function function;
+} utility_entry;
+
+static const utility_entry utility_table[] = {
+  { "cat",  utility_cat  },
+  { "grep", utility_grep },
+  { "head", utility_head },
+  { "sort", utility_sort },
+  { "tail", utility_tail },
+  { "wc",   utility_wc   },
+  { NULL,   NULL         }
+};
+
+/**
+ * Look up an in-process utility
+ * @param name Command name; a name with a '/' always means the program
+ * @return The utility, or NULL if name is not one or "set -o utilities" is off
+ */
+utility_function find_utility(const char* name) {
+  const utility_entry* entry;
+
+  if (!option_enabled(OPTION_UTILITIES)) {
+    return NULL;
+  }
+  for (entry = utility_table; entry->name != NULL; entry++) {
+    if (strcmp(entry->name, name) == 0) {
+      return entry->function;
+    }
+  }
+  return NULL;
+}
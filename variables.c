@@ -0,0 +1,444 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Shell variable store.
+ *
+ * Variables live in an open-addressing hash table instead of libc's
+ * environ, so lookups do not scan a list and reassigning a variable
+ * frees the old value. Each variable is one "NAME=VALUE" allocation
+ * with an exported flag. The envp array handed to exec is rebuilt only
+ * when an exported variable changed since the last exec; otherwise the
+ * cached array is reused as is.
+ *
+ * The inherited environment is only copied into the table the first
+ * time a variable is looked at. Until then exec gets the inherited
+ * envp unchanged, so "shell2 -c" with a builtin never copies it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "shell2.h"
+
+#define VARIABLE_TABLE_INITIAL_SLOTS 256
+
+typedef struct {
+  char* text;           /* "NAME=VALUE", NULL if the slot is free */
+  size_t name_length;
+  size_t hash;
+  bool exported;
+  bool deleted;         /* tombstone left by unset */
+} variable_slot;
+
+static variable_slot* variable_slots;
+static size_t variable_slot_count;
+static size_t variable_used_count;     /* live variables plus tombstones */
+static size_t exported_count;
+
+static char** cached_environment;
+static bool environment_dirty = true;
+
+/* Bumped whenever PATH changes, so caches of PATH contents can notice */
+static unsigned long path_generation;
+
+/* Inherited environment not copied into the table yet */
+static char** pending_environment;
+
+static size_t hash_name(const char* name, size_t length) {
+  size_t hash = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)name[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+ * Check that name is a valid shell identifier
+ * @param name Name to check
+ * @param length Number of characters to check
+ */
+bool variable_name_is_valid(const char* name, size_t length) {
+  size_t i;
+
+  if (length == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+    return false;
+  }
+  for (i = 1; i < length; i++) {
+    if (!(isalnum((unsigned char)name[i]) || name[i] == '_')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Check whether a word has the form NAME=VALUE
+ * @param word Word to check
+ * @return Length of NAME, or 0 if word is not an assignment
+ */
+size_t variable_assignment_name_length(const char* word) {
+  const char* equals = strchr(word, '=');
+
+  if (equals == NULL || !variable_name_is_valid(word, equals - word)) {
+    return 0;
+  }
+  return equals - word;
+}
+
+/**
+ * Apply a NAME=VALUE word. VALUE is everything after the first '='
+ * and may itself contain '=' or be empty.
+ * @param word Assignment word (variable_assignment_name_length() > 0)
+ * @param export true to also export the variable
+ */
+void variable_assign_word(const char* word, bool export) {
+  size_t name_length = variable_assignment_name_length(word);
+  char* name = strndup(word, name_length);
+
+  if (name == NULL) {
+    perror("strndup");
+    exit(1);
+  }
+  variable_set(name, word + name_length + 1, export);
+  free(name);
+}
+
+static void grow_table(void);
+static void import_pending_environment(void);
+
+/**
+ * Find the slot holding name, or the slot where it would be inserted
+ * @param insert true to return a free slot if name is absent
+ * @return Slot, or NULL if absent and insert is false
+ */
+static variable_slot* find_slot(const char* name, size_t length, bool insert) {
+  variable_slot* tombstone = NULL;
+  variable_slot* slot;
+  size_t hash = hash_name(name, length);
+  size_t mask, index;
+
+  if (pending_environment != NULL) {
+    import_pending_environment();
+  }
+  if (insert && (variable_used_count + 1) * 4 >= variable_slot_count * 3) {
+    grow_table();
+  }
+  if (variable_slot_count == 0) {
+    return NULL;
+  }
+  mask = variable_slot_count - 1;
+  for (index = hash & mask; ; index = (index + 1) & mask) {
+    slot = &variable_slots[index];
+    if (slot->text == NULL) {
+      if (slot->deleted) {
+        if (tombstone == NULL) {
+          tombstone = slot;
+        }
+        continue;
+      }
+      if (!insert) {
+        return NULL;
+      }
+      slot = tombstone != NULL ? tombstone : slot;
+      slot->hash = hash;
+      return slot;
+    }
+    if (slot->hash == hash && slot->name_length == length &&
+        memcmp(slot->text, name, length) == 0) {
+      return slot;
+    }
+  }
+}
+
+/**
+ * Double the table (or create it), dropping tombstones
+ */
+static void grow_table(void) {
+  variable_slot* old_slots = variable_slots;
+  size_t old_count = variable_slot_count;
+  variable_slot* slot;
+  size_t index;
+
+  variable_slot_count = old_count ? old_count * 2 : VARIABLE_TABLE_INITIAL_SLOTS;
+  variable_slots = calloc(variable_slot_count, sizeof(variable_slot));
+  if (variable_slots == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  variable_used_count = 0;
+  for (index = 0; index < old_count; index++) {
+    if (old_slots[index].text != NULL) {
+      slot = &variable_slots[old_slots[index].hash & (variable_slot_count - 1)];
+      while (slot->text != NULL) {
+        slot = (slot + 1 == variable_slots + variable_slot_count) ? variable_slots : slot + 1;
+      }
+      *slot = old_slots[index];
+      variable_used_count++;
+    }
+  }
+  free(old_slots);
+}
+
+/**
+ * Look up a variable
+ * @param name Variable name
+ * @return Value, or NULL if unset. Valid until the variable changes.
+ */
+const char* variable_get(const char* name) {
+  size_t length = strlen(name);
+  variable_slot* slot = find_slot(name, length, false);
+
+  return slot != NULL ? slot->text + length + 1 : NULL;
+}
+
+/**
+ * Assign a variable, creating it if needed
+ * @param name Variable name (must be valid)
+ * @param value New value
+ * @param export true to mark it exported; false keeps the current flag
+ * @return false if name is not a valid identifier
+ */
+bool variable_set(const char* name, const char* value, bool export) {
+  size_t name_length = strlen(name);
+  size_t value_length = strlen(value);
+  variable_slot* slot;
+  char* text;
+
+  if (!variable_name_is_valid(name, name_length)) {
+    return false;
+  }
+  text = malloc(name_length + value_length + 2);
+  if (text == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  memcpy(text, name, name_length);
+  text[name_length] = '=';
+  memcpy(text + name_length + 1, value, value_length + 1);
+
+  slot = find_slot(name, name_length, true);
+  if (slot->text == NULL) {
+    if (!slot->deleted) {
+      variable_used_count++;
+    }
+    slot->deleted = false;
+    slot->exported = false;
+    slot->name_length = name_length;
+  }
+  free(slot->text);
+  slot->text = text;
+  if (name_length == 4 && memcmp(name, "PATH", 4) == 0) {
+    path_generation++;
+  }
+  if (export && !slot->exported) {
+    slot->exported = true;
+    exported_count++;
+  }
+  if (slot->exported) {
+    environment_dirty = true;
+  }
+  return true;
+}
+
+/**
+ * Mark an existing variable as exported or not
+ * @return false if the variable does not exist
+ */
+bool variable_set_exported(const char* name, bool export) {
+  variable_slot* slot = find_slot(name, strlen(name), false);
+
+  if (slot == NULL) {
+    return false;
+  }
+  if (slot->exported != export) {
+    slot->exported = export;
+    exported_count += export ? 1 : -1;
+    environment_dirty = true;
+  }
+  return true;
+}
+
+/**
+ * Remove a variable
+ * @return false if it was not set
+ */
+bool variable_unset(const char* name) {
+  variable_slot* slot = find_slot(name, strlen(name), false);
+
+  if (slot == NULL) {
+    return false;
+  }
+  if (slot->exported) {
+    exported_count--;
+    environment_dirty = true;
+  }
+  if (strcmp(name, "PATH") == 0) {
+    path_generation++;
+  }
+  free(slot->text);
+  slot->text = NULL;
+  slot->exported = false;
+  slot->deleted = true;
+  return true;
+}
+
+/**
+ * Counter that changes every time PATH is assigned or unset
+ */
+unsigned long variables_path_generation(void) {
+  if (pending_environment != NULL) {
+    import_pending_environment();
+  }
+  return path_generation;
+}
+
+/**
+ * Call visit for every variable, in table order
+ * @param visit Callback receiving the "NAME=VALUE" text and exported flag
+ * @param context Passed through to visit
+ */
+void variables_for_each(void (*visit)(const char* text, bool exported, void* context), void* context) {
+  size_t index;
+
+  if (pending_environment != NULL) {
+    import_pending_environment();
+  }
+  for (index = 0; index < variable_slot_count; index++) {
+    if (variable_slots[index].text != NULL) {
+      visit(variable_slots[index].text, variable_slots[index].exported, context);
+    }
+  }
+}
+
+/**
+ * Load the process environment into the store, all exported. The copy
+ * is made on first use.
+ * @param environment envp-style array, which must stay unchanged until then
+ */
+void variables_initialize(char** environment) {
+  pending_environment = environment;
+}
+
+/**
+ * Drop every variable and take environment as the new store, copied on
+ * first use like the inherited one. For a zygote worker about to exec
+ * with the shell's current variables; the old table is not freed.
+ */
+void variables_replace_environment(char** environment) {
+  variable_slots = NULL;
+  variable_slot_count = 0;
+  variable_used_count = 0;
+  exported_count = 0;
+  cached_environment = NULL;
+  environment_dirty = true;
+  path_generation++;
+  pending_environment = environment;
+}
+
+static void import_pending_environment(void) {
+  char** environment = pending_environment;
+  char* equals;
+  char* name;
+
+  /* Cleared first: variable_set() below comes back through find_slot() */
+  pending_environment = NULL;
+  for (; *environment != NULL; environment++) {
+    equals = strchr(*environment, '=');
+    if (equals == NULL) {
+      continue;
+    }
+    name = strndup(*environment, equals - *environment);
+    if (name != NULL) {
+      variable_set(name, equals + 1, true);
+      free(name);
+    }
+  }
+}
+
+/**
+ * envp for exec: the exported variables as "NAME=VALUE" strings.
+ * The array points at the variables' own storage and is only rebuilt
+ * after an exported variable changed.
+ * @return NULL-terminated array owned by the store
+ */
+char** variables_environment(void) {
+  size_t index, count = 0;
+
+  if (pending_environment != NULL) {
+    return pending_environment;
+  }
+  if (!environment_dirty && cached_environment != NULL) {
+    return cached_environment;
+  }
+  free(cached_environment);
+  cached_environment = malloc((exported_count + 1) * sizeof(char*));
+  if (cached_environment == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (index = 0; index < variable_slot_count; index++) {
+    if (variable_slots[index].text != NULL && variable_slots[index].exported) {
+      cached_environment[count++] = variable_slots[index].text;
+    }
+  }
+  cached_environment[count] = NULL;
+  environment_dirty = false;
+  return cached_environment;
+}
+
+/**
+ * Check whether an assignment in overrides[from..count) sets the same
+ * name as text ("NAME=..." form)
+ */
+static bool is_overridden(const char* text, char** overrides, size_t from, size_t count) {
+  size_t name_length = strchr(text, '=') - text + 1;
+  size_t i;
+
+  for (i = from; i < count; i++) {
+    if (strncmp(overrides[i], text, name_length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * envp for one command run as "NAME=VALUE ... command": the exported
+ * variables with the given assignments added or replaced. The shell's
+ * own variables are not touched. Meant to be called in the child
+ * right before exec.
+ * @param assignments NAME=VALUE words
+ * @param count Number of assignments
+ * @return Newly allocated NULL-terminated array
+ */
+char** variables_environment_with(char** assignments, size_t count) {
+  char** base = variables_environment();
+  char** environment;
+  size_t base_count, index, total = 0;
+
+  for (base_count = 0; base[base_count] != NULL; base_count++) {
+  }
+  environment = malloc((base_count + count + 1) * sizeof(char*));
+  if (environment == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (index = 0; index < base_count; index++) {
+    if (!is_overridden(base[index], assignments, 0, count)) {
+      environment[total++] = base[index];
+    }
+  }
+  /* A name assigned twice keeps its last value */
+  for (index = 0; index < count; index++) {
+    if (!is_overridden(assignments[index], assignments, index + 1, count)) {
+      environment[total++] = assignments[index];
+    }
+  }
+  environment[total] = NULL;
+  return environment;
+}
@@ -0,0 +1,407 @@
+// <Adel Alkhamisy>
+// <Adel.Alkhamisy@bison.howard.edu>
+
+/**
+ * Zygote: a helper process forked while the shell is still small,
+ * which starts pipeline stages on the shell's behalf.
+ *
+ * fork() copies the page tables of the process calling it, so its cost
+ * grows with the shell's memory (history map, completion trie, job
+ * table). The zygote stays at its startup size. The shell sends it one
+ * SOCK_SEQPACKET message per stage with the argv, envp and the
+ * descriptors the stage needs. The zygote creates the worker with
+ * clone(CLONE_PARENT), so the worker is the shell's child, not the
+ * zygote's. The shell then reaps it and controls it as a job like any
+ * other, and only gets its pid back.
+ *
+ * Turned on with SHELL2_ZYGOTE=1 in the environment (the zygote is then
+ * forked at startup) or "set -o zygote" (forked on first use). Stages
+ * that need state the zygote does not have, like pending ulimit or
+ * sched settings or "set -o fdcheck", are forked directly as before.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "shell2.h"
+
+#define ZYGOTE_MESSAGE_SIZE 65536
+/* stdin, stdout, stderr, working directory, cgroup.procs */
+#define ZYGOTE_MAX_FDS 5
+
+typedef struct {
+  pid_t process_group;  /* as in spawn_options */
+  bool take_terminal;
+  bool stdin_from_null; /* no stdin descriptor follows */
+  bool has_cgroup;      /* a cgroup.procs descriptor follows */
+  int argument_count;
+  int environment_count;
+  /* Then NUL-terminated strings: resolved path, arguments, environment */
+} zygote_request;
+
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+
+/**
+ * Close descriptors first..last (last may be ~0U for "all above first")
+ */
+void close_descriptor_range(unsigned int first, unsigned int last) {
+  unsigned int fd;
+
+  if (first > last) {
+    return;
+  }
+#ifdef SYS_close_range
+  if (syscall(SYS_close_range, first, last, 0) == 0) {
+    return;
+  }
+#endif
+  for (fd = first; fd <= last && fd < 1024; fd++) {
+    close(fd);
+  }
+}
+
+/**
+ * In a forked child about to run a command, close every descriptor
+ * above stderr except the trace file, which it keeps for its events
+ */
+void close_descriptors_in_child(void) {
+  int trace_fd = trace_descriptor();
+
+  if (trace_fd > STDERR_FILENO) {
+    close_descriptor_range(STDERR_FILENO + 1, trace_fd - 1);
+    close_descriptor_range(trace_fd + 1, ~0U);
+  }
+  else {
+    close_descriptor_range(STDERR_FILENO + 1, ~0U);
+  }
+}
+
+/**
+ * Close every descriptor above stderr except the zygote socket and the
+ * signalfd (which workers close themselves), so the zygote does not hold
+ * pipe ends or pidfds the shell had open when it was forked
+ */
+static void close_inherited_descriptors(void) {
+  unsigned int low = zygote_fd;
+  unsigned int high = signals_get_fd();
+
+  if (signals_get_fd() < 0) {
+    high = low;
+  }
+  if (low > high) {
+    low = high;
+    high = zygote_fd;
+  }
+  close_descriptor_range(3, low - 1);
+  close_descriptor_range(low + 1, high - 1);
+  close_descriptor_range(high + 1, ~0U);
+}
+
+/**
+ * Worker side: take the descriptors, join the job and exec. Mirrors
+ * the child branch of spawn_pipeline().
+ */
+static void run_worker(zygote_request* request, char** arguments, char** environment,
+                       const char* resolved_path, int* fds) {
+  int next = 0;
+  int null_fd;
+
+  close(zygote_fd);
+  if (request->stdin_from_null) {
+    null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDIN_FILENO);
+      close(null_fd);
+    }
+  } else {
+    dup2(fds[next++], STDIN_FILENO);
+  }
+  dup2(fds[next++], STDOUT_FILENO);
+  dup2(fds[next++], STDERR_FILENO);
+  if (fchdir(fds[next++]) < 0) {
+    perror("fchdir");
+    _exit(1);
+  }
+  if (request->process_group >= 0) {
+    setpgid(0, request->process_group);
+    if (request->take_terminal) {
+      tcsetpgrp(STDIN_FILENO, request->process_group ? request->process_group : getpid());
+    }
+  }
+  signals_reset_in_child();
+  if (request->has_cgroup && write(fds[next], "0", 1) != 1) {
+    perror("cgroup.procs");
+  }
+  /* The zygote's copy of the variables is stale; use the shell's */
+  variables_replace_environment(environment);
+  execute_single_command(arguments, resolved_path[0] != '\0' ? resolved_path : NULL);
+  _exit(1);
+}
+
+/**
+ * Split count NUL-terminated strings starting at cursor into output
+ * @return Position after the last string, or NULL if the message is malformed
+ */
+static char* unpack_strings(char* cursor, char* end, int count, char** output) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (cursor == NULL || cursor >= end) {
+      return NULL;
+    }
+    output[i] = cursor;
+    cursor = memchr(cursor, '\0', end - cursor);
+    if (cursor == NULL) {
+      return NULL;
+    }
+    cursor++;
+  }
+  output[count] = NULL;
+  return cursor;
+}
+
+/**
+ * Zygote main loop: one worker per request until the shell goes away
+ */
+static void zygote_main(void) {
+  static char message_buffer[ZYGOTE_MESSAGE_SIZE];
+  char control[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+  struct iovec data = { message_buffer, sizeof(message_buffer) };
+  zygote_request* request = (zygote_request*)message_buffer;
+  struct msghdr message;
+  struct cmsghdr* header;
+  int fds[ZYGOTE_MAX_FDS];
+  char* resolved_path[2];
+  char** arguments;
+  char** environment;
+  char* cursor;
+  char* end;
+  ssize_t length;
+  int fd_count, i;
+  pid_t pid;
+
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  /* Workers must not write trace events to a descriptor number that is reused */
+  options_set("trace", false);
+  trace_update();
+  close_inherited_descriptors();
+  while (true) {
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    length = recvmsg(zygote_fd, &message, MSG_CMSG_CLOEXEC);
+    if (length <= 0) {
+      _exit(0);
+    }
+    fd_count = 0;
+    header = CMSG_FIRSTHDR(&message);
+    if (header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+      fd_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(header), fd_count * sizeof(int));
+    }
+    pid = -EINVAL;
+    end = message_buffer + length;
+    arguments = NULL;
+    environment = NULL;
+    if ((size_t)length > sizeof(zygote_request) && request->argument_count > 0 &&
+        request->environment_count >= 0 && fd_count == 3 + !request->stdin_from_null + request->has_cgroup) {
+      arguments = malloc((request->argument_count + 1) * sizeof(char*));
+      environment = malloc((request->environment_count + 1) * sizeof(char*));
+    }
+    if (arguments != NULL && environment != NULL) {
+      cursor = unpack_strings(message_buffer + sizeof(zygote_request), end, 1, resolved_path);
+      cursor = unpack_strings(cursor, end, request->argument_count, arguments);
+      if (unpack_strings(cursor, end, request->environment_count, environment) != NULL) {
+        /* Like fork(), but the new process is the shell's child */
+        pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+        if (pid == 0) {
+          run_worker(request, arguments, environment, resolved_path[0], fds);
+        }
+        if (pid < 0) {
+          pid = -errno;
+        }
+      }
+    }
+    free(arguments);
+    free(environment);
+    for (i = 0; i < fd_count; i++) {
+      close(fds[i]);
+    }
+    if (send(zygote_fd, &pid, sizeof(pid), MSG_NOSIGNAL) != sizeof(pid)) {
+      _exit(0);
+    }
+  }
+}
+
+/**
+ * Fork the zygote. Call early, while the shell is small; must come
+ * after jobs_initialize() so the zygote ignores the job control signals.
+ * @return false if it could not be started
+ */
+bool zygote_start(void) {
+  int sockets[2];
+
+  if (zygote_fd >= 0) {
+    return true;
+  }
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+    perror("socketpair");
+    return false;
+  }
+  io_core_flush();
+  zygote_pid = fork();
+  if (zygote_pid < 0) {
+    perror("fork");
+    close(sockets[0]);
+    close(sockets[1]);
+    return false;
+  }
+  if (zygote_pid == 0) {
+    close(sockets[0]);
+    zygote_fd = sockets[1];
+    zygote_main();
+  }
+  close(sockets[1]);
+  zygote_fd = sockets[0];
+  return true;
+}
+
+/**
+ * Give up on a zygote that stopped answering; later stages fork directly
+ */
+static void zygote_stop(void) {
+  close(zygote_fd);
+  zygote_fd = -1;
+  kill(zygote_pid, SIGKILL);
+  while (waitpid(zygote_pid, NULL, 0) < 0 && errno == EINTR) {
+  }
+  zygote_pid = -1;
+}
+
+/**
+ * Check whether stages should go through the zygote, starting it if
+ * "set -o zygote" was turned on since startup
+ */
+bool zygote_usable(void) {
+  /* The zygote's option table is a copy from its start */
+  if (!option_enabled(OPTION_ZYGOTE) || limits_pending() || sched_pending() ||
+      option_enabled(OPTION_FDCHECK)) {
+    return false;
+  }
+  return zygote_start();
+}
+
+/**
+ * Append a NUL-terminated string to the request
+ * @return false if it does not fit
+ */
+static bool pack_string(char* buffer, size_t* used, const char* text) {
+  size_t length = strlen(text) + 1;
+
+  if (*used + length > ZYGOTE_MESSAGE_SIZE) {
+    return false;
+  }
+  memcpy(buffer + *used, text, length);
+  *used += length;
+  return true;
+}
+
+/**
+ * Have the zygote start one pipeline stage
+ * @param arguments The stage's words, redirections included
+ * @param resolved_path Full path from the PATH cache, or NULL
+ * @param stdin_fd Descriptor for the stage's stdin (ignored with options->stdin_from_null)
+ * @param stdout_fd Descriptor for the stage's stdout
+ * @param cwd_fd Descriptor of the shell's working directory
+ * @param options Process group, terminal and cgroup, as for spawn_pipeline()
+ * @return pid of the new process (a child of the shell), or -1 to fork directly instead
+ */
+pid_t zygote_spawn(char* arguments[], const char* resolved_path, int stdin_fd, int stdout_fd,
+                   int cwd_fd, spawn_options* options) {
+  static char buffer[ZYGOTE_MESSAGE_SIZE];
+  zygote_request* request = (zygote_request*)buffer;
+  char control[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+  int fds[ZYGOTE_MAX_FDS];
+  struct iovec data;
+  struct msghdr message;
+  struct cmsghdr* header;
+  char** environment = variables_environment();
+  size_t used = sizeof(zygote_request);
+  int fd_count = 0;
+  pid_t pid;
+  int i;
+
+  if (arguments[0] == NULL) {
+    return -1;
+  }
+  memset(request, 0, sizeof(zygote_request));
+  request->process_group = options->process_group;
+  request->take_terminal = options->take_terminal;
+  request->stdin_from_null = options->stdin_from_null && stdin_fd == STDIN_FILENO;
+  request->has_cgroup = options->cgroup_procs_fd >= 0;
+  if (!pack_string(buffer, &used, resolved_path != NULL ? resolved_path : "")) {
+    return -1;
+  }
+  for (i = 0; arguments[i] != NULL; i++) {
+    if (!pack_string(buffer, &used, arguments[i])) {
+      return -1;
+    }
+  }
+  request->argument_count = i;
+  for (i = 0; environment[i] != NULL; i++) {
+    if (!pack_string(buffer, &used, environment[i])) {
+      return -1;
+    }
+  }
+  request->environment_count = i;
+
+  if (!request->stdin_from_null) {
+    fds[fd_count++] = stdin_fd;
+  }
+  fds[fd_count++] = stdout_fd;
+  fds[fd_count++] = STDERR_FILENO;
+  fds[fd_count++] = cwd_fd;
+  if (request->has_cgroup) {
+    fds[fd_count++] = options->cgroup_procs_fd;
+  }
+  data.iov_base = buffer;
+  data.iov_len = used;
+  memset(&message, 0, sizeof(message));
+  memset(control, 0, sizeof(control));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+  header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+  memcpy(CMSG_DATA(header), fds, fd_count * sizeof(int));
+
+  if (sendmsg(zygote_fd, &message, MSG_NOSIGNAL) < 0 ||
+      recv(zygote_fd, &pid, sizeof(pid), 0) != sizeof(pid)) {
+    perror("zygote");
+    zygote_stop();
+    return -1;
+  }
+  if (pid < 0) {
+    errno = -pid;
+    perror("zygote: clone");
+    return -1;
+  }
+  stats_add(COUNTER_ZYGOTE_SPAWNS, 1);
+  return pid;
+}